@@ -0,0 +1,324 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <sched.h>
+#include "net/buffers.h"
+#include "net/histogram.h"
+
+// Benchmark allocator and queue operations with 1..N threads and print the
+// results as JSON lines:
+//   allocator: buffer::allocator::get() + put().
+//   init:      buffer::init().
+//   queue:     N producers buffers::push_back() and one consumer
+//              buffers::pop(); the latency is the time spent in the queue.
+
+static const unsigned default_operations = 1000000;
+static const size_t default_size = 64;
+
+enum class benchmark {
+  allocator,
+  init,
+  queue
+};
+
+struct context {
+  benchmark bench;
+  unsigned thread;
+  unsigned operations;
+  size_t size;
+  bool pin;
+
+  net::buffer::allocator* allocator;
+  net::buffers* queue;
+
+  net::histogram* hist;
+};
+
+static void usage(const char* program);
+static void run(benchmark bench,
+                unsigned nthreads,
+                unsigned operations,
+                size_t size,
+                bool pin);
+
+static void* producer(void* arg);
+static void* consumer(void* arg);
+static void pin_thread(unsigned cpu);
+static uint64_t now();
+static const char* name(benchmark bench);
+
+int main(int argc, char** argv)
+{
+  long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+  unsigned max_threads = (ncpus > 1) ? static_cast<unsigned>(ncpus) : 1;
+  unsigned operations = default_operations;
+  size_t size = default_size;
+
+  int c;
+  while ((c = getopt(argc, argv, "t:n:s:")) != -1) {
+    switch (c) {
+      case 't':
+        max_threads = static_cast<unsigned>(atoi(optarg));
+        break;
+      case 'n':
+        operations = static_cast<unsigned>(atoi(optarg));
+        break;
+      case 's':
+        size = static_cast<size_t>(atoi(optarg));
+        break;
+      default:
+        usage(argv[0]);
+        return -1;
+    }
+  }
+
+  if ((optind != argc) ||
+      (max_threads == 0) ||
+      (operations == 0) ||
+      (size < sizeof(uint64_t))) {
+    usage(argv[0]);
+    return -1;
+  }
+
+  static const benchmark benchmarks[] = {
+    benchmark::allocator,
+    benchmark::init,
+    benchmark::queue
+  };
+
+  // For each benchmark...
+  for (size_t i = 0; i < sizeof(benchmarks) / sizeof(benchmarks[0]); i++) {
+    // Without and with CPU pinning.
+    for (int pin = 0; pin <= 1; pin++) {
+      // 1, 2, 4, ..., max_threads threads.
+      for (unsigned n = 1; ; n = (n * 2 < max_threads) ? n * 2 : max_threads) {
+        run(benchmarks[i], n, operations, size, pin != 0);
+
+        if (n == max_threads) {
+          break;
+        }
+      }
+    }
+  }
+
+  return 0;
+}
+
+void usage(const char* program)
+{
+  fprintf(stderr,
+          "Usage: %s [-t <max-threads>] [-n <operations>] [-s <size>]\n",
+          program);
+}
+
+void run(benchmark bench,
+         unsigned nthreads,
+         unsigned operations,
+         size_t size,
+         bool pin)
+{
+  net::buffer::allocator allocator;
+  net::buffers queue;
+
+  context* contexts = new context[nthreads + 1];
+  pthread_t* threads = new pthread_t[nthreads + 1];
+
+  // Thread 0 is the consumer (queue benchmark).
+  for (unsigned i = 0; i <= nthreads; i++) {
+    contexts[i].bench = bench;
+    contexts[i].thread = i;
+    contexts[i].operations = (i == 0) ? operations * nthreads : operations;
+    contexts[i].size = size;
+    contexts[i].pin = pin;
+    contexts[i].allocator = &allocator;
+    contexts[i].queue = &queue;
+    contexts[i].hist = new net::histogram();
+  }
+
+  const uint64_t start = now();
+
+  // Start threads.
+  unsigned first = (bench == benchmark::queue) ? 0 : 1;
+  for (unsigned i = first; i <= nthreads; i++) {
+    pthread_create(&threads[i],
+                   nullptr,
+                   (i == 0) ? consumer : producer,
+                   &contexts[i]);
+  }
+
+  // Wait for threads and merge histograms.
+  net::histogram hist;
+  for (unsigned i = first; i <= nthreads; i++) {
+    pthread_join(threads[i], nullptr);
+
+    // The latency of the queue is measured by the consumer.
+    if ((bench != benchmark::queue) || (i == 0)) {
+      hist.merge(*contexts[i].hist);
+    }
+  }
+
+  const double seconds = (now() - start) / 1e9;
+  const uint64_t ops = static_cast<uint64_t>(operations) * nthreads;
+
+  printf("{\"benchmark\":\"%s\",\"threads\":%u,\"pinned\":%s,\"size\":%zu,"
+         "\"operations\":%llu,\"seconds\":%.6f,\"ops_per_second\":%.0f,"
+         "\"latency_ns\":{\"min\":%llu,\"mean\":%.1f,\"p50\":%llu,"
+         "\"p90\":%llu,\"p99\":%llu,\"p99.9\":%llu,\"max\":%llu}}\n",
+         name(bench),
+         nthreads,
+         pin ? "true" : "false",
+         size,
+         static_cast<unsigned long long>(ops),
+         seconds,
+         ops / seconds,
+         static_cast<unsigned long long>(hist.min()),
+         hist.mean(),
+         static_cast<unsigned long long>(hist.percentile(50.0)),
+         static_cast<unsigned long long>(hist.percentile(90.0)),
+         static_cast<unsigned long long>(hist.percentile(99.0)),
+         static_cast<unsigned long long>(hist.percentile(99.9)),
+         static_cast<unsigned long long>(hist.max()));
+
+  fflush(stdout);
+
+  for (unsigned i = 0; i <= nthreads; i++) {
+    delete contexts[i].hist;
+  }
+
+  delete [] threads;
+  delete [] contexts;
+}
+
+void* producer(void* arg)
+{
+  context* ctx = static_cast<context*>(arg);
+
+  if (ctx->pin) {
+    pin_thread(ctx->thread);
+  }
+
+  uint8_t* data = static_cast<uint8_t*>(calloc(1, ctx->size));
+  if (!data) {
+    return nullptr;
+  }
+
+  switch (ctx->bench) {
+    case benchmark::allocator:
+      for (unsigned i = ctx->operations; i > 0; i--) {
+        const uint64_t t0 = now();
+
+        net::buffer* buf = ctx->allocator->get();
+        ctx->allocator->put(buf);
+
+        ctx->hist->record(now() - t0);
+      }
+
+      break;
+    case benchmark::init:
+      {
+        net::buffer* buf = ctx->allocator->get();
+
+        for (unsigned i = ctx->operations; i > 0; i--) {
+          const uint64_t t0 = now();
+
+          buf->init(data, ctx->size);
+
+          ctx->hist->record(now() - t0);
+        }
+
+        ctx->allocator->put(buf);
+      }
+
+      break;
+    case benchmark::queue:
+      for (unsigned i = ctx->operations; i > 0; i--) {
+        net::buffer* buf = ctx->allocator->get();
+
+        // Save the enqueue time in the buffer.
+        const uint64_t t0 = now();
+        memcpy(data, &t0, sizeof(uint64_t));
+
+        buf->init(data, ctx->size);
+        ctx->queue->push_back(buf);
+      }
+
+      break;
+  }
+
+  free(data);
+
+  return nullptr;
+}
+
+void* consumer(void* arg)
+{
+  context* ctx = static_cast<context*>(arg);
+
+  if (ctx->pin) {
+    pin_thread(ctx->thread);
+  }
+
+  unsigned left = ctx->operations;
+  while (left > 0) {
+    net::buffer* first;
+    net::buffer* last;
+    size_t count = ctx->queue->pop(first, last, 100);
+
+    if (count > 0) {
+      const uint64_t t1 = now();
+
+      net::buffer* buf = first;
+      for (; count > 0; count--) {
+        net::buffer* next = buf->next();
+
+        uint64_t t0;
+        memcpy(&t0, buf->data(), sizeof(uint64_t));
+
+        ctx->hist->record(t1 - t0);
+
+        ctx->allocator->put(buf);
+
+        buf = next;
+        left--;
+      }
+    }
+  }
+
+  return nullptr;
+}
+
+void pin_thread(unsigned cpu)
+{
+  const long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  CPU_SET(cpu % ((ncpus > 0) ? ncpus : 1), &set);
+
+  pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &set);
+}
+
+uint64_t now()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return (static_cast<uint64_t>(ts.tv_sec) * 1000000000ull) + ts.tv_nsec;
+}
+
+const char* name(benchmark bench)
+{
+  switch (bench) {
+    case benchmark::allocator:
+      return "allocator";
+    case benchmark::init:
+      return "init";
+    case benchmark::queue:
+    default:
+      return "queue";
+  }
+}
@@ -0,0 +1,481 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <limits.h>
+#include <dirent.h>
+#include <sys/inotify.h>
+#include <atomic>
+#include "net/sender.h"
+#include "net/receiver.h"
+#include "net/histogram.h"
+
+// Open-loop latency benchmark (from sender::send() to the receiver).
+//
+// The messages are scheduled at a fixed rate independently of how long the
+// previous sends took and each message carries its scheduled time: if the
+// sender falls behind, the time the messages wait to be sent is included in
+// the latency (no coordinated omission). The latency is recorded by a local
+// receiver in a histogram per phase:
+//   steady:    the receiver is running.
+//   reconnect: the receiver is restarted at the beginning of the phase.
+//   spill:     the receiver is stopped for <outage> seconds at the beginning
+//              of the phase (the sender writes the queued buffers to disk
+//              and replays them after reconnecting).
+// A JSON line is printed per phase, followed by a JSON line per latency
+// histogram of the sender (queue wait, send, connect, handshake and spill)
+// covering all the phases. With -t, the kernel transmit timestamps are
+// enabled and the tx_scheduled, tx_sent and tx_acknowledged histograms are
+// printed as well.
+
+static const char* const default_address = "127.0.0.1:45710";
+static const double default_rate = 1000;
+static const unsigned default_duration = 10;
+static const unsigned default_outage = 5;
+static const size_t default_size = 64;
+static const size_t default_window = 64;
+static const unsigned max_drain_seconds = 300;
+
+enum class phase {
+  steady,
+  reconnect,
+  spill
+};
+
+static const unsigned max_phases = 3;
+
+// Message header.
+struct header {
+  uint64_t scheduled;
+  uint32_t phase;
+};
+
+// Phase statistics.
+struct statistics {
+  net::histogram hist;
+  std::atomic<uint64_t> sent;
+};
+
+static statistics stats[max_phases];
+
+static void usage(const char* program);
+static bool parse_phases(const char* s, phase* phases, unsigned& nphases);
+static bool record_latency(net::envelope::decoder& decoder, void* user);
+static uint64_t received(unsigned nphases, const phase* phases);
+static unsigned count_spilled(int fd);
+static void remove_directory(const char* directory);
+static uint64_t now();
+static void sleep_until(uint64_t t);
+static const char* name(phase p);
+static void print_sender_latency(const char* name, const net::histogram& hist);
+
+int main(int argc, char** argv)
+{
+  const char* address = default_address;
+  double rate = default_rate;
+  unsigned duration = default_duration;
+  unsigned outage = default_outage;
+  size_t size = default_size;
+  size_t window = default_window;
+  bool tx_timestamps = false;
+  phase phases[max_phases] = {phase::steady, phase::reconnect, phase::spill};
+  unsigned nphases = max_phases;
+
+  int c;
+  while ((c = getopt(argc, argv, "a:r:d:o:s:w:tP:")) != -1) {
+    switch (c) {
+      case 'a':
+        address = optarg;
+        break;
+      case 'r':
+        rate = atof(optarg);
+        break;
+      case 'd':
+        duration = static_cast<unsigned>(atoi(optarg));
+        break;
+      case 'o':
+        outage = static_cast<unsigned>(atoi(optarg));
+        break;
+      case 's':
+        size = static_cast<size_t>(atoi(optarg));
+        break;
+      case 'w':
+        window = static_cast<size_t>(atoi(optarg));
+        break;
+      case 't':
+        tx_timestamps = true;
+        break;
+      case 'P':
+        if (!parse_phases(optarg, phases, nphases)) {
+          usage(argv[0]);
+          return -1;
+        }
+
+        break;
+      default:
+        usage(argv[0]);
+        return -1;
+    }
+  }
+
+  if ((optind != argc) ||
+      (rate <= 0) ||
+      (duration == 0) ||
+      (size < sizeof(header))) {
+    usage(argv[0]);
+    return -1;
+  }
+
+  // Create spool directory.
+  char directory[] = "/tmp/bench_latency.XXXXXX";
+  if (!mkdtemp(directory)) {
+    perror("mkdtemp");
+    return -1;
+  }
+
+  // Watch the files written to disk.
+  const int inotifyfd = inotify_init1(IN_NONBLOCK);
+  if ((inotifyfd == -1) ||
+      (inotify_add_watch(inotifyfd, directory, IN_CLOSE_WRITE) == -1)) {
+    perror("inotify");
+    remove_directory(directory);
+    return -1;
+  }
+
+  // Start receiver.
+  net::receiver receiver;
+  if (!receiver.start(address,
+                      net::receiver::encryption::no,
+                      record_latency,
+                      nullptr)) {
+    fprintf(stderr, "Error starting receiver.\n");
+    remove_directory(directory);
+    return -1;
+  }
+
+  net::buffer::allocator allocator;
+  net::sender sender(allocator);
+
+  // Without acknowledgements, the envelopes sent while the receiver is
+  // restarting would be lost.
+  sender.set_framing(net::sender::framing::envelope);
+  sender.set_window(window);
+  sender.set_latency_histograms(true);
+  sender.set_tx_timestamps(tx_timestamps);
+
+  if (!sender.start(address, net::sender::encryption::no, directory)) {
+    fprintf(stderr, "Error starting sender.\n");
+    remove_directory(directory);
+    return -1;
+  }
+
+  uint8_t* data = static_cast<uint8_t*>(calloc(1, size));
+  if (!data) {
+    remove_directory(directory);
+    return -1;
+  }
+
+  const uint64_t period = static_cast<uint64_t>(1e9 / rate);
+  uint64_t scheduled = now();
+
+  unsigned spilled[max_phases];
+
+  // For each phase...
+  for (unsigned i = 0; i < nphases; i++) {
+    const uint64_t end = scheduled + (duration * 1000000000ull);
+    uint64_t restart = 0;
+
+    switch (phases[i]) {
+      case phase::reconnect:
+        receiver.stop();
+        restart = scheduled;
+        break;
+      case phase::spill:
+        receiver.stop();
+        restart = scheduled + (outage * 1000000000ull);
+        break;
+      case phase::steady:
+      default:
+        break;
+    }
+
+    header hdr;
+    hdr.phase = static_cast<uint32_t>(phases[i]);
+
+    // Send messages at a fixed rate.
+    for (; scheduled < end; scheduled += period) {
+      // If the receiver has to be restarted...
+      if ((restart != 0) && (scheduled >= restart)) {
+        if (!receiver.start(address,
+                            net::receiver::encryption::no,
+                            record_latency,
+                            nullptr)) {
+          fprintf(stderr, "Error restarting receiver.\n");
+        }
+
+        restart = 0;
+      }
+
+      sleep_until(scheduled);
+
+      net::buffer* buf = allocator.get();
+      if (buf) {
+        hdr.scheduled = scheduled;
+        memcpy(data, &hdr, sizeof(header));
+
+        if (buf->init(data, size)) {
+          sender.send(buf);
+          stats[static_cast<unsigned>(phases[i])].sent++;
+        } else {
+          allocator.put(buf);
+        }
+      }
+    }
+
+    spilled[i] = count_spilled(inotifyfd);
+  }
+
+  // Wait for the remaining messages.
+  uint64_t total = 0;
+  for (unsigned i = 0; i < nphases; i++) {
+    total += stats[static_cast<unsigned>(phases[i])].sent.load();
+  }
+
+  const uint64_t deadline = now() + (max_drain_seconds * 1000000000ull);
+  while ((received(nphases, phases) < total) && (now() < deadline)) {
+    usleep(10000);
+  }
+
+  sender.stop();
+  receiver.stop();
+
+  // Files written to disk after the last phase.
+  spilled[nphases - 1] += count_spilled(inotifyfd);
+
+  for (unsigned i = 0; i < nphases; i++) {
+    const statistics& st = stats[static_cast<unsigned>(phases[i])];
+
+    printf("{\"benchmark\":\"latency\",\"phase\":\"%s\",\"rate\":%.0f,"
+           "\"size\":%zu,\"window\":%zu,\"sent\":%llu,\"received\":%llu,"
+           "\"spilled_files\":%u,\"latency_ns\":{\"min\":%llu,"
+           "\"mean\":%.1f,\"p50\":%llu,\"p90\":%llu,\"p99\":%llu,"
+           "\"p99.9\":%llu,\"max\":%llu}}\n",
+           name(phases[i]),
+           rate,
+           size,
+           window,
+           static_cast<unsigned long long>(st.sent.load()),
+           static_cast<unsigned long long>(st.hist.count()),
+           spilled[i],
+           static_cast<unsigned long long>(st.hist.min()),
+           st.hist.mean(),
+           static_cast<unsigned long long>(st.hist.percentile(50.0)),
+           static_cast<unsigned long long>(st.hist.percentile(90.0)),
+           static_cast<unsigned long long>(st.hist.percentile(99.0)),
+           static_cast<unsigned long long>(st.hist.percentile(99.9)),
+           static_cast<unsigned long long>(st.hist.max()));
+  }
+
+  net::sender::latency_histograms* latency =
+    new net::sender::latency_histograms();
+
+  if (sender.latency(*latency)) {
+    print_sender_latency("queue_wait", latency->queue_wait);
+    print_sender_latency("send", latency->send);
+    print_sender_latency("connect", latency->connect);
+    print_sender_latency("handshake", latency->handshake);
+    print_sender_latency("spill", latency->spill);
+
+    if (tx_timestamps) {
+      print_sender_latency("tx_scheduled", latency->tx_scheduled);
+      print_sender_latency("tx_sent", latency->tx_sent);
+      print_sender_latency("tx_acknowledged", latency->tx_acknowledged);
+    }
+  }
+
+  delete latency;
+
+  free(data);
+
+  close(inotifyfd);
+  remove_directory(directory);
+
+  return (received(nphases, phases) == total) ? 0 : -1;
+}
+
+void usage(const char* program)
+{
+  fprintf(stderr,
+          "Usage: %s [-a <address>] [-r <rate>] [-d <duration>] "
+          "[-o <outage>] [-s <size>] [-w <window>] [-t] [-P <phases>]\n"
+          "  <rate>:     messages per second.\n"
+          "  <duration>: seconds per phase.\n"
+          "  <outage>:   seconds the receiver is stopped in the spill phase.\n"
+          "  <phases>:   comma-separated list of steady, reconnect and "
+          "spill.\n",
+          program);
+}
+
+bool parse_phases(const char* s, phase* phases, unsigned& nphases)
+{
+  nphases = 0;
+
+  do {
+    const char* end = strchr(s, ',');
+    const size_t len = end ? static_cast<size_t>(end - s) : strlen(s);
+
+    if (nphases == max_phases) {
+      return false;
+    }
+
+    if ((len == 6) && (strncmp(s, "steady", len) == 0)) {
+      phases[nphases++] = phase::steady;
+    } else if ((len == 9) && (strncmp(s, "reconnect", len) == 0)) {
+      phases[nphases++] = phase::reconnect;
+    } else if ((len == 5) && (strncmp(s, "spill", len) == 0)) {
+      phases[nphases++] = phase::spill;
+    } else {
+      return false;
+    }
+
+    // Each phase can only appear once.
+    for (unsigned i = 0; i + 1 < nphases; i++) {
+      if (phases[i] == phases[nphases - 1]) {
+        return false;
+      }
+    }
+
+    s = end ? end + 1 : nullptr;
+  } while (s);
+
+  return true;
+}
+
+bool record_latency(net::envelope::decoder& decoder, void* user)
+{
+  const uint64_t t = now();
+
+  const void* data;
+  size_t len;
+  while (decoder.next(data, len)) {
+    if (len >= sizeof(header)) {
+      header hdr;
+      memcpy(&hdr, data, sizeof(header));
+
+      if (hdr.phase < max_phases) {
+        stats[hdr.phase].hist.record((t > hdr.scheduled) ?
+                                       t - hdr.scheduled :
+                                       0);
+      }
+    }
+  }
+
+  return true;
+}
+
+uint64_t received(unsigned nphases, const phase* phases)
+{
+  uint64_t count = 0;
+  for (unsigned i = 0; i < nphases; i++) {
+    count += stats[static_cast<unsigned>(phases[i])].hist.count();
+  }
+
+  return count;
+}
+
+unsigned count_spilled(int fd)
+{
+  unsigned count = 0;
+
+  char buf[64 * 1024]
+  __attribute__ ((aligned(__alignof__(struct inotify_event))));
+
+  ssize_t ret;
+  while ((ret = read(fd, buf, sizeof(buf))) > 0) {
+    for (ssize_t off = 0; off < ret; ) {
+      const struct inotify_event* ev =
+        reinterpret_cast<const struct inotify_event*>(buf + off);
+
+      if (ev->mask & IN_CLOSE_WRITE) {
+        count++;
+      }
+
+      off += sizeof(struct inotify_event) + ev->len;
+    }
+  }
+
+  return count;
+}
+
+void remove_directory(const char* directory)
+{
+  DIR* dir = opendir(directory);
+  if (dir) {
+    struct dirent* entry;
+    while ((entry = readdir(dir)) != nullptr) {
+      if (entry->d_name[0] != '.') {
+        char filename[PATH_MAX];
+        snprintf(filename,
+                 sizeof(filename),
+                 "%s/%s",
+                 directory,
+                 entry->d_name);
+
+        unlink(filename);
+      }
+    }
+
+    closedir(dir);
+  }
+
+  rmdir(directory);
+}
+
+uint64_t now()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return (static_cast<uint64_t>(ts.tv_sec) * 1000000000ull) + ts.tv_nsec;
+}
+
+void sleep_until(uint64_t t)
+{
+  struct timespec ts;
+  ts.tv_sec = t / 1000000000ull;
+  ts.tv_nsec = t % 1000000000ull;
+
+  while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, nullptr) != 0);
+}
+
+const char* name(phase p)
+{
+  switch (p) {
+    case phase::steady:
+      return "steady";
+    case phase::reconnect:
+      return "reconnect";
+    case phase::spill:
+    default:
+      return "spill";
+  }
+}
+
+void print_sender_latency(const char* name, const net::histogram& hist)
+{
+  printf("{\"benchmark\":\"sender_latency\",\"histogram\":\"%s\","
+         "\"count\":%llu,\"latency_ns\":{\"min\":%llu,\"mean\":%.1f,"
+         "\"p50\":%llu,\"p90\":%llu,\"p99\":%llu,\"p99.9\":%llu,"
+         "\"max\":%llu}}\n",
+         name,
+         static_cast<unsigned long long>(hist.count()),
+         static_cast<unsigned long long>(hist.min()),
+         hist.mean(),
+         static_cast<unsigned long long>(hist.percentile(50.0)),
+         static_cast<unsigned long long>(hist.percentile(90.0)),
+         static_cast<unsigned long long>(hist.percentile(99.0)),
+         static_cast<unsigned long long>(hist.percentile(99.9)),
+         static_cast<unsigned long long>(hist.max()));
+}
@@ -0,0 +1,581 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <limits.h>
+#include <signal.h>
+#include <pthread.h>
+#include <dirent.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+#include <sys/inotify.h>
+#include <math.h>
+#include <atomic>
+#include <new>
+#include "net/sender.h"
+#include "net/receiver.h"
+#include "net/ssl/library.h"
+
+// Loopback throughput benchmark.
+//
+// Starts a sink (net::receiver) in a child process listening on TCP, TLS
+// (with cert.pem and key.pem from the current directory) or a Unix-domain
+// socket, drives a net::sender from several producer threads and prints the
+// result as a JSON line. The CPU time is the one of this process (producers
+// and sender thread), the sink is not included.
+
+static const unsigned default_producers = 1;
+static const unsigned default_messages = 10000;
+static const in_port_t port = 45700;
+static const unsigned max_seconds = 60;
+
+enum class transport {
+  tcp,
+  tls,
+  local
+};
+
+// Message size distribution.
+struct distribution {
+  enum class type {
+    fixed,
+    uniform,
+    exponential
+  };
+
+  type t;
+  size_t min;
+  size_t max;
+};
+
+// Counters shared with the sink process.
+struct counters {
+  std::atomic<uint64_t> records;
+  std::atomic<uint64_t> bytes;
+};
+
+struct producer_context {
+  net::buffer::allocator* allocator;
+  net::sender* sender;
+  const distribution* dist;
+  unsigned messages;
+  double rate;
+  unsigned seed;
+  uint64_t bytes;
+};
+
+static void usage(const char* program);
+static bool parse_distribution(const char* s, distribution& dist);
+static size_t next_size(const distribution& dist, uint64_t& state);
+static void sink(transport t,
+                 const char* address,
+                 counters* cnt,
+                 int readyfd,
+                 int quitfd);
+static bool count_envelope(net::envelope::decoder& decoder, void* user);
+static void* produce(void* arg);
+static unsigned count_spilled(int fd);
+static void remove_directory(const char* directory);
+static uint64_t now();
+static uint64_t cpu_time();
+static const char* name(transport t);
+
+int main(int argc, char** argv)
+{
+  transport t = transport::tcp;
+  unsigned producers = default_producers;
+  unsigned messages = default_messages;
+  const char* size = "fixed:64";
+  double rate = 0;
+  size_t window = 0;
+  bool flow_control = false;
+
+  int c;
+  while ((c = getopt(argc, argv, "m:p:n:s:r:w:f")) != -1) {
+    switch (c) {
+      case 'm':
+        if (strcmp(optarg, "tcp") == 0) {
+          t = transport::tcp;
+        } else if (strcmp(optarg, "tls") == 0) {
+          t = transport::tls;
+        } else if (strcmp(optarg, "unix") == 0) {
+          t = transport::local;
+        } else {
+          usage(argv[0]);
+          return -1;
+        }
+
+        break;
+      case 'p':
+        producers = static_cast<unsigned>(atoi(optarg));
+        break;
+      case 'n':
+        messages = static_cast<unsigned>(atoi(optarg));
+        break;
+      case 's':
+        size = optarg;
+        break;
+      case 'r':
+        rate = atof(optarg);
+        break;
+      case 'w':
+        window = static_cast<size_t>(atoi(optarg));
+        break;
+      case 'f':
+        flow_control = true;
+        break;
+      default:
+        usage(argv[0]);
+        return -1;
+    }
+  }
+
+  distribution dist;
+  if ((optind != argc) ||
+      (producers == 0) ||
+      (messages == 0) ||
+      (!parse_distribution(size, dist)) ||
+      ((flow_control) && (window == 0))) {
+    usage(argv[0]);
+    return -1;
+  }
+
+  // Build address.
+  char address[PATH_MAX];
+  if (t == transport::local) {
+    snprintf(address,
+             sizeof(address),
+             "/tmp/bench_sender.%ld.sock",
+             static_cast<long>(getpid()));
+
+    unlink(address);
+  } else {
+    snprintf(address, sizeof(address), "127.0.0.1:%u", port);
+  }
+
+  // Create spool directory.
+  char directory[] = "/tmp/bench_sender.XXXXXX";
+  if (!mkdtemp(directory)) {
+    perror("mkdtemp");
+    return -1;
+  }
+
+  // Watch the files written to disk.
+  const int inotifyfd = inotify_init1(IN_NONBLOCK);
+  if ((inotifyfd == -1) ||
+      (inotify_add_watch(inotifyfd, directory, IN_CLOSE_WRITE) == -1)) {
+    perror("inotify");
+    remove_directory(directory);
+    return -1;
+  }
+
+  // Counters shared with the sink.
+  counters* cnt = static_cast<counters*>(mmap(nullptr,
+                                              sizeof(counters),
+                                              PROT_READ | PROT_WRITE,
+                                              MAP_SHARED | MAP_ANONYMOUS,
+                                              -1,
+                                              0));
+
+  if (cnt == MAP_FAILED) {
+    perror("mmap");
+    remove_directory(directory);
+    return -1;
+  }
+
+  new (cnt) counters();
+
+  int readyfds[2];
+  int quitfds[2];
+  if ((pipe(readyfds) != 0) || (pipe(quitfds) != 0)) {
+    perror("pipe");
+    remove_directory(directory);
+    return -1;
+  }
+
+  // Start sink (before creating any thread).
+  const pid_t pid = fork();
+  if (pid == 0) {
+    close(readyfds[0]);
+    close(quitfds[1]);
+
+    sink(t, address, cnt, readyfds[1], quitfds[0]);
+
+    _exit(0);
+  } else if (pid == -1) {
+    perror("fork");
+    remove_directory(directory);
+    return -1;
+  }
+
+  close(readyfds[1]);
+  close(quitfds[0]);
+
+  // Wait for the sink to be ready.
+  char ready = 0;
+  if ((read(readyfds[0], &ready, 1) != 1) || (ready != 1)) {
+    fprintf(stderr, "Error starting sink.\n");
+    waitpid(pid, nullptr, 0);
+    remove_directory(directory);
+    return -1;
+  }
+
+  // Initialize OpenSSL (client).
+  net::ssl::library openssl;
+  if ((t == transport::tls) && (!openssl.init())) {
+    fprintf(stderr, "Error initializing OpenSSL.\n");
+    close(quitfds[1]);
+    waitpid(pid, nullptr, 0);
+    remove_directory(directory);
+    return -1;
+  }
+
+  net::buffer::allocator allocator;
+  net::sender sender(allocator);
+
+  sender.set_framing(net::sender::framing::envelope);
+  sender.set_window(window);
+  sender.set_flow_control(flow_control);
+
+  int ret = -1;
+
+  // Start sender.
+  if (sender.start(address,
+                   (t == transport::tls) ? net::sender::encryption::yes :
+                                           net::sender::encryption::no,
+                   directory)) {
+    producer_context* contexts = new producer_context[producers];
+    pthread_t* threads = new pthread_t[producers];
+
+    const uint64_t cpu0 = cpu_time();
+    const uint64_t start = now();
+
+    // Start producers.
+    for (unsigned i = 0; i < producers; i++) {
+      contexts[i].allocator = &allocator;
+      contexts[i].sender = &sender;
+      contexts[i].dist = &dist;
+      contexts[i].messages = messages;
+      contexts[i].rate = rate / producers;
+      contexts[i].seed = i + 1;
+      contexts[i].bytes = 0;
+
+      pthread_create(&threads[i], nullptr, produce, &contexts[i]);
+    }
+
+    uint64_t bytes = 0;
+    for (unsigned i = 0; i < producers; i++) {
+      pthread_join(threads[i], nullptr);
+      bytes += contexts[i].bytes;
+    }
+
+    // Wait for the sink to receive all the messages.
+    const uint64_t total = static_cast<uint64_t>(producers) * messages;
+    const uint64_t deadline = start + (max_seconds * 1000000000ull);
+    while ((cnt->records.load() < total) && (now() < deadline)) {
+      usleep(1000);
+    }
+
+    const uint64_t end = now();
+    const uint64_t cpu = cpu_time() - cpu0;
+
+    sender.stop();
+
+    const uint64_t received = cnt->records.load();
+    const double seconds = (end - start) / 1e9;
+
+    printf("{\"benchmark\":\"sender\",\"transport\":\"%s\",\"producers\":%u,"
+           "\"size\":\"%s\",\"rate\":%.0f,\"window\":%zu,"
+           "\"flow_control\":%s,\"messages\":%llu,\"bytes\":%llu,"
+           "\"received\":%llu,\"seconds\":%.6f,\"msgs_per_second\":%.0f,"
+           "\"bytes_per_second\":%.0f,\"cpu_ns_per_message\":%.1f,"
+           "\"spilled_files\":%u}\n",
+           name(t),
+           producers,
+           size,
+           rate,
+           window,
+           flow_control ? "true" : "false",
+           static_cast<unsigned long long>(total),
+           static_cast<unsigned long long>(bytes),
+           static_cast<unsigned long long>(received),
+           seconds,
+           received / seconds,
+           cnt->bytes.load() / seconds,
+           static_cast<double>(cpu) / total,
+           count_spilled(inotifyfd));
+
+    delete [] threads;
+    delete [] contexts;
+
+    ret = (received == total) ? 0 : -1;
+  } else {
+    fprintf(stderr, "Error starting sender.\n");
+  }
+
+  // Stop sink.
+  close(quitfds[1]);
+  waitpid(pid, nullptr, 0);
+
+  close(inotifyfd);
+  remove_directory(directory);
+
+  if (t == transport::local) {
+    unlink(address);
+  }
+
+  return ret;
+}
+
+void usage(const char* program)
+{
+  fprintf(stderr,
+          "Usage: %s [-m tcp|tls|unix] [-p <producers>] [-n <messages>] "
+          "[-s <size>] [-r <rate>] [-w <window> [-f]]\n"
+          "  <messages>: messages per producer.\n"
+          "  <size>:     fixed:<n> | uniform:<min>-<max> | "
+          "exponential:<mean>.\n"
+          "  <rate>:     total messages per second (0: unlimited).\n"
+          "  -f:         flow control.\n",
+          program);
+}
+
+bool parse_distribution(const char* s, distribution& dist)
+{
+  unsigned long min, max;
+
+  if (sscanf(s, "fixed:%lu", &min) == 1) {
+    dist.t = distribution::type::fixed;
+    dist.min = min;
+    dist.max = min;
+  } else if (sscanf(s, "uniform:%lu-%lu", &min, &max) == 2) {
+    if (min > max) {
+      return false;
+    }
+
+    dist.t = distribution::type::uniform;
+    dist.min = min;
+    dist.max = max;
+  } else if (sscanf(s, "exponential:%lu", &min) == 1) {
+    dist.t = distribution::type::exponential;
+    dist.min = min;
+    dist.max = min;
+  } else {
+    return false;
+  }
+
+  return (dist.min > 0);
+}
+
+size_t next_size(const distribution& dist, uint64_t& state)
+{
+  // xorshift64.
+  state ^= state << 13;
+  state ^= state >> 7;
+  state ^= state << 17;
+
+  switch (dist.t) {
+    case distribution::type::uniform:
+      return dist.min + (state % (dist.max - dist.min + 1));
+    case distribution::type::exponential:
+      {
+        const double u = (state >> 11) * (1.0 / 9007199254740992.0);
+        const size_t size = static_cast<size_t>(-log1p(-u) * dist.min);
+
+        return (size > 0) ? size : 1;
+      }
+    case distribution::type::fixed:
+    default:
+      return dist.min;
+  }
+}
+
+void sink(transport t,
+          const char* address,
+          counters* cnt,
+          int readyfd,
+          int quitfd)
+{
+  char ready = 0;
+
+  // Initialize OpenSSL (server).
+  net::ssl::library openssl;
+  if ((t != transport::tls) ||
+      ((openssl.init()) &&
+       (openssl.load_certificate("cert.pem")) &&
+       (openssl.load_private_key("key.pem")))) {
+    net::receiver receiver;
+    if (receiver.start(address,
+                       (t == transport::tls) ?
+                         net::receiver::encryption::yes :
+                         net::receiver::encryption::no,
+                       count_envelope,
+                       cnt)) {
+      ready = 1;
+      write(readyfd, &ready, 1);
+
+      // Wait for the parent to close the pipe.
+      char c;
+      while (read(quitfd, &c, 1) > 0);
+
+      return;
+    }
+  }
+
+  write(readyfd, &ready, 1);
+}
+
+bool count_envelope(net::envelope::decoder& decoder, void* user)
+{
+  counters* cnt = static_cast<counters*>(user);
+
+  uint64_t bytes = 0;
+
+  const void* data;
+  size_t len;
+  while (decoder.next(data, len)) {
+    bytes += len;
+  }
+
+  cnt->bytes.fetch_add(bytes, std::memory_order_relaxed);
+  cnt->records.fetch_add(decoder.count(), std::memory_order_relaxed);
+
+  return true;
+}
+
+void* produce(void* arg)
+{
+  producer_context* ctx = static_cast<producer_context*>(arg);
+
+  // Size of the biggest message.
+  size_t maxsize = 0;
+  uint64_t state = ctx->seed * 0x9e3779b97f4a7c15ull;
+
+  size_t* sizes = new size_t[ctx->messages];
+  for (unsigned i = 0; i < ctx->messages; i++) {
+    sizes[i] = next_size(*ctx->dist, state);
+
+    if (sizes[i] > maxsize) {
+      maxsize = sizes[i];
+    }
+  }
+
+  uint8_t* data = static_cast<uint8_t*>(malloc(maxsize));
+  if (data) {
+    memset(data, 'x', maxsize);
+
+    const uint64_t start = now();
+
+    for (unsigned i = 0; i < ctx->messages; i++) {
+      // If the rate is limited...
+      if (ctx->rate > 0) {
+        const uint64_t when = start + static_cast<uint64_t>(i * 1e9 /
+                                                            ctx->rate);
+
+        const uint64_t t = now();
+        if (when > t) {
+          struct timespec ts;
+          ts.tv_sec = (when - t) / 1000000000ull;
+          ts.tv_nsec = (when - t) % 1000000000ull;
+
+          nanosleep(&ts, nullptr);
+        }
+      }
+
+      net::buffer* buf = ctx->allocator->get();
+      if ((buf) && (buf->init(data, sizes[i]))) {
+        ctx->sender->send(buf);
+        ctx->bytes += sizes[i];
+      }
+    }
+
+    free(data);
+  }
+
+  delete [] sizes;
+
+  return nullptr;
+}
+
+unsigned count_spilled(int fd)
+{
+  unsigned count = 0;
+
+  char buf[64 * 1024]
+  __attribute__ ((aligned(__alignof__(struct inotify_event))));
+
+  ssize_t ret;
+  while ((ret = read(fd, buf, sizeof(buf))) > 0) {
+    for (ssize_t off = 0; off < ret; ) {
+      const struct inotify_event* ev =
+        reinterpret_cast<const struct inotify_event*>(buf + off);
+
+      if (ev->mask & IN_CLOSE_WRITE) {
+        count++;
+      }
+
+      off += sizeof(struct inotify_event) + ev->len;
+    }
+  }
+
+  return count;
+}
+
+void remove_directory(const char* directory)
+{
+  DIR* dir = opendir(directory);
+  if (dir) {
+    struct dirent* entry;
+    while ((entry = readdir(dir)) != nullptr) {
+      if (entry->d_name[0] != '.') {
+        char filename[PATH_MAX];
+        snprintf(filename,
+                 sizeof(filename),
+                 "%s/%s",
+                 directory,
+                 entry->d_name);
+
+        unlink(filename);
+      }
+    }
+
+    closedir(dir);
+  }
+
+  rmdir(directory);
+}
+
+uint64_t now()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return (static_cast<uint64_t>(ts.tv_sec) * 1000000000ull) + ts.tv_nsec;
+}
+
+uint64_t cpu_time()
+{
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+
+  return ((static_cast<uint64_t>(usage.ru_utime.tv_sec) +
+           usage.ru_stime.tv_sec) * 1000000000ull) +
+         ((static_cast<uint64_t>(usage.ru_utime.tv_usec) +
+           usage.ru_stime.tv_usec) * 1000ull);
+}
+
+const char* name(transport t)
+{
+  switch (t) {
+    case transport::tcp:
+      return "tcp";
+    case transport::tls:
+      return "tls";
+    case transport::local:
+    default:
+      return "unix";
+  }
+}
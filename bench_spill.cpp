@@ -0,0 +1,291 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <limits.h>
+#include <dirent.h>
+#include <atomic>
+#include "net/sender.h"
+#include "net/receiver.h"
+
+// Spill and recovery benchmark.
+//
+// Sends messages at a fixed rate to a local receiver, stops the receiver
+// for <outage> seconds (the sender writes the queued buffers to disk) and
+// restarts it. Measures how long it takes to deliver the backlog after the
+// receiver has been restarted and prints a JSON line with the disk
+// statistics of the sender.
+
+static const char* const default_address = "127.0.0.1:45720";
+static const double default_rate = 5000;
+static const unsigned default_warmup = 2;
+static const unsigned default_outage = 10;
+static const size_t default_size = 256;
+static const size_t default_window = 64;
+static const unsigned max_drain_seconds = 600;
+
+static std::atomic<uint64_t> received(0);
+static std::atomic<uint64_t> first_received(0);
+
+static void usage(const char* program);
+static bool count_records(net::envelope::decoder& decoder, void* user);
+static bool directory_empty(const char* directory);
+static void remove_directory(const char* directory);
+static uint64_t now();
+static void sleep_until(uint64_t t);
+
+int main(int argc, char** argv)
+{
+  const char* address = default_address;
+  double rate = default_rate;
+  unsigned warmup = default_warmup;
+  unsigned outage = default_outage;
+  size_t size = default_size;
+  size_t window = default_window;
+
+  int c;
+  while ((c = getopt(argc, argv, "a:r:u:o:s:w:")) != -1) {
+    switch (c) {
+      case 'a':
+        address = optarg;
+        break;
+      case 'r':
+        rate = atof(optarg);
+        break;
+      case 'u':
+        warmup = static_cast<unsigned>(atoi(optarg));
+        break;
+      case 'o':
+        outage = static_cast<unsigned>(atoi(optarg));
+        break;
+      case 's':
+        size = static_cast<size_t>(atoi(optarg));
+        break;
+      case 'w':
+        window = static_cast<size_t>(atoi(optarg));
+        break;
+      default:
+        usage(argv[0]);
+        return -1;
+    }
+  }
+
+  if ((optind != argc) || (rate <= 0) || (outage == 0) || (size == 0)) {
+    usage(argv[0]);
+    return -1;
+  }
+
+  // Create spool directory.
+  char directory[] = "/tmp/bench_spill.XXXXXX";
+  if (!mkdtemp(directory)) {
+    perror("mkdtemp");
+    return -1;
+  }
+
+  // Start receiver.
+  net::receiver receiver;
+  if (!receiver.start(address,
+                      net::receiver::encryption::no,
+                      count_records,
+                      nullptr)) {
+    fprintf(stderr, "Error starting receiver.\n");
+    remove_directory(directory);
+    return -1;
+  }
+
+  net::buffer::allocator allocator;
+  net::sender sender(allocator);
+
+  sender.set_framing(net::sender::framing::envelope);
+  sender.set_window(window);
+
+  if (!sender.start(address, net::sender::encryption::no, directory)) {
+    fprintf(stderr, "Error starting sender.\n");
+    remove_directory(directory);
+    return -1;
+  }
+
+  uint8_t* data = static_cast<uint8_t*>(malloc(size));
+  if (!data) {
+    remove_directory(directory);
+    return -1;
+  }
+
+  memset(data, 'x', size);
+
+  const uint64_t period = static_cast<uint64_t>(1e9 / rate);
+  const uint64_t start = now();
+  const uint64_t stop = start + (warmup * 1000000000ull);
+  const uint64_t restart = stop + (outage * 1000000000ull);
+
+  bool stopped = false;
+  uint64_t sent = 0;
+
+  // Send messages at a fixed rate until the receiver is restarted.
+  for (uint64_t scheduled = start; scheduled < restart; scheduled += period) {
+    // If the outage begins...
+    if ((!stopped) && (scheduled >= stop)) {
+      receiver.stop();
+      stopped = true;
+    }
+
+    sleep_until(scheduled);
+
+    net::buffer* buf = allocator.get();
+    if (buf) {
+      if (buf->init(data, size)) {
+        sender.send(buf);
+        sent++;
+      } else {
+        allocator.put(buf);
+      }
+    }
+  }
+
+  // Restart receiver.
+  first_received = 0;
+  const uint64_t restarted = now();
+
+  if (!receiver.start(address,
+                      net::receiver::encryption::no,
+                      count_records,
+                      nullptr)) {
+    fprintf(stderr, "Error restarting receiver.\n");
+    free(data);
+    remove_directory(directory);
+    return -1;
+  }
+
+  // Wait for the backlog to be delivered.
+  const uint64_t deadline = restarted + (max_drain_seconds * 1000000000ull);
+  while (((received.load() < sent) || (!directory_empty(directory))) &&
+         (now() < deadline)) {
+    usleep(10000);
+  }
+
+  const uint64_t drained = now();
+
+  sender.stop();
+  receiver.stop();
+
+  net::sender::statistics stats;
+  sender.stats(stats);
+
+  const uint64_t first = first_received.load();
+
+  printf("{\"benchmark\":\"spill\",\"rate\":%.0f,\"size\":%zu,"
+         "\"window\":%zu,\"outage_seconds\":%u,\"sent\":%llu,"
+         "\"received\":%llu,\"buffers_saved\":%llu,\"bytes_written\":%llu,"
+         "\"save_seconds\":%.6f,\"files_sent\":%llu,\"bytes_read\":%llu,"
+         "\"scan_seconds\":%.6f,\"io_seconds\":%.6f,"
+         "\"network_seconds\":%.6f,\"reconnect_seconds\":%.6f,"
+         "\"drain_seconds\":%.6f}\n",
+         rate,
+         size,
+         window,
+         outage,
+         static_cast<unsigned long long>(sent),
+         static_cast<unsigned long long>(received.load()),
+         static_cast<unsigned long long>(stats.buffers_spilled),
+         static_cast<unsigned long long>(stats.bytes_spilled),
+         stats.save_time / 1e9,
+         static_cast<unsigned long long>(stats.files_replayed),
+         static_cast<unsigned long long>(stats.bytes_replayed),
+         stats.scan_time / 1e9,
+         stats.io_time / 1e9,
+         stats.network_time / 1e9,
+         (first > restarted) ? (first - restarted) / 1e9 : 0.0,
+         (drained - restarted) / 1e9);
+
+  free(data);
+
+  remove_directory(directory);
+
+  return (received.load() == sent) ? 0 : -1;
+}
+
+void usage(const char* program)
+{
+  fprintf(stderr,
+          "Usage: %s [-a <address>] [-r <rate>] [-u <warmup>] [-o <outage>] "
+          "[-s <size>] [-w <window>]\n"
+          "  <rate>:   messages per second.\n"
+          "  <warmup>: seconds before the outage.\n"
+          "  <outage>: seconds the receiver is stopped.\n",
+          program);
+}
+
+bool count_records(net::envelope::decoder& decoder, void* user)
+{
+  // Save the time of the first envelope received after the restart.
+  if (first_received.load(std::memory_order_relaxed) == 0) {
+    first_received = now();
+  }
+
+  received.fetch_add(decoder.count(), std::memory_order_relaxed);
+
+  return true;
+}
+
+bool directory_empty(const char* directory)
+{
+  bool empty = true;
+
+  DIR* dir = opendir(directory);
+  if (dir) {
+    struct dirent* entry;
+    while ((entry = readdir(dir)) != nullptr) {
+      if (entry->d_name[0] != '.') {
+        empty = false;
+        break;
+      }
+    }
+
+    closedir(dir);
+  }
+
+  return empty;
+}
+
+void remove_directory(const char* directory)
+{
+  DIR* dir = opendir(directory);
+  if (dir) {
+    struct dirent* entry;
+    while ((entry = readdir(dir)) != nullptr) {
+      if (entry->d_name[0] != '.') {
+        char filename[PATH_MAX];
+        snprintf(filename,
+                 sizeof(filename),
+                 "%s/%s",
+                 directory,
+                 entry->d_name);
+
+        unlink(filename);
+      }
+    }
+
+    closedir(dir);
+  }
+
+  rmdir(directory);
+}
+
+uint64_t now()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return (static_cast<uint64_t>(ts.tv_sec) * 1000000000ull) + ts.tv_nsec;
+}
+
+void sleep_until(uint64_t t)
+{
+  struct timespec ts;
+  ts.tv_sec = t / 1000000000ull;
+  ts.tv_nsec = t % 1000000000ull;
+
+  while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, nullptr) != 0);
+}
@@ -0,0 +1,420 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+#include <openssl/crypto.h>
+#include "net/ssl/library.h"
+#include "net/ssl/socket.h"
+
+// TLS benchmark.
+//
+// Starts a TLS server (cert.pem and key.pem from the current directory) in
+// a child process and measures:
+//   handshake: full and resumed handshakes per second (including the TCP
+//              connection).
+//   bulk:      send() throughput by record size and CPU time per GB of the
+//              sender (encryption) and of the server (decryption).
+// The results are printed as JSON lines.
+
+static const char* const default_address = "127.0.0.1:45730";
+static const unsigned default_handshakes = 1000;
+static const size_t default_bytes = 64 * 1024 * 1024;
+static const int timeout = 5000;
+
+static const size_t record_sizes[] = {256, 1024, 4096, 16384};
+
+// Commands.
+static const char handshake_command = 'h';
+static const char bulk_command = 'b';
+
+static void usage(const char* program);
+static void server(const net::socket::address& addr, int readyfd);
+static bool serve(net::ssl::socket& sock);
+static bool handshake(const net::socket::address& addr,
+                      SSL_SESSION* session,
+                      bool& reused,
+                      SSL_SESSION** newsession);
+static bool bulk(const net::socket::address& addr, size_t size, size_t bytes);
+static bool bench_handshakes(const net::socket::address& addr,
+                             unsigned count,
+                             bool resume);
+static bool recv_all(net::ssl::socket& sock, void* buf, size_t len);
+static uint64_t now();
+static uint64_t cpu_time();
+
+int main(int argc, char** argv)
+{
+  const char* address = default_address;
+  unsigned handshakes = default_handshakes;
+  size_t bytes = default_bytes;
+
+  int c;
+  while ((c = getopt(argc, argv, "a:n:b:")) != -1) {
+    switch (c) {
+      case 'a':
+        address = optarg;
+        break;
+      case 'n':
+        handshakes = static_cast<unsigned>(atoi(optarg));
+        break;
+      case 'b':
+        bytes = static_cast<size_t>(atoll(optarg));
+        break;
+      default:
+        usage(argv[0]);
+        return -1;
+    }
+  }
+
+  net::socket::address addr;
+  if ((optind != argc) ||
+      (handshakes == 0) ||
+      (bytes == 0) ||
+      (!addr.build(address))) {
+    usage(argv[0]);
+    return -1;
+  }
+
+  int readyfds[2];
+  if (pipe(readyfds) != 0) {
+    perror("pipe");
+    return -1;
+  }
+
+  // Start server.
+  const pid_t pid = fork();
+  if (pid == 0) {
+    close(readyfds[0]);
+
+    server(addr, readyfds[1]);
+
+    _exit(0);
+  } else if (pid == -1) {
+    perror("fork");
+    return -1;
+  }
+
+  close(readyfds[1]);
+
+  // Wait for the server to be ready.
+  char ready = 0;
+  if ((read(readyfds[0], &ready, 1) != 1) || (ready != 1)) {
+    fprintf(stderr, "Error starting server.\n");
+    waitpid(pid, nullptr, 0);
+    return -1;
+  }
+
+  int ret = -1;
+
+  // Initialize OpenSSL (client).
+  net::ssl::library openssl;
+  if (openssl.init()) {
+    if ((bench_handshakes(addr, handshakes, false)) &&
+        (bench_handshakes(addr, handshakes, true))) {
+      ret = 0;
+
+      for (size_t i = 0; i < sizeof(record_sizes) / sizeof(record_sizes[0]);
+           i++) {
+        if (!bulk(addr, record_sizes[i], bytes)) {
+          ret = -1;
+          break;
+        }
+      }
+    }
+  } else {
+    fprintf(stderr, "Error initializing OpenSSL.\n");
+  }
+
+  // Stop server.
+  kill(pid, SIGTERM);
+  waitpid(pid, nullptr, 0);
+
+  return ret;
+}
+
+void usage(const char* program)
+{
+  fprintf(stderr,
+          "Usage: %s [-a <address>] [-n <handshakes>] [-b <bytes>]\n",
+          program);
+}
+
+void server(const net::socket::address& addr, int readyfd)
+{
+  char ready = 0;
+
+  // Initialize OpenSSL (server).
+  net::ssl::library openssl;
+  if ((openssl.init()) &&
+      (openssl.load_certificate("cert.pem")) &&
+      (openssl.load_private_key("key.pem"))) {
+    // Listen.
+    net::socket listener;
+    if (listener.listen(addr)) {
+      ready = 1;
+      write(readyfd, &ready, 1);
+
+      do {
+        // Accept new connection.
+        net::socket client;
+        if (listener.accept(client, timeout)) {
+          // Perform TLS handshake and serve the command.
+          net::ssl::socket sslsock(client);
+          if ((sslsock.handshake(net::ssl::socket::mode::server, timeout)) &&
+              (serve(sslsock))) {
+            sslsock.shutdown(net::ssl::socket::shutdown_how::unidirectional,
+                             timeout);
+          }
+        }
+      } while (true);
+    }
+  }
+
+  write(readyfd, &ready, 1);
+}
+
+bool serve(net::ssl::socket& sock)
+{
+  char command;
+  if (!recv_all(sock, &command, 1)) {
+    return false;
+  }
+
+  switch (command) {
+    case handshake_command:
+      // Reply (the client processes the session tickets meanwhile).
+      return sock.send(&command, 1, timeout);
+    case bulk_command:
+      {
+        // Receive number of bytes.
+        uint64_t bytes;
+        if (!recv_all(sock, &bytes, sizeof(uint64_t))) {
+          return false;
+        }
+
+        const uint64_t cpu0 = cpu_time();
+
+        // Receive and discard data.
+        static uint8_t buf[64 * 1024];
+        while (bytes > 0) {
+          const ssize_t ret = sock.recv(buf,
+                                        (bytes < sizeof(buf)) ?
+                                          bytes :
+                                          sizeof(buf),
+                                        timeout);
+
+          if (ret <= 0) {
+            return false;
+          }
+
+          bytes -= ret;
+        }
+
+        // Reply with the CPU time.
+        const uint64_t cpu = cpu_time() - cpu0;
+        return sock.send(&cpu, sizeof(uint64_t), timeout);
+      }
+    default:
+      return false;
+  }
+}
+
+bool handshake(const net::socket::address& addr,
+               SSL_SESSION* session,
+               bool& reused,
+               SSL_SESSION** newsession)
+{
+  net::ssl::socket sock;
+  sock.session(session);
+
+  // Connect and perform handshake.
+  if (sock.connect(addr, timeout)) {
+    reused = sock.session_reused();
+
+    // Send command and wait for the reply.
+    char reply;
+    if ((sock.send(&handshake_command, 1, timeout)) &&
+        (recv_all(sock, &reply, 1))) {
+      // Save session (if requested).
+      if (newsession) {
+        *newsession = sock.session();
+      }
+
+      // Shutdown the connection (otherwise the session cannot be resumed).
+      sock.shutdown(net::ssl::socket::shutdown_how::unidirectional, timeout);
+
+      return true;
+    }
+  }
+
+  return false;
+}
+
+bool bench_handshakes(const net::socket::address& addr,
+                      unsigned count,
+                      bool resume)
+{
+  SSL_SESSION* session = nullptr;
+
+  // Get a session to be resumed.
+  bool reused;
+  if ((resume) && (!handshake(addr, nullptr, reused, &session))) {
+    fprintf(stderr, "Error performing handshake.\n");
+    return false;
+  }
+
+  unsigned resumed = 0;
+
+  const uint64_t cpu0 = cpu_time();
+  const uint64_t start = now();
+
+  for (unsigned i = 0; i < count; i++) {
+    if (!handshake(addr, session, reused, nullptr)) {
+      fprintf(stderr, "Error performing handshake.\n");
+
+      if (session) {
+        SSL_SESSION_free(session);
+      }
+
+      return false;
+    }
+
+    if (reused) {
+      resumed++;
+    }
+  }
+
+  const double seconds = (now() - start) / 1e9;
+  const uint64_t cpu = cpu_time() - cpu0;
+
+  if (session) {
+    SSL_SESSION_free(session);
+  }
+
+  printf("{\"benchmark\":\"tls_handshake\",\"openssl\":\"%s\","
+         "\"mode\":\"%s\",\"handshakes\":%u,\"resumed\":%u,"
+         "\"seconds\":%.6f,\"handshakes_per_second\":%.1f,"
+         "\"client_cpu_us_per_handshake\":%.1f}\n",
+         OpenSSL_version(OPENSSL_VERSION),
+         resume ? "resumed" : "full",
+         count,
+         resumed,
+         seconds,
+         count / seconds,
+         cpu / (count * 1e3));
+
+  fflush(stdout);
+
+  return true;
+}
+
+bool bulk(const net::socket::address& addr, size_t size, size_t bytes)
+{
+  uint8_t* data = static_cast<uint8_t*>(malloc(size));
+  if (!data) {
+    return false;
+  }
+
+  memset(data, 'x', size);
+
+  bool ret = false;
+
+  net::ssl::socket sock;
+  if (sock.connect(addr, timeout)) {
+    const uint64_t total = bytes;
+
+    // Send command and number of bytes.
+    if ((sock.send(&bulk_command, 1, timeout)) &&
+        (sock.send(&total, sizeof(uint64_t), timeout))) {
+      const uint64_t cpu0 = cpu_time();
+      const uint64_t start = now();
+
+      // Send data (one TLS record per send()).
+      size_t left = bytes;
+      while (left > 0) {
+        const size_t len = (left < size) ? left : size;
+        if (!sock.send(data, len, timeout)) {
+          break;
+        }
+
+        left -= len;
+      }
+
+      // Wait for the server to receive everything.
+      uint64_t server_cpu;
+      if ((left == 0) && (recv_all(sock, &server_cpu, sizeof(uint64_t)))) {
+        const double seconds = (now() - start) / 1e9;
+        const uint64_t cpu = cpu_time() - cpu0;
+        const double gb = bytes / 1e9;
+
+        printf("{\"benchmark\":\"tls_bulk\",\"openssl\":\"%s\","
+               "\"protocol\":\"%s\",\"cipher\":\"%s\",\"record_size\":%zu,"
+               "\"bytes\":%zu,\"seconds\":%.6f,\"bytes_per_second\":%.0f,"
+               "\"sender_cpu_seconds_per_gb\":%.3f,"
+               "\"receiver_cpu_seconds_per_gb\":%.3f}\n",
+               OpenSSL_version(OPENSSL_VERSION),
+               sock.version(),
+               sock.cipher(),
+               size,
+               bytes,
+               seconds,
+               bytes / seconds,
+               (cpu / 1e9) / gb,
+               (server_cpu / 1e9) / gb);
+
+        fflush(stdout);
+
+        ret = true;
+      }
+    }
+  }
+
+  if (!ret) {
+    fprintf(stderr, "Error sending data (record size: %zu).\n", size);
+  }
+
+  free(data);
+
+  return ret;
+}
+
+bool recv_all(net::ssl::socket& sock, void* buf, size_t len)
+{
+  uint8_t* b = static_cast<uint8_t*>(buf);
+
+  while (len > 0) {
+    const ssize_t ret = sock.recv(b, len, timeout);
+    if (ret <= 0) {
+      return false;
+    }
+
+    b += ret;
+    len -= ret;
+  }
+
+  return true;
+}
+
+uint64_t now()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return (static_cast<uint64_t>(ts.tv_sec) * 1000000000ull) + ts.tv_nsec;
+}
+
+uint64_t cpu_time()
+{
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+
+  return ((static_cast<uint64_t>(usage.ru_utime.tv_sec) +
+           usage.ru_stime.tv_sec) * 1000000000ull) +
+         ((static_cast<uint64_t>(usage.ru_utime.tv_usec) +
+           usage.ru_stime.tv_usec) * 1000ull);
+}
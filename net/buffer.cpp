@@ -5,6 +5,7 @@
 #include <errno.h>
 #include <new>
 #include "net/buffer.h"
+#include "net/probes.h"
 
 net::buffer::allocator::~allocator()
 {
@@ -30,6 +31,8 @@ net::buffer* net::buffer::allocator::get()
 
     _M_first = _M_first->next();
 
+    _M_free.fetch_sub(1, std::memory_order_relaxed);
+
     // Unlock mutex.
     pthread_mutex_unlock(&_M_mutex);
 
@@ -51,24 +54,32 @@ void net::buffer::allocator::put(buffer* buf)
 
   _M_first = buf;
 
+  _M_free.fetch_add(1, std::memory_order_relaxed);
+
   // Unlock mutex.
   pthread_mutex_unlock(&_M_mutex);
 }
 
 bool net::buffer::allocator::allocate()
 {
-  for (size_t i = allocation; i > 0; i--) {
+  size_t i;
+  for (i = allocation; i > 0; i--) {
     buffer* buf = new (std::nothrow) buffer();
 
     if (buf) {
       buf->next(_M_first);
 
       _M_first = buf;
+
+      _M_buffers.fetch_add(1, std::memory_order_relaxed);
+      _M_free.fetch_add(1, std::memory_order_relaxed);
     } else {
       break;
     }
   }
 
+  NET_PROBE2(allocator_refill, this, allocation - i);
+
   return (_M_first != nullptr);
 }
 
@@ -87,6 +98,23 @@ bool net::buffer::init(const void* data, size_t len)
   return false;
 }
 
+bool net::buffer::resize(size_t len)
+{
+  // If the buffer has to grow...
+  if ((len > _M_length) || (!_M_data)) {
+    void* buf = realloc(_M_data, (len > 0) ? len : 1);
+    if (!buf) {
+      return false;
+    }
+
+    _M_data = buf;
+  }
+
+  _M_length = len;
+
+  return true;
+}
+
 bool net::buffer::save(const char* filename) const
 {
   // Open file for writing.
@@ -2,8 +2,10 @@
 #define NET_BUFFER_H
 
 #include <stdlib.h>
+#include <stdint.h>
 #include <sys/types.h>
 #include <pthread.h>
+#include <atomic>
 
 namespace net {
   // Forward declaration.
@@ -27,6 +29,18 @@ namespace net {
           // Put buffer.
           void put(buffer* buf);
 
+          // Statistics.
+          struct statistics {
+            // Number of buffers allocated.
+            size_t buffers;
+
+            // Number of free buffers.
+            size_t free;
+          };
+
+          // Get statistics (without locking).
+          void stats(statistics& st) const;
+
         private:
           // Buffer allocation.
           static constexpr const size_t allocation = 10000;
@@ -34,6 +48,11 @@ namespace net {
           // Pointer to the first buffer.
           buffer* _M_first = nullptr;
 
+          // Number of buffers allocated and number of free buffers (modified
+          // with the mutex locked, they can be read without locking).
+          std::atomic<size_t> _M_buffers{0};
+          std::atomic<size_t> _M_free{0};
+
           // Mutex.
           pthread_mutex_t _M_mutex = PTHREAD_MUTEX_INITIALIZER;
 
@@ -57,11 +76,16 @@ namespace net {
       // Initialize.
       bool init(const void* data, size_t len);
 
+      // Resize (the content is preserved up to the lesser of the new and old
+      // lengths).
+      bool resize(size_t len);
+
       // Save to file.
       bool save(const char* filename) const;
 
       // Get data.
       const void* data() const;
+      void* data();
 
       // Get data length.
       size_t length() const;
@@ -80,6 +104,12 @@ namespace net {
       // Set next buffer.
       void next(buffer* buf);
 
+      // Get timestamp.
+      uint64_t timestamp() const;
+
+      // Set timestamp.
+      void timestamp(uint64_t t);
+
     private:
       // Data.
       void* _M_data = nullptr;
@@ -93,11 +123,20 @@ namespace net {
       // Next buffer.
       buffer* _M_next;
 
+      // Timestamp (e.g. time when the buffer was queued).
+      uint64_t _M_timestamp = 0;
+
       // Disable copy constructor and assignment operator.
       buffer(const buffer&) = delete;
       buffer& operator=(const buffer&) = delete;
   };
 
+  inline void buffer::allocator::stats(statistics& st) const
+  {
+    st.buffers = _M_buffers.load(std::memory_order_relaxed);
+    st.free = _M_free.load(std::memory_order_relaxed);
+  }
+
   inline buffer::~buffer()
   {
     clear();
@@ -116,6 +155,11 @@ namespace net {
     return _M_data;
   }
 
+  inline void* buffer::data()
+  {
+    return _M_data;
+  }
+
   inline size_t buffer::length() const
   {
     return _M_length;
@@ -150,6 +194,16 @@ namespace net {
   {
     _M_next = buf;
   }
+
+  inline uint64_t buffer::timestamp() const
+  {
+    return _M_timestamp;
+  }
+
+  inline void buffer::timestamp(uint64_t t)
+  {
+    _M_timestamp = t;
+  }
 }
 
 #endif // NET_BUFFER_H
@@ -1,5 +1,6 @@
 #include <sys/time.h>
 #include "net/buffers.h"
+#include "net/probes.h"
 
 net::buffers::~buffers()
 {
@@ -12,6 +13,7 @@ net::buffers::~buffers()
     buf = next;
   }
 
+  pthread_cond_destroy(&_M_space);
   pthread_cond_destroy(&_M_cond);
   pthread_mutex_destroy(&_M_mutex);
 }
@@ -27,8 +29,9 @@ size_t net::buffers::push_front(buffer* buf)
   _M_header.next()->prev(buf);
   _M_header.next(buf);
 
-  // Increment number of buffers.
-  const size_t count = ++_M_count;
+  // Increment number of buffers and bytes.
+  const size_t count = _M_count.fetch_add(1, std::memory_order_relaxed) + 1;
+  _M_bytes.fetch_add(buf->length(), std::memory_order_relaxed);
 
   // Restart one of the threads waiting on the condition variable.
   pthread_cond_signal(&_M_cond);
@@ -36,13 +39,16 @@ size_t net::buffers::push_front(buffer* buf)
   // Unlock mutex.
   pthread_mutex_unlock(&_M_mutex);
 
+  NET_PROBE3(buffers_requeue, this, 1, count);
+
   return count;
 }
 
 size_t net::buffers::push_front(buffer* first, buffer* last)
 {
-  // Compute number of buffers to be added.
-  size_t count = distance(first, last);
+  // Compute number of buffers and bytes to be added.
+  size_t bytes;
+  const size_t n = distance(first, last, bytes);
 
   // Lock mutex.
   pthread_mutex_lock(&_M_mutex);
@@ -53,10 +59,9 @@ size_t net::buffers::push_front(buffer* first, buffer* last)
   _M_header.next()->prev(last);
   _M_header.next(first);
 
-  // Increment number of buffers.
-  _M_count += count;
-
-  count = _M_count;
+  // Increment number of buffers and bytes.
+  const size_t count = _M_count.fetch_add(n, std::memory_order_relaxed) + n;
+  _M_bytes.fetch_add(bytes, std::memory_order_relaxed);
 
   // Restart one of the threads waiting on the condition variable.
   pthread_cond_signal(&_M_cond);
@@ -64,6 +69,8 @@ size_t net::buffers::push_front(buffer* first, buffer* last)
   // Unlock mutex.
   pthread_mutex_unlock(&_M_mutex);
 
+  NET_PROBE3(buffers_requeue, this, n, count);
+
   return count;
 }
 
@@ -78,8 +85,9 @@ size_t net::buffers::push_back(buffer* buf)
   _M_header.prev()->next(buf);
   _M_header.prev(buf);
 
-  // Increment number of buffers.
-  const size_t count = ++_M_count;
+  // Increment number of buffers and bytes.
+  const size_t count = _M_count.fetch_add(1, std::memory_order_relaxed) + 1;
+  _M_bytes.fetch_add(buf->length(), std::memory_order_relaxed);
 
   // Restart one of the threads waiting on the condition variable.
   pthread_cond_signal(&_M_cond);
@@ -87,13 +95,16 @@ size_t net::buffers::push_back(buffer* buf)
   // Unlock mutex.
   pthread_mutex_unlock(&_M_mutex);
 
+  NET_PROBE3(buffers_enqueue, this, 1, count);
+
   return count;
 }
 
 size_t net::buffers::push_back(buffer* first, buffer* last)
 {
-  // Compute number of buffers to be added.
-  size_t count = distance(first, last);
+  // Compute number of buffers and bytes to be added.
+  size_t bytes;
+  const size_t n = distance(first, last, bytes);
 
   // Lock mutex.
   pthread_mutex_lock(&_M_mutex);
@@ -104,10 +115,82 @@ size_t net::buffers::push_back(buffer* first, buffer* last)
   _M_header.prev()->next(first);
   _M_header.prev(last);
 
-  // Increment number of buffers.
-  _M_count += count;
+  // Increment number of buffers and bytes.
+  const size_t count = _M_count.fetch_add(n, std::memory_order_relaxed) + n;
+  _M_bytes.fetch_add(bytes, std::memory_order_relaxed);
+
+  // Restart one of the threads waiting on the condition variable.
+  pthread_cond_signal(&_M_cond);
+
+  // Unlock mutex.
+  pthread_mutex_unlock(&_M_mutex);
+
+  NET_PROBE3(buffers_enqueue, this, n, count);
+
+  return count;
+}
+
+size_t net::buffers::push_back(buffer* first,
+                               buffer* last,
+                               size_t max_count,
+                               size_t max_bytes,
+                               unsigned timeout)
+{
+  // Compute number of buffers and bytes to be added.
+  size_t bytes;
+  const size_t n = distance(first, last, bytes);
+
+  // Lock mutex.
+  pthread_mutex_lock(&_M_mutex);
+
+  // If there is no room for the buffers...
+  if (!room(n, bytes, max_count, max_bytes)) {
+    if (timeout == 0) {
+      // Unlock mutex.
+      pthread_mutex_unlock(&_M_mutex);
+
+      return 0;
+    }
+
+    // Get current time.
+    struct timeval now;
+    gettimeofday(&now, nullptr);
+
+    // Compute absolute time.
+    struct timespec ts;
+    ts.tv_sec = now.tv_sec + (timeout / 1000);
+    ts.tv_nsec = (now.tv_usec * 1000) + ((timeout % 1000) * 1000000);
 
-  count = _M_count;
+    if (ts.tv_nsec >= 1000000000l) {
+      ts.tv_sec++;
+      ts.tv_nsec -= 1000000000l;
+    }
+
+    _M_producers++;
+
+    do {
+      if (pthread_cond_timedwait(&_M_space, &_M_mutex, &ts) != 0) {
+        _M_producers--;
+
+        // Unlock mutex.
+        pthread_mutex_unlock(&_M_mutex);
+
+        return 0;
+      }
+    } while (!room(n, bytes, max_count, max_bytes));
+
+    _M_producers--;
+  }
+
+  first->prev(_M_header.prev());
+  last->next(&_M_header);
+
+  _M_header.prev()->next(first);
+  _M_header.prev(last);
+
+  // Increment number of buffers and bytes.
+  const size_t count = _M_count.fetch_add(n, std::memory_order_relaxed) + n;
+  _M_bytes.fetch_add(bytes, std::memory_order_relaxed);
 
   // Restart one of the threads waiting on the condition variable.
   pthread_cond_signal(&_M_cond);
@@ -115,6 +198,8 @@ size_t net::buffers::push_back(buffer* first, buffer* last)
   // Unlock mutex.
   pthread_mutex_unlock(&_M_mutex);
 
+  NET_PROBE3(buffers_enqueue, this, n, count);
+
   return count;
 }
 
@@ -131,8 +216,14 @@ net::buffer* net::buffers::pop_front()
     buf->next()->prev(&_M_header);
     _M_header.next(buf->next());
 
-    // Decrement number of buffers.
-    _M_count--;
+    // Decrement number of buffers and bytes.
+    _M_count.fetch_sub(1, std::memory_order_relaxed);
+    _M_bytes.fetch_sub(buf->length(), std::memory_order_relaxed);
+
+    NET_PROBE2(buffers_dequeue, this, 1);
+
+    // Restart the threads waiting for room (if any).
+    notify_space();
   } else {
     buf = nullptr;
   }
@@ -156,8 +247,14 @@ net::buffer* net::buffers::pop_front(unsigned timeout)
     buf->next()->prev(&_M_header);
     _M_header.next(buf->next());
 
-    // Decrement number of buffers.
-    _M_count--;
+    // Decrement number of buffers and bytes.
+    _M_count.fetch_sub(1, std::memory_order_relaxed);
+    _M_bytes.fetch_sub(buf->length(), std::memory_order_relaxed);
+
+    NET_PROBE2(buffers_dequeue, this, 1);
+
+    // Restart the threads waiting for room (if any).
+    notify_space();
 
     // Unlock mutex.
     pthread_mutex_unlock(&_M_mutex);
@@ -185,8 +282,14 @@ net::buffer* net::buffers::pop_front(unsigned timeout)
         buf->next()->prev(&_M_header);
         _M_header.next(buf->next());
 
-        // Decrement number of buffers.
-        _M_count--;
+        // Decrement number of buffers and bytes.
+        _M_count.fetch_sub(1, std::memory_order_relaxed);
+        _M_bytes.fetch_sub(buf->length(), std::memory_order_relaxed);
+
+        NET_PROBE2(buffers_dequeue, this, 1);
+
+        // Restart the threads waiting for room (if any).
+        notify_space();
 
         // Unlock mutex.
         pthread_mutex_unlock(&_M_mutex);
@@ -212,12 +315,18 @@ size_t net::buffers::pop(buffer*& first, buffer*& last)
     first = _M_header.next();
     last = _M_header.prev();
 
-    const size_t count = _M_count;
+    const size_t count = _M_count.load(std::memory_order_relaxed);
 
     _M_header.prev(&_M_header);
     _M_header.next(&_M_header);
 
-    _M_count = 0;
+    _M_count.store(0, std::memory_order_relaxed);
+    _M_bytes.store(0, std::memory_order_relaxed);
+
+    NET_PROBE2(buffers_dequeue, this, count);
+
+    // Restart the threads waiting for room (if any).
+    notify_space();
 
     // Unlock mutex.
     pthread_mutex_unlock(&_M_mutex);
@@ -244,12 +353,18 @@ size_t net::buffers::pop(buffer*& first, buffer*& last, unsigned timeout)
     first = _M_header.next();
     last = _M_header.prev();
 
-    const size_t count = _M_count;
+    const size_t count = _M_count.load(std::memory_order_relaxed);
 
     _M_header.prev(&_M_header);
     _M_header.next(&_M_header);
 
-    _M_count = 0;
+    _M_count.store(0, std::memory_order_relaxed);
+    _M_bytes.store(0, std::memory_order_relaxed);
+
+    NET_PROBE2(buffers_dequeue, this, count);
+
+    // Restart the threads waiting for room (if any).
+    notify_space();
 
     // Unlock mutex.
     pthread_mutex_unlock(&_M_mutex);
@@ -278,12 +393,18 @@ size_t net::buffers::pop(buffer*& first, buffer*& last, unsigned timeout)
         first = _M_header.next();
         last = _M_header.prev();
 
-        const size_t count = _M_count;
+        const size_t count = _M_count.load(std::memory_order_relaxed);
 
         _M_header.prev(&_M_header);
         _M_header.next(&_M_header);
 
-        _M_count = 0;
+        _M_count.store(0, std::memory_order_relaxed);
+        _M_bytes.store(0, std::memory_order_relaxed);
+
+        NET_PROBE2(buffers_dequeue, this, count);
+
+        // Restart the threads waiting for room (if any).
+        notify_space();
 
         // Unlock mutex.
         pthread_mutex_unlock(&_M_mutex);
@@ -301,3 +422,123 @@ size_t net::buffers::pop(buffer*& first, buffer*& last, unsigned timeout)
     }
   } while (true);
 }
+
+size_t net::buffers::pop(buffer*& first,
+                         buffer*& last,
+                         size_t max_count,
+                         size_t max_bytes)
+{
+  // Lock mutex.
+  pthread_mutex_lock(&_M_mutex);
+
+  // If there is at least one buffer...
+  if (_M_header.next() != &_M_header) {
+    const size_t count = detach(first, last, max_count, max_bytes);
+
+    // Unlock mutex.
+    pthread_mutex_unlock(&_M_mutex);
+
+    return count;
+  } else {
+    // Unlock mutex.
+    pthread_mutex_unlock(&_M_mutex);
+
+    first = nullptr;
+    last = nullptr;
+
+    return 0;
+  }
+}
+
+size_t net::buffers::pop(buffer*& first,
+                         buffer*& last,
+                         size_t max_count,
+                         size_t max_bytes,
+                         unsigned timeout)
+{
+  // Lock mutex.
+  pthread_mutex_lock(&_M_mutex);
+
+  // If there is at least one buffer...
+  if (_M_header.next() != &_M_header) {
+    const size_t count = detach(first, last, max_count, max_bytes);
+
+    // Unlock mutex.
+    pthread_mutex_unlock(&_M_mutex);
+
+    return count;
+  }
+
+  // Get current time.
+  struct timeval now;
+  gettimeofday(&now, nullptr);
+
+  // Compute absolute time.
+  struct timespec ts;
+  ts.tv_sec = now.tv_sec + (timeout / 1000);
+  ts.tv_nsec = (now.tv_usec * 1000) + ((timeout % 1000) * 1000000);
+
+  if (ts.tv_nsec >= 1000000000l) {
+    ts.tv_sec++;
+    ts.tv_nsec -= 1000000000l;
+  }
+
+  do {
+    if (pthread_cond_timedwait(&_M_cond, &_M_mutex, &ts) == 0) {
+      // If there is at least one buffer...
+      if (_M_header.next() != &_M_header) {
+        const size_t count = detach(first, last, max_count, max_bytes);
+
+        // Unlock mutex.
+        pthread_mutex_unlock(&_M_mutex);
+
+        return count;
+      }
+    } else {
+      // Unlock mutex.
+      pthread_mutex_unlock(&_M_mutex);
+
+      first = nullptr;
+      last = nullptr;
+
+      return 0;
+    }
+  } while (true);
+}
+
+size_t net::buffers::detach(buffer*& first,
+                            buffer*& last,
+                            size_t max_count,
+                            size_t max_bytes)
+{
+  first = _M_header.next();
+  last = first;
+
+  size_t count = 1;
+  size_t bytes = first->length();
+
+  // Extend the batch while the limits allow it.
+  while ((last->next() != &_M_header) &&
+         ((max_count == 0) || (count < max_count)) &&
+         ((max_bytes == 0) || (bytes + last->next()->length() <= max_bytes))) {
+    last = last->next();
+
+    count++;
+    bytes += last->length();
+  }
+
+  // Unlink the batch.
+  _M_header.next(last->next());
+  last->next()->prev(&_M_header);
+
+  // Decrement number of buffers and bytes.
+  _M_count.fetch_sub(count, std::memory_order_relaxed);
+  _M_bytes.fetch_sub(bytes, std::memory_order_relaxed);
+
+  NET_PROBE2(buffers_dequeue, this, count);
+
+  // Restart the threads waiting for room (if any).
+  notify_space();
+
+  return count;
+}
@@ -1,6 +1,7 @@
 #ifndef NET_BUFFERS_H
 #define NET_BUFFERS_H
 
+#include <atomic>
 #include "net/buffer.h"
 
 namespace net {
@@ -25,6 +26,16 @@ namespace net {
       // Add buffers to the end.
       size_t push_back(buffer* first, buffer* last);
 
+      // Add buffers to the end if there is room for them: afterwards there
+      // are at most 'max_count' buffers and 'max_bytes' bytes (an empty list
+      // always has room). Waits for room up to 'timeout' milliseconds;
+      // returns 0 if the buffers couldn't be added.
+      size_t push_back(buffer* first,
+                       buffer* last,
+                       size_t max_count,
+                       size_t max_bytes,
+                       unsigned timeout);
+
       // Get first buffer.
       buffer* pop_front();
 
@@ -37,12 +48,37 @@ namespace net {
       // Get all buffers (timeout in milliseconds).
       size_t pop(buffer*& first, buffer*& last, unsigned timeout);
 
+      // Get buffers from the front, at most 'max_count' buffers and
+      // 'max_bytes' bytes (0: no limit), but at least one buffer even if it
+      // is bigger than 'max_bytes'.
+      size_t pop(buffer*& first,
+                 buffer*& last,
+                 size_t max_count,
+                 size_t max_bytes);
+
+      // Get buffers from the front, at most 'max_count' buffers and
+      // 'max_bytes' bytes (0: no limit), but at least one buffer even if it
+      // is bigger than 'max_bytes' (timeout in milliseconds).
+      size_t pop(buffer*& first,
+                 buffer*& last,
+                 size_t max_count,
+                 size_t max_bytes,
+                 unsigned timeout);
+
+      // Get number of buffers (without locking).
+      size_t count() const;
+
+      // Get number of bytes (without locking).
+      size_t bytes() const;
+
     private:
       // Header.
       buffer _M_header;
 
-      // Number of buffers.
-      size_t _M_count = 0;
+      // Number of buffers and bytes (modified with the mutex locked, they
+      // can be read without locking).
+      std::atomic<size_t> _M_count{0};
+      std::atomic<size_t> _M_bytes{0};
 
       // Mutex.
       pthread_mutex_t _M_mutex = PTHREAD_MUTEX_INITIALIZER;
@@ -50,8 +86,32 @@ namespace net {
       // Condition variable.
       pthread_cond_t _M_cond = PTHREAD_COND_INITIALIZER;
 
-      // Compute number of buffers in the list.
-      static size_t distance(const buffer* first, const buffer* last);
+      // Condition variable (room for more buffers) and number of threads
+      // waiting on it.
+      pthread_cond_t _M_space = PTHREAD_COND_INITIALIZER;
+      size_t _M_producers = 0;
+
+      // Compute number of buffers and bytes in the list.
+      static size_t distance(const buffer* first,
+                             const buffer* last,
+                             size_t& bytes);
+
+      // Is there room for 'count' buffers and 'bytes' bytes (the mutex must
+      // be locked)?
+      bool room(size_t count,
+                size_t bytes,
+                size_t max_count,
+                size_t max_bytes) const;
+
+      // Restart the threads waiting for room (the mutex must be locked).
+      void notify_space();
+
+      // Detach buffers from the front (at least one buffer must be queued
+      // and the mutex must be locked).
+      size_t detach(buffer*& first,
+                    buffer*& last,
+                    size_t max_count,
+                    size_t max_bytes);
 
       // Disable copy constructor and assignment operator.
       buffers(const buffers&) = delete;
@@ -64,13 +124,46 @@ namespace net {
     _M_header.next(&_M_header);
   }
 
-  inline size_t buffers::distance(const buffer* first, const buffer* last)
+  inline size_t buffers::count() const
+  {
+    return _M_count.load(std::memory_order_relaxed);
+  }
+
+  inline size_t buffers::bytes() const
+  {
+    return _M_bytes.load(std::memory_order_relaxed);
+  }
+
+  inline bool buffers::room(size_t count,
+                            size_t bytes,
+                            size_t max_count,
+                            size_t max_bytes) const
+  {
+    const size_t c = _M_count.load(std::memory_order_relaxed);
+
+    return (c == 0) ||
+           ((c + count <= max_count) &&
+            (_M_bytes.load(std::memory_order_relaxed) + bytes <= max_bytes));
+  }
+
+  inline void buffers::notify_space()
+  {
+    if (_M_producers > 0) {
+      pthread_cond_broadcast(&_M_space);
+    }
+  }
+
+  inline size_t buffers::distance(const buffer* first,
+                                  const buffer* last,
+                                  size_t& bytes)
   {
     size_t count = 1;
+    bytes = first->length();
 
     while (first != last) {
       first = first->next();
       count++;
+      bytes += first->length();
     }
 
     return count;
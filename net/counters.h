@@ -0,0 +1,118 @@
+#ifndef NET_COUNTERS_H
+#define NET_COUNTERS_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+
+namespace net {
+  // Statistics counters.
+  //
+  // Each thread updates the counters in its own slot with relaxed atomic
+  // operations and get() / snapshot() add up the slots. The slots are
+  // separated by at least a cache line, so threads updating the counters
+  // concurrently don't write to the same cache line.
+  template<size_t N>
+  class counters {
+    public:
+      // Constructor.
+      counters();
+
+      // Add to counter.
+      void add(size_t counter, uint64_t n = 1);
+
+      // Get counter.
+      uint64_t get(size_t counter) const;
+
+      // Get all the counters.
+      void snapshot(uint64_t* values) const;
+
+    private:
+      // Number of slots (the threads are assigned a slot round-robin, the
+      // slots might be shared if there are more threads).
+      static constexpr const size_t nslots = 16;
+
+      // Cache line size.
+      static constexpr const size_t cache_line_size = 64;
+
+      // Slot (padded, so the counters of two slots are never in the same
+      // cache line regardless of the alignment of the object).
+      struct slot {
+        std::atomic<uint64_t> values[N];
+
+        uint8_t padding[(((N * sizeof(uint64_t)) + cache_line_size - 1) /
+                         cache_line_size) * cache_line_size +
+                        cache_line_size -
+                        (N * sizeof(uint64_t))];
+      };
+
+      // Slots.
+      slot _M_slots[nslots];
+
+      // Get slot of the calling thread.
+      static size_t thread_slot();
+
+      // Disable copy constructor and assignment operator.
+      counters(const counters&) = delete;
+      counters& operator=(const counters&) = delete;
+  };
+
+  template<size_t N>
+  inline counters<N>::counters()
+  {
+    for (size_t i = 0; i < nslots; i++) {
+      for (size_t j = 0; j < N; j++) {
+        _M_slots[i].values[j].store(0, std::memory_order_relaxed);
+      }
+    }
+  }
+
+  template<size_t N>
+  inline void counters<N>::add(size_t counter, uint64_t n)
+  {
+    _M_slots[thread_slot()].values[counter].fetch_add(
+      n,
+      std::memory_order_relaxed
+    );
+  }
+
+  template<size_t N>
+  inline uint64_t counters<N>::get(size_t counter) const
+  {
+    uint64_t value = 0;
+
+    for (size_t i = 0; i < nslots; i++) {
+      value += _M_slots[i].values[counter].load(std::memory_order_relaxed);
+    }
+
+    return value;
+  }
+
+  template<size_t N>
+  inline void counters<N>::snapshot(uint64_t* values) const
+  {
+    for (size_t j = 0; j < N; j++) {
+      values[j] = 0;
+    }
+
+    for (size_t i = 0; i < nslots; i++) {
+      for (size_t j = 0; j < N; j++) {
+        values[j] += _M_slots[i].values[j].load(std::memory_order_relaxed);
+      }
+    }
+  }
+
+  template<size_t N>
+  inline size_t counters<N>::thread_slot()
+  {
+    static std::atomic<size_t> next(0);
+    static thread_local size_t slot = next.fetch_add(
+                                        1,
+                                        std::memory_order_relaxed
+                                      ) % nslots;
+
+    return slot;
+  }
+}
+
+#endif // NET_COUNTERS_H
@@ -0,0 +1,128 @@
+#include <string.h>
+#include "net/crc32c.h"
+
+namespace net {
+  // Slicing-by-8 lookup tables.
+  class crc32c_tables {
+    public:
+      // Constructor.
+      crc32c_tables();
+
+      uint32_t table[8][256];
+  };
+
+  crc32c_tables::crc32c_tables()
+  {
+    // Reversed polynomial.
+    static constexpr const uint32_t polynomial = 0x82f63b78u;
+
+    for (unsigned i = 0; i < 256; i++) {
+      uint32_t crc = i;
+      for (unsigned j = 0; j < 8; j++) {
+        crc = (crc & 1) ? (crc >> 1) ^ polynomial : (crc >> 1);
+      }
+
+      table[0][i] = crc;
+    }
+
+    for (unsigned i = 0; i < 256; i++) {
+      for (unsigned j = 1; j < 8; j++) {
+        table[j][i] = (table[j - 1][i] >> 8) ^
+                      table[0][table[j - 1][i] & 0xff];
+      }
+    }
+  }
+
+  static const crc32c_tables tables;
+
+  static uint32_t crc32c_software(uint32_t crc, const uint8_t* p, size_t len)
+  {
+    // Process 8 bytes at a time.
+    while (len >= 8) {
+      uint32_t lo;
+      uint32_t hi;
+      memcpy(&lo, p, 4);
+      memcpy(&hi, p + 4, 4);
+
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+      lo = __builtin_bswap32(lo);
+      hi = __builtin_bswap32(hi);
+#endif
+
+      lo ^= crc;
+
+      crc = tables.table[7][lo & 0xff] ^
+            tables.table[6][(lo >> 8) & 0xff] ^
+            tables.table[5][(lo >> 16) & 0xff] ^
+            tables.table[4][lo >> 24] ^
+            tables.table[3][hi & 0xff] ^
+            tables.table[2][(hi >> 8) & 0xff] ^
+            tables.table[1][(hi >> 16) & 0xff] ^
+            tables.table[0][hi >> 24];
+
+      p += 8;
+      len -= 8;
+    }
+
+    // Process remaining bytes.
+    while (len > 0) {
+      crc = (crc >> 8) ^ tables.table[0][(crc ^ *p++) & 0xff];
+      len--;
+    }
+
+    return crc;
+  }
+
+#if defined(__x86_64__)
+  __attribute__((target("sse4.2")))
+  static uint32_t crc32c_hardware(uint32_t crc, const uint8_t* p, size_t len)
+  {
+    uint64_t crc64 = crc;
+
+    // Process 8 bytes at a time.
+    while (len >= 8) {
+      uint64_t n;
+      memcpy(&n, p, 8);
+
+      crc64 = __builtin_ia32_crc32di(crc64, n);
+
+      p += 8;
+      len -= 8;
+    }
+
+    crc = static_cast<uint32_t>(crc64);
+
+    // Process remaining bytes.
+    while (len > 0) {
+      crc = __builtin_ia32_crc32qi(crc, *p++);
+      len--;
+    }
+
+    return crc;
+  }
+
+  static bool hardware_supported()
+  {
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("sse4.2");
+  }
+
+  static const bool hardware = hardware_supported();
+#endif // defined(__x86_64__)
+}
+
+uint32_t net::crc32c(uint32_t crc, const void* data, size_t len)
+{
+  const uint8_t* p = static_cast<const uint8_t*>(data);
+
+  crc = ~crc;
+
+#if defined(__x86_64__)
+  crc = hardware ? crc32c_hardware(crc, p, len) :
+                   crc32c_software(crc, p, len);
+#else
+  crc = crc32c_software(crc, p, len);
+#endif
+
+  return ~crc;
+}
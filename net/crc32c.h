@@ -0,0 +1,13 @@
+#ifndef NET_CRC32C_H
+#define NET_CRC32C_H
+
+#include <stdint.h>
+#include <stdlib.h>
+
+namespace net {
+  // Compute the CRC-32C (Castagnoli) of 'len' bytes starting at 'data',
+  // continuing from a previously computed 'crc' (0 for the first block).
+  uint32_t crc32c(uint32_t crc, const void* data, size_t len);
+}
+
+#endif // NET_CRC32C_H
@@ -0,0 +1,208 @@
+#include "net/envelope.h"
+#include "net/crc32c.h"
+
+size_t net::envelope::encoder::encode(uint64_t sequence,
+                                      const buffer* first,
+                                      const buffer* last,
+                                      size_t max_count,
+                                      size_t max_bytes)
+{
+  uint8_t* lengths = _M_data + header_size;
+
+  if (max_count > max_records) {
+    max_count = max_records;
+  }
+
+  // Encode record lengths.
+  size_t count = 0;
+  size_t bytes = 0;
+  const buffer* buf = first;
+  do {
+    if (buf->length() <= max_record_length) {
+      // If the buffer doesn't fit...
+      if ((count > 0) && (buf->length() > max_bytes - bytes)) {
+        break;
+      }
+
+      bytes += buf->length();
+
+      write32(lengths + (count * 4), static_cast<uint32_t>(buf->length()));
+
+      count++;
+
+      // If not the last buffer...
+      if (buf != last) {
+        buf = buf->next();
+      } else {
+        break;
+      }
+    } else {
+      // If no record could be encoded...
+      if (count == 0) {
+        return 0;
+      }
+
+      break;
+    }
+  } while (count < max_count);
+
+  // Encode fixed header.
+  encode_header(type::data, sequence, 0, count);
+
+  // Compute CRC.
+  uint32_t crc = crc32c(0, _M_data, header_size - 4);
+  crc = crc32c(crc, lengths, count * 4);
+
+  buf = first;
+  for (size_t i = count; i > 0; i--) {
+    crc = crc32c(crc, buf->data(), buf->length());
+    buf = buf->next();
+  }
+
+  write32(_M_data + header_size - 4, crc);
+
+  _M_length = header_size + (count * 4);
+
+  return count;
+}
+
+bool net::envelope::encoder::encode(uint64_t sequence,
+                                    const void* data,
+                                    size_t len)
+{
+  return encode(type::data, sequence, 0, data, len);
+}
+
+bool net::envelope::encoder::encode(type t,
+                                    uint64_t sequence,
+                                    uint16_t flags,
+                                    const void* data,
+                                    size_t len)
+{
+  if (len <= max_record_length) {
+    uint8_t* lengths = _M_data + header_size;
+
+    // Encode record length.
+    write32(lengths, static_cast<uint32_t>(len));
+
+    // Encode fixed header.
+    encode_header(t, sequence, flags, 1);
+
+    // Compute CRC.
+    uint32_t crc = crc32c(0, _M_data, header_size - 4);
+    crc = crc32c(crc, lengths, 4);
+    crc = crc32c(crc, data, len);
+
+    write32(_M_data + header_size - 4, crc);
+
+    _M_length = header_size + 4;
+
+    return true;
+  }
+
+  return false;
+}
+
+void net::envelope::encoder::encode(type t, uint64_t sequence, uint16_t flags)
+{
+  // Encode fixed header.
+  encode_header(t, sequence, flags, 0);
+
+  // Compute CRC.
+  write32(_M_data + header_size - 4, crc32c(0, _M_data, header_size - 4));
+
+  _M_length = header_size;
+}
+
+void net::envelope::encoder::encode_header(type t,
+                                           uint64_t sequence,
+                                           uint16_t flags,
+                                           size_t count)
+{
+  write32(_M_data, magic);
+  _M_data[4] = version;
+  _M_data[5] = static_cast<uint8_t>(t);
+  write16(_M_data + 6, flags);
+  write64(_M_data + 8, sequence);
+  write32(_M_data + 16, static_cast<uint32_t>(count));
+}
+
+net::envelope::decoder::result
+net::envelope::decoder::decode(const void* data, size_t len, bool verify)
+{
+  const uint8_t* const p = static_cast<const uint8_t*>(data);
+
+  // Decode header.
+  const result res = decode_header(data, len);
+  if (res != result::ok) {
+    return res;
+  }
+
+  // If the records are not complete...
+  if (len < _M_size) {
+    return result::incomplete;
+  }
+
+  // Verify CRC (if requested).
+  if ((verify) &&
+      (crc32c(crc32c(0, p, header_size - 4),
+              p + header_size,
+              _M_size - header_size) != read32(p + header_size - 4))) {
+    return result::error;
+  }
+
+  _M_length = p + header_size;
+  _M_record = p + header_size + (_M_count * 4);
+  _M_left = _M_count;
+
+  return result::ok;
+}
+
+net::envelope::decoder::result
+net::envelope::decoder::decode_header(const void* data, size_t len)
+{
+  const uint8_t* const p = static_cast<const uint8_t*>(data);
+
+  _M_left = 0;
+
+  // If the fixed header is not complete...
+  if (len < header_size) {
+    _M_size = header_size;
+    return result::incomplete;
+  }
+
+  // Check magic and version.
+  if ((read32(p) != magic) || (p[4] != version)) {
+    return result::error;
+  }
+
+  _M_type = static_cast<type>(p[5]);
+  _M_flags = read16(p + 6);
+  _M_sequence = read64(p + 8);
+  _M_count = read32(p + 16);
+
+  if (_M_count > max_records) {
+    return result::error;
+  }
+
+  // If the record lengths are not complete...
+  const size_t hdrlen = header_size + (_M_count * 4);
+  if (len < hdrlen) {
+    _M_size = hdrlen;
+    return result::incomplete;
+  }
+
+  // Compute envelope size.
+  uint64_t size = hdrlen;
+  for (size_t i = 0; i < _M_count; i++) {
+    size += read32(p + header_size + (i * 4));
+  }
+
+  if (size > SIZE_MAX) {
+    return result::error;
+  }
+
+  _M_size = static_cast<size_t>(size);
+
+  return result::ok;
+}
@@ -0,0 +1,300 @@
+#ifndef NET_ENVELOPE_H
+#define NET_ENVELOPE_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include "net/buffer.h"
+
+namespace net {
+  // Batch envelope.
+  //
+  // An envelope carries a batch of records. All the integers are in network
+  // byte order:
+  //   magic    (4 bytes): "NBUF".
+  //   version  (1 byte).
+  //   type     (1 byte).
+  //   flags    (2 bytes).
+  //   sequence (8 bytes): batch sequence number.
+  //   count    (4 bytes): number of records.
+  //   crc      (4 bytes): CRC-32C of the previous fields, the record lengths
+  //                       and the records.
+  //   lengths  (count * 4 bytes).
+  //   records.
+  //
+  // Besides data envelopes, there are control envelopes without records:
+  //   hello: sent by the sender after connecting; 'sequence' contains the
+  //          session identifier.
+  //   ack:   sent by the receiver; 'sequence' contains the sequence number of
+  //          the last data envelope received (cumulative acknowledgement).
+  //
+  // Credit envelopes are sent by the receiver to senders which have
+  // requested flow control (flag 'flow_control' in hello); they carry a
+  // single record with the number of bytes (8 bytes) and records (4 bytes)
+  // the sender is allowed to send in addition to the previous grants.
+  class envelope {
+    public:
+      // Header size.
+      static constexpr const size_t header_size = 24;
+
+      // Maximum number of records per envelope.
+      static constexpr const size_t max_records = 1024;
+
+      // Maximum record length.
+      static constexpr const size_t max_record_length = 0xffffffffu;
+
+      // Magic ("NBUF").
+      static constexpr const uint32_t magic = 0x4e425546u;
+
+      // Version.
+      static constexpr const uint8_t version = 1;
+
+      // Envelope type.
+      enum class type : uint8_t {
+        data   = 0,
+        hello  = 1,
+        ack    = 2,
+        credit = 3
+      };
+
+      // Flags.
+      static constexpr const uint16_t flow_control = 0x0001;
+
+      // Size of the record of a credit envelope.
+      static constexpr const size_t credit_size = 12;
+
+      // Envelope encoder.
+      class encoder {
+        public:
+          // Constructor.
+          encoder() = default;
+
+          // Encode the header of an envelope carrying the buffers
+          // [first, last] (at most 'max_count' buffers and 'max_bytes' bytes,
+          // although the first buffer is always included).
+          // Returns the number of records encoded or 0 on error.
+          size_t encode(uint64_t sequence,
+                        const buffer* first,
+                        const buffer* last,
+                        size_t max_count = max_records,
+                        size_t max_bytes = SIZE_MAX);
+
+          // Encode the header of a data envelope carrying a single record.
+          bool encode(uint64_t sequence, const void* data, size_t len);
+
+          // Encode the header of an envelope carrying a single record.
+          bool encode(type t,
+                      uint64_t sequence,
+                      uint16_t flags,
+                      const void* data,
+                      size_t len);
+
+          // Encode control envelope without records.
+          void encode(type t, uint64_t sequence, uint16_t flags = 0);
+
+          // Get header.
+          const void* data() const;
+
+          // Get header length.
+          size_t length() const;
+
+        private:
+          // Header.
+          uint8_t _M_data[header_size + (max_records * 4)];
+
+          // Header length.
+          size_t _M_length = 0;
+
+          // Encode fixed header.
+          void encode_header(type t,
+                             uint64_t sequence,
+                             uint16_t flags,
+                             size_t count);
+
+          // Disable copy constructor and assignment operator.
+          encoder(const encoder&) = delete;
+          encoder& operator=(const encoder&) = delete;
+      };
+
+      // Envelope decoder.
+      //
+      // The decoder doesn't copy data: the records point into the memory
+      // passed to decode(), which must remain valid while they are used.
+      class decoder {
+        public:
+          // Constructor.
+          decoder() = default;
+
+          // Decode the envelope at the beginning of [data, data + len).
+          enum class result {
+            ok,
+            incomplete,
+            error
+          };
+
+          result decode(const void* data, size_t len, bool verify = true);
+
+          // Decode the fixed header and the record lengths of the envelope at
+          // the beginning of [data, data + len) without requiring the records
+          // (the CRC is not verified and next() cannot be used).
+          result decode_header(const void* data, size_t len);
+
+          // Get envelope size (if the last call to decode() returned
+          // 'incomplete', the minimum number of bytes required so far).
+          size_t size() const;
+
+          // Get envelope type.
+          type envelope_type() const;
+
+          // Get flags.
+          uint16_t flags() const;
+
+          // Get sequence number.
+          uint64_t sequence() const;
+
+          // Get number of records.
+          size_t count() const;
+
+          // Get next record.
+          bool next(const void*& data, size_t& len);
+
+        private:
+          // Envelope type.
+          type _M_type;
+
+          // Flags.
+          uint16_t _M_flags;
+
+          // Sequence number.
+          uint64_t _M_sequence;
+
+          // Number of records.
+          size_t _M_count = 0;
+
+          // Envelope size.
+          size_t _M_size = 0;
+
+          // Next record length.
+          const uint8_t* _M_length = nullptr;
+
+          // Next record.
+          const uint8_t* _M_record = nullptr;
+
+          // Number of records left.
+          size_t _M_left = 0;
+
+          // Disable copy constructor and assignment operator.
+          decoder(const decoder&) = delete;
+          decoder& operator=(const decoder&) = delete;
+      };
+
+      // Read 16-bit integer in network byte order.
+      static uint16_t read16(const uint8_t* p);
+
+      // Read 32-bit integer in network byte order.
+      static uint32_t read32(const uint8_t* p);
+
+      // Read 64-bit integer in network byte order.
+      static uint64_t read64(const uint8_t* p);
+
+      // Write 16-bit integer in network byte order.
+      static void write16(uint8_t* p, uint16_t n);
+
+      // Write 32-bit integer in network byte order.
+      static void write32(uint8_t* p, uint32_t n);
+
+      // Write 64-bit integer in network byte order.
+      static void write64(uint8_t* p, uint64_t n);
+  };
+
+  inline const void* envelope::encoder::data() const
+  {
+    return _M_data;
+  }
+
+  inline size_t envelope::encoder::length() const
+  {
+    return _M_length;
+  }
+
+  inline size_t envelope::decoder::size() const
+  {
+    return _M_size;
+  }
+
+  inline envelope::type envelope::decoder::envelope_type() const
+  {
+    return _M_type;
+  }
+
+  inline uint16_t envelope::decoder::flags() const
+  {
+    return _M_flags;
+  }
+
+  inline uint64_t envelope::decoder::sequence() const
+  {
+    return _M_sequence;
+  }
+
+  inline size_t envelope::decoder::count() const
+  {
+    return _M_count;
+  }
+
+  inline bool envelope::decoder::next(const void*& data, size_t& len)
+  {
+    if (_M_left > 0) {
+      len = read32(_M_length);
+      data = _M_record;
+
+      _M_length += 4;
+      _M_record += len;
+
+      _M_left--;
+
+      return true;
+    }
+
+    return false;
+  }
+
+  inline uint16_t envelope::read16(const uint8_t* p)
+  {
+    return static_cast<uint16_t>((static_cast<uint16_t>(p[0]) << 8) | p[1]);
+  }
+
+  inline uint32_t envelope::read32(const uint8_t* p)
+  {
+    return (static_cast<uint32_t>(p[0]) << 24) |
+           (static_cast<uint32_t>(p[1]) << 16) |
+           (static_cast<uint32_t>(p[2]) << 8) |
+           static_cast<uint32_t>(p[3]);
+  }
+
+  inline uint64_t envelope::read64(const uint8_t* p)
+  {
+    return (static_cast<uint64_t>(read32(p)) << 32) | read32(p + 4);
+  }
+
+  inline void envelope::write16(uint8_t* p, uint16_t n)
+  {
+    p[0] = static_cast<uint8_t>(n >> 8);
+    p[1] = static_cast<uint8_t>(n);
+  }
+
+  inline void envelope::write32(uint8_t* p, uint32_t n)
+  {
+    p[0] = static_cast<uint8_t>(n >> 24);
+    p[1] = static_cast<uint8_t>(n >> 16);
+    p[2] = static_cast<uint8_t>(n >> 8);
+    p[3] = static_cast<uint8_t>(n);
+  }
+
+  inline void envelope::write64(uint8_t* p, uint64_t n)
+  {
+    write32(p, static_cast<uint32_t>(n >> 32));
+    write32(p + 4, static_cast<uint32_t>(n));
+  }
+}
+
+#endif // NET_ENVELOPE_H
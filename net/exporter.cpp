@@ -0,0 +1,716 @@
+#include <stdio.h>
+#include <stddef.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <new>
+#include "net/exporter.h"
+
+const net::exporter::metric net::exporter::sender_metrics[] = {
+  {
+    "netbuf_sender_buffers_enqueued_total",
+    "Buffers passed to send().",
+    "counter",
+    offsetof(net::sender::statistics, buffers_enqueued),
+    false
+  },
+  {
+    "netbuf_sender_bytes_enqueued_total",
+    "Bytes passed to send().",
+    "counter",
+    offsetof(net::sender::statistics, bytes_enqueued),
+    false
+  },
+  {
+    "netbuf_sender_buffers_sent_total",
+    "Buffers sent.",
+    "counter",
+    offsetof(net::sender::statistics, buffers_sent),
+    false
+  },
+  {
+    "netbuf_sender_bytes_sent_total",
+    "Bytes sent.",
+    "counter",
+    offsetof(net::sender::statistics, bytes_sent),
+    false
+  },
+  {
+    "netbuf_sender_buffers_spilled_total",
+    "Buffers written to disk.",
+    "counter",
+    offsetof(net::sender::statistics, buffers_spilled),
+    false
+  },
+  {
+    "netbuf_sender_bytes_spilled_total",
+    "Bytes written to disk.",
+    "counter",
+    offsetof(net::sender::statistics, bytes_spilled),
+    false
+  },
+  {
+    "netbuf_sender_files_replayed_total",
+    "Files sent from disk.",
+    "counter",
+    offsetof(net::sender::statistics, files_replayed),
+    false
+  },
+  {
+    "netbuf_sender_bytes_replayed_total",
+    "Bytes sent from disk.",
+    "counter",
+    offsetof(net::sender::statistics, bytes_replayed),
+    false
+  },
+  {
+    "netbuf_sender_buffers_dropped_total",
+    "Buffers and files discarded.",
+    "counter",
+    offsetof(net::sender::statistics, buffers_dropped),
+    false
+  },
+  {
+    "netbuf_sender_files_rejected_total",
+    "Files too big to be sent in an envelope (left on disk).",
+    "counter",
+    offsetof(net::sender::statistics, files_rejected),
+    false
+  },
+  {
+    "netbuf_sender_buffers_rejected_total",
+    "Buffers rejected because the queue was full.",
+    "counter",
+    offsetof(net::sender::statistics, buffers_rejected),
+    false
+  },
+  {
+    "netbuf_sender_buffers_evicted_total",
+    "Queued buffers discarded to make room for new ones.",
+    "counter",
+    offsetof(net::sender::statistics, buffers_evicted),
+    false
+  },
+  {
+    "netbuf_sender_buffers_discarded_total",
+    "New buffers discarded because the queue was full.",
+    "counter",
+    offsetof(net::sender::statistics, buffers_discarded),
+    false
+  },
+  {
+    "netbuf_sender_buffers_over_quota_total",
+    "Buffers discarded because their tenant exceeded its disk quota.",
+    "counter",
+    offsetof(net::sender::statistics, buffers_over_quota),
+    false
+  },
+  {
+    "netbuf_sender_producer_waits_total",
+    "Times a producer waited for room in the queue.",
+    "counter",
+    offsetof(net::sender::statistics, producer_waits),
+    false
+  },
+  {
+    "netbuf_sender_producer_wait_seconds_total",
+    "Time producers waited for room in the queue.",
+    "counter",
+    offsetof(net::sender::statistics, producer_wait_time),
+    true
+  },
+  {
+    "netbuf_sender_linger_size_flushes_total",
+    "Corked batches flushed because they reached the batch size.",
+    "counter",
+    offsetof(net::sender::statistics, linger_size_flushes),
+    false
+  },
+  {
+    "netbuf_sender_linger_time_flushes_total",
+    "Corked batches flushed because the linger time expired.",
+    "counter",
+    offsetof(net::sender::statistics, linger_time_flushes),
+    false
+  },
+  {
+    "netbuf_sender_connects_total",
+    "Connections established.",
+    "counter",
+    offsetof(net::sender::statistics, connects),
+    false
+  },
+  {
+    "netbuf_sender_connect_failures_total",
+    "Failed connection attempts.",
+    "counter",
+    offsetof(net::sender::statistics, connect_failures),
+    false
+  },
+  {
+    "netbuf_sender_retransmission_failovers_total",
+    "Connections closed because of persistent retransmissions.",
+    "counter",
+    offsetof(net::sender::statistics, retransmission_failovers),
+    false
+  },
+  {
+    "netbuf_sender_queued_buffers",
+    "Buffers waiting to be sent.",
+    "gauge",
+    offsetof(net::sender::statistics, queued_buffers),
+    false
+  },
+  {
+    "netbuf_sender_queued_bytes",
+    "Bytes waiting to be sent.",
+    "gauge",
+    offsetof(net::sender::statistics, queued_bytes),
+    false
+  },
+  {
+    "netbuf_sender_save_seconds_total",
+    "Time writing buffers to disk.",
+    "counter",
+    offsetof(net::sender::statistics, save_time),
+    true
+  },
+  {
+    "netbuf_sender_scan_seconds_total",
+    "Time scanning the directory.",
+    "counter",
+    offsetof(net::sender::statistics, scan_time),
+    true
+  },
+  {
+    "netbuf_sender_io_seconds_total",
+    "Time opening, mapping, closing and removing files.",
+    "counter",
+    offsetof(net::sender::statistics, io_time),
+    true
+  },
+  {
+    "netbuf_sender_network_seconds_total",
+    "Time sending files.",
+    "counter",
+    offsetof(net::sender::statistics, network_time),
+    true
+  },
+  {
+    "netbuf_sender_throttle_seconds_total",
+    "Time waiting for the rate limits.",
+    "counter",
+    offsetof(net::sender::statistics, throttle_time),
+    true
+  },
+  {
+    "netbuf_sender_tcp_rtt_seconds",
+    "Smoothed round-trip time of the TCP connection.",
+    "gauge",
+    offsetof(net::sender::statistics, tcp_rtt),
+    true
+  },
+  {
+    "netbuf_sender_tcp_rtt_variance_seconds",
+    "Round-trip time variance of the TCP connection.",
+    "gauge",
+    offsetof(net::sender::statistics, tcp_rtt_var),
+    true
+  },
+  {
+    "netbuf_sender_tcp_cwnd_segments",
+    "Congestion window of the TCP connection.",
+    "gauge",
+    offsetof(net::sender::statistics, tcp_cwnd),
+    false
+  },
+  {
+    "netbuf_sender_tcp_retransmitted_segments",
+    "Segments retransmitted by the TCP connection.",
+    "gauge",
+    offsetof(net::sender::statistics, tcp_retransmits),
+    false
+  },
+  {
+    "netbuf_sender_tcp_unacked_segments",
+    "Segments of the TCP connection not acknowledged.",
+    "gauge",
+    offsetof(net::sender::statistics, tcp_unacked),
+    false
+  },
+  {
+    "netbuf_sender_tcp_notsent_bytes",
+    "Bytes in the send queue of the TCP connection not sent.",
+    "gauge",
+    offsetof(net::sender::statistics, tcp_notsent_bytes),
+    false
+  },
+  {
+    "netbuf_sender_tcp_pacing_rate_bytes",
+    "Pacing rate of the TCP connection (bytes per second).",
+    "gauge",
+    offsetof(net::sender::statistics, tcp_pacing_rate),
+    false
+  }
+};
+
+const size_t net::exporter::nsender_metrics = sizeof(sender_metrics) /
+                                              sizeof(sender_metrics[0]);
+
+const double net::exporter::quantiles[] = {0.5, 0.9, 0.99, 0.999};
+
+const size_t net::exporter::nquantiles = sizeof(quantiles) /
+                                         sizeof(quantiles[0]);
+
+bool net::exporter::start(const char* path)
+{
+  // Build Unix-domain socket address.
+  if ((!_M_sockaddr.build(path)) || (_M_sockaddr.family() != AF_UNIX)) {
+    return false;
+  }
+
+  // Allocate latency histograms.
+  if (!_M_latency) {
+    _M_latency = new (std::nothrow) sender::latency_histograms();
+    if (!_M_latency) {
+      return false;
+    }
+  }
+
+  // Remove the socket file (if it exists).
+  struct stat sbuf;
+  if ((lstat(path, &sbuf) == 0) && (S_ISSOCK(sbuf.st_mode))) {
+    unlink(path);
+  }
+
+  // Listen.
+  if (_M_listener.listen(_M_sockaddr)) {
+    // Save path.
+    snprintf(_M_path, sizeof(_M_path), "%s", path);
+
+    _M_running = true;
+
+    // Start thread.
+    if (pthread_create(&_M_thread, nullptr, start_routine, this) == 0) {
+      return true;
+    }
+
+    _M_running = false;
+
+    _M_listener.close();
+    unlink(_M_path);
+  }
+
+  return false;
+}
+
+void net::exporter::stop()
+{
+  // If the thread is running...
+  if (_M_running) {
+    _M_running = false;
+    pthread_join(_M_thread, nullptr);
+
+    _M_listener.close();
+    unlink(_M_path);
+  }
+}
+
+void net::exporter::run()
+{
+  do {
+    // Accept new connection.
+    socket sock;
+    if (_M_listener.accept(sock, accept_timeout)) {
+      serve(sock);
+    }
+  } while (_M_running);
+}
+
+void net::exporter::serve(socket& sock)
+{
+  // Receive request (until the end of the headers, otherwise the client
+  // might get an error when the connection is closed).
+  char req[max_request_size];
+  size_t len = 0;
+
+  do {
+    const ssize_t ret = sock.recv(req + len,
+                                  sizeof(req) - 1 - len,
+                                  socket_timeout);
+
+    if (ret <= 0) {
+      return;
+    }
+
+    len += ret;
+    req[len] = 0;
+
+    // If the request is too big...
+    if (len == sizeof(req) - 1) {
+      return;
+    }
+  } while ((!strstr(req, "\r\n\r\n")) && (!strstr(req, "\n\n")));
+
+  // Compose response body.
+  const char* status = "200 OK";
+  const char* content_type;
+  bool ret;
+
+  _M_length = 0;
+
+  if (strncmp(req, "GET /metrics/binary ", 20) == 0) {
+    content_type = "application/octet-stream";
+    ret = binary();
+  } else if (strncmp(req, "GET /metrics ", 13) == 0) {
+    content_type = "text/plain; version=0.0.4";
+    ret = text();
+  } else {
+    status = "404 Not Found";
+    content_type = "text/plain";
+    ret = true;
+  }
+
+  if (!ret) {
+    status = "500 Internal Server Error";
+    content_type = "text/plain";
+
+    _M_length = 0;
+  }
+
+  // Compose response header.
+  char header[256];
+  const int n = snprintf(header,
+                         sizeof(header),
+                         "HTTP/1.0 %s\r\n"
+                         "Content-Type: %s\r\n"
+                         "Content-Length: %zu\r\n"
+                         "Connection: close\r\n"
+                         "\r\n",
+                         status,
+                         content_type,
+                         _M_length);
+
+  // Send response.
+  struct iovec iov[2];
+  iov[0].iov_base = header;
+  iov[0].iov_len = n;
+  iov[1].iov_base = _M_body;
+  iov[1].iov_len = _M_length;
+
+  sock.writev(iov, (_M_length > 0) ? 2 : 1, socket_timeout);
+}
+
+bool net::exporter::text()
+{
+  // Get sender statistics.
+  sender::statistics stats[max_senders];
+  for (size_t i = 0; i < _M_nsenders; i++) {
+    _M_senders[i].s->stats(stats[i]);
+  }
+
+  // If there are senders...
+  if (_M_nsenders > 0) {
+    // For each metric...
+    for (size_t i = 0; i < nsender_metrics; i++) {
+      const metric& m = sender_metrics[i];
+
+      if (!format("# HELP %s %s\n# TYPE %s %s\n",
+                  m.name,
+                  m.help,
+                  m.name,
+                  m.type)) {
+        return false;
+      }
+
+      // For each sender...
+      for (size_t j = 0; j < _M_nsenders; j++) {
+        const uint64_t n = value(stats[j], m);
+
+        if (!(m.nanoseconds ?
+                format("%s{sender=\"%s\"} %.9f\n",
+                       m.name,
+                       _M_senders[j].name,
+                       n / 1e9) :
+                format("%s{sender=\"%s\"} %llu\n",
+                       m.name,
+                       _M_senders[j].name,
+                       static_cast<unsigned long long>(n)))) {
+          return false;
+        }
+      }
+    }
+
+    // Latency histograms.
+    if ((!text("netbuf_sender_queue_wait_seconds",
+               "Time from send() until the buffer is sent.",
+               &sender::latency_histograms::queue_wait)) ||
+        (!text("netbuf_sender_send_seconds",
+               "Time writing to the socket.",
+               &sender::latency_histograms::send)) ||
+        (!text("netbuf_sender_connect_seconds",
+               "Time establishing the connection.",
+               &sender::latency_histograms::connect)) ||
+        (!text("netbuf_sender_handshake_seconds",
+               "Time performing the session handshake.",
+               &sender::latency_histograms::handshake)) ||
+        (!text("netbuf_sender_spill_seconds",
+               "Time writing a buffer to disk.",
+               &sender::latency_histograms::spill)) ||
+        (!text("netbuf_sender_tx_scheduled_seconds",
+               "Time from send() until the kernel schedules the buffer.",
+               &sender::latency_histograms::tx_scheduled)) ||
+        (!text("netbuf_sender_tx_sent_seconds",
+               "Time from send() until the buffer is passed to the device.",
+               &sender::latency_histograms::tx_sent)) ||
+        (!text("netbuf_sender_tx_acknowledged_seconds",
+               "Time from send() until the peer acknowledges the buffer.",
+               &sender::latency_histograms::tx_acknowledged))) {
+      return false;
+    }
+  }
+
+  // If there are allocators...
+  if (_M_nallocators > 0) {
+    buffer::allocator::statistics st[max_allocators];
+    for (size_t i = 0; i < _M_nallocators; i++) {
+      _M_allocators[i].allocator->stats(st[i]);
+    }
+
+    if (!format("# HELP netbuf_allocator_buffers Buffers allocated.\n"
+                "# TYPE netbuf_allocator_buffers gauge\n")) {
+      return false;
+    }
+
+    for (size_t i = 0; i < _M_nallocators; i++) {
+      if (!format("netbuf_allocator_buffers{allocator=\"%s\"} %zu\n",
+                  _M_allocators[i].name,
+                  st[i].buffers)) {
+        return false;
+      }
+    }
+
+    if (!format("# HELP netbuf_allocator_free_buffers Free buffers.\n"
+                "# TYPE netbuf_allocator_free_buffers gauge\n")) {
+      return false;
+    }
+
+    for (size_t i = 0; i < _M_nallocators; i++) {
+      if (!format("netbuf_allocator_free_buffers{allocator=\"%s\"} %zu\n",
+                  _M_allocators[i].name,
+                  st[i].free)) {
+        return false;
+      }
+    }
+  }
+
+  return true;
+}
+
+bool net::exporter::text(const char* name,
+                         const char* help,
+                         const histogram sender::latency_histograms::* hist)
+{
+  if (!format("# HELP %s %s\n# TYPE %s summary\n", name, help, name)) {
+    return false;
+  }
+
+  // For each sender...
+  for (size_t i = 0; i < _M_nsenders; i++) {
+    // If the sender records the latency...
+    if (_M_senders[i].s->latency(*_M_latency)) {
+      const histogram& h = (*_M_latency).*hist;
+
+      for (size_t j = 0; j < nquantiles; j++) {
+        if (!format("%s{sender=\"%s\",quantile=\"%g\"} %.9f\n",
+                    name,
+                    _M_senders[i].name,
+                    quantiles[j],
+                    h.percentile(quantiles[j] * 100.0) / 1e9)) {
+          return false;
+        }
+      }
+
+      if (!format("%s_sum{sender=\"%s\"} %.9f\n"
+                  "%s_count{sender=\"%s\"} %llu\n",
+                  name,
+                  _M_senders[i].name,
+                  h.sum() / 1e9,
+                  name,
+                  _M_senders[i].name,
+                  static_cast<unsigned long long>(h.count()))) {
+        return false;
+      }
+    }
+  }
+
+  return true;
+}
+
+bool net::exporter::binary()
+{
+  static const uint8_t magic[] = {'N', 'B', 'S', 'T'};
+
+  // Header.
+  if ((!append(magic, sizeof(magic))) || (!append8(version))) {
+    return false;
+  }
+
+  // For each sender...
+  for (size_t i = 0; i < _M_nsenders; i++) {
+    const char* name = _M_senders[i].name;
+
+    sender::statistics stats;
+    _M_senders[i].s->stats(stats);
+
+    if ((!binary(record::sender, name)) || (!append8(nsender_metrics))) {
+      return false;
+    }
+
+    for (size_t j = 0; j < nsender_metrics; j++) {
+      if (!append64(value(stats, sender_metrics[j]))) {
+        return false;
+      }
+    }
+
+    // If the sender records the latency...
+    if (_M_senders[i].s->latency(*_M_latency)) {
+      if ((!binary(name, 0, _M_latency->queue_wait)) ||
+          (!binary(name, 1, _M_latency->send)) ||
+          (!binary(name, 2, _M_latency->connect)) ||
+          (!binary(name, 3, _M_latency->handshake)) ||
+          (!binary(name, 4, _M_latency->spill)) ||
+          (!binary(name, 5, _M_latency->tx_scheduled)) ||
+          (!binary(name, 6, _M_latency->tx_sent)) ||
+          (!binary(name, 7, _M_latency->tx_acknowledged))) {
+        return false;
+      }
+    }
+  }
+
+  // For each allocator...
+  for (size_t i = 0; i < _M_nallocators; i++) {
+    buffer::allocator::statistics st;
+    _M_allocators[i].allocator->stats(st);
+
+    if ((!binary(record::allocator, _M_allocators[i].name)) ||
+        (!append8(2)) ||
+        (!append64(st.buffers)) ||
+        (!append64(st.free))) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+bool net::exporter::binary(const char* name, uint8_t id, const histogram& hist)
+{
+  // Count non-empty buckets.
+  uint16_t nbuckets = 0;
+  for (size_t i = 0; i < histogram::buckets; i++) {
+    if (hist.count(i) > 0) {
+      nbuckets++;
+    }
+  }
+
+  if ((!binary(record::histogram, name)) ||
+      (!append8(id)) ||
+      (!append64(hist.count())) ||
+      (!append64(hist.sum())) ||
+      (!append64(hist.min())) ||
+      (!append64(hist.max())) ||
+      (!append16(nbuckets))) {
+    return false;
+  }
+
+  // For each non-empty bucket...
+  for (size_t i = 0; (i < histogram::buckets) && (nbuckets > 0); i++) {
+    const uint64_t n = hist.count(i);
+    if (n > 0) {
+      if ((!append16(static_cast<uint16_t>(i))) || (!append64(n))) {
+        return false;
+      }
+
+      nbuckets--;
+    }
+  }
+
+  return true;
+}
+
+bool net::exporter::binary(record type, const char* name)
+{
+  const size_t len = strlen(name);
+
+  return ((append8(static_cast<uint8_t>(type))) &&
+          (append8(static_cast<uint8_t>(len))) &&
+          (append(name, len)));
+}
+
+uint64_t net::exporter::value(const sender::statistics& stats,
+                              const metric& m)
+{
+  uint64_t n;
+  memcpy(&n, reinterpret_cast<const uint8_t*>(&stats) + m.offset, sizeof(n));
+
+  return n;
+}
+
+bool net::exporter::format(const char* fmt, ...)
+{
+  va_list ap;
+
+  va_start(ap, fmt);
+  const int n = vsnprintf(reinterpret_cast<char*>(_M_body) + _M_length,
+                          _M_size - _M_length,
+                          fmt,
+                          ap);
+  va_end(ap);
+
+  if (n < 0) {
+    return false;
+  }
+
+  // If the text didn't fit...
+  if (_M_length + n >= _M_size) {
+    if (!reserve(n + 1)) {
+      return false;
+    }
+
+    va_start(ap, fmt);
+    vsnprintf(reinterpret_cast<char*>(_M_body) + _M_length,
+              _M_size - _M_length,
+              fmt,
+              ap);
+    va_end(ap);
+  }
+
+  _M_length += n;
+
+  return true;
+}
+
+bool net::exporter::reserve(size_t len)
+{
+  // If there is enough space...
+  if (_M_length + len <= _M_size) {
+    return true;
+  }
+
+  size_t size = (_M_size > 0) ? _M_size : initial_size;
+  while (size < _M_length + len) {
+    size *= 2;
+  }
+
+  uint8_t* body = static_cast<uint8_t*>(realloc(_M_body, size));
+  if (body) {
+    _M_body = body;
+    _M_size = size;
+
+    return true;
+  }
+
+  return false;
+}
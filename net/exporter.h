@@ -0,0 +1,299 @@
+#ifndef NET_EXPORTER_H
+#define NET_EXPORTER_H
+
+#include <stdint.h>
+#include <string.h>
+#include <limits.h>
+#include <pthread.h>
+#include "net/buffer.h"
+#include "net/sender.h"
+#include "net/socket.h"
+
+namespace net {
+  // Statistics exporter.
+  //
+  // Serves the statistics and latency histograms of senders and allocators
+  // over a local (Unix-domain) socket from a background thread. Each
+  // connection receives a single HTTP/1.0 response and is closed:
+  //   GET /metrics         Prometheus text format.
+  //   GET /metrics/binary  Compact binary format (see below).
+  // e.g.: curl --unix-socket /run/app/netbuf.sock http://localhost/metrics
+  //
+  // The statistics are read with relaxed atomic loads: the threads using the
+  // senders and allocators are never blocked by the exporter.
+  //
+  // Binary format (integers in network byte order):
+  //   Header: magic "NBST" (4 bytes), version (1 byte).
+  //   Followed by records, each one starting with the record type (1 byte),
+  //   the length of the name (1 byte) and the name:
+  //     Sender (type 1): number of values (1 byte) and the values (8 bytes
+  //       each) in the order of the fields of sender::statistics.
+  //     Allocator (type 2): number of values (1 byte) and the values (8
+  //       bytes each) in the order of the fields of
+  //       buffer::allocator::statistics.
+  //     Histogram (type 3), after the record of its sender: histogram
+  //       (1 byte: 0 queue wait, 1 send, 2 connect, 3 handshake, 4 spill,
+  //       5 tx scheduled, 6 tx sent, 7 tx acknowledged), count, sum, minimum
+  //       and maximum (8 bytes each), number of non-empty buckets (2 bytes)
+  //       and the buckets: index (2 bytes) and count (8 bytes) (see
+  //       net::histogram).
+  class exporter {
+    public:
+      // Maximum number of senders and allocators.
+      static constexpr const size_t max_senders = 16;
+      static constexpr const size_t max_allocators = 16;
+
+      // Maximum name length.
+      static constexpr const size_t max_name_length = 64;
+
+      // Constructor.
+      exporter() = default;
+
+      // Destructor.
+      ~exporter();
+
+      // Add sender / allocator (must be called before start()). The name is
+      // used as label ('sender' / 'allocator'), must remain valid and cannot
+      // contain quotes, backslashes or newlines.
+      bool add(const char* name, const sender& s);
+      bool add(const char* name, const buffer::allocator& allocator);
+
+      // Start (the socket file is replaced if it already exists).
+      bool start(const char* path);
+
+      // Stop.
+      void stop();
+
+    private:
+      // Accept timeout in milliseconds (how often the thread checks whether
+      // it has to stop).
+      static constexpr const int accept_timeout = 250;
+
+      // Socket timeout in milliseconds.
+      static constexpr const int socket_timeout = 1000;
+
+      // Maximum size of a request.
+      static constexpr const size_t max_request_size = 4096;
+
+      // Initial size of the response body.
+      static constexpr const size_t initial_size = 16 * 1024;
+
+      // Binary format.
+      static constexpr const uint8_t version = 1;
+
+      enum class record : uint8_t {
+        sender = 1,
+        allocator = 2,
+        histogram = 3
+      };
+
+      // Metric.
+      struct metric {
+        // Name.
+        const char* name;
+
+        // Help.
+        const char* help;
+
+        // Type (counter or gauge).
+        const char* type;
+
+        // Offset of the value in sender::statistics.
+        size_t offset;
+
+        // Value in nanoseconds (exported in seconds)?
+        bool nanoseconds;
+      };
+
+      // Sender metrics (in the order of the fields of sender::statistics).
+      static const metric sender_metrics[];
+      static const size_t nsender_metrics;
+
+      // Quantiles of the latency histograms.
+      static const double quantiles[];
+      static const size_t nquantiles;
+
+      // Senders.
+      struct named_sender {
+        const char* name;
+        const sender* s;
+      };
+
+      named_sender _M_senders[max_senders];
+      size_t _M_nsenders = 0;
+
+      // Allocators.
+      struct named_allocator {
+        const char* name;
+        const buffer::allocator* allocator;
+      };
+
+      named_allocator _M_allocators[max_allocators];
+      size_t _M_nallocators = 0;
+
+      // Socket address and path.
+      socket::address _M_sockaddr;
+      char _M_path[PATH_MAX];
+
+      // Listener socket.
+      socket _M_listener;
+
+      // Latency histograms (snapshot).
+      sender::latency_histograms* _M_latency = nullptr;
+
+      // Response body.
+      uint8_t* _M_body = nullptr;
+      size_t _M_size = 0;
+      size_t _M_length = 0;
+
+      // Thread id.
+      pthread_t _M_thread;
+
+      // Running?
+      bool _M_running = false;
+
+      // Run.
+      void run();
+
+      // Serve connection.
+      void serve(socket& sock);
+
+      // Compose Prometheus text.
+      bool text();
+
+      // Compose Prometheus summary of a latency histogram.
+      bool text(const char* name,
+                const char* help,
+                const histogram sender::latency_histograms::* hist);
+
+      // Compose binary.
+      bool binary();
+
+      // Append histogram record.
+      bool binary(const char* name, uint8_t id, const histogram& hist);
+
+      // Append record header.
+      bool binary(record type, const char* name);
+
+      // Get value of a metric.
+      static uint64_t value(const sender::statistics& stats, const metric& m);
+
+      // Is the name valid?
+      static bool valid(const char* name);
+
+      // Append formatted text to the body.
+      bool format(const char* fmt, ...)
+        __attribute__ ((format (printf, 2, 3)));
+
+      // Append integers to the body.
+      bool append8(uint8_t n);
+      bool append16(uint16_t n);
+      bool append64(uint64_t n);
+
+      // Append data to the body.
+      bool append(const void* data, size_t len);
+
+      // Reserve space in the body.
+      bool reserve(size_t len);
+
+      // Start routine.
+      static void* start_routine(void* arg);
+
+      // Disable copy constructor and assignment operator.
+      exporter(const exporter&) = delete;
+      exporter& operator=(const exporter&) = delete;
+  };
+
+  inline exporter::~exporter()
+  {
+    stop();
+
+    if (_M_latency) {
+      delete _M_latency;
+    }
+
+    if (_M_body) {
+      free(_M_body);
+    }
+  }
+
+  inline bool exporter::add(const char* name, const sender& s)
+  {
+    if ((!_M_running) &&
+        (_M_nsenders < max_senders) &&
+        (valid(name))) {
+      _M_senders[_M_nsenders].name = name;
+      _M_senders[_M_nsenders].s = &s;
+
+      _M_nsenders++;
+
+      return true;
+    }
+
+    return false;
+  }
+
+  inline bool exporter::add(const char* name,
+                            const buffer::allocator& allocator)
+  {
+    if ((!_M_running) &&
+        (_M_nallocators < max_allocators) &&
+        (valid(name))) {
+      _M_allocators[_M_nallocators].name = name;
+      _M_allocators[_M_nallocators].allocator = &allocator;
+
+      _M_nallocators++;
+
+      return true;
+    }
+
+    return false;
+  }
+
+  inline bool exporter::valid(const char* name)
+  {
+    return ((strlen(name) <= max_name_length) &&
+            (!strpbrk(name, "\"\\\n")));
+  }
+
+  inline bool exporter::append8(uint8_t n)
+  {
+    return append(&n, 1);
+  }
+
+  inline bool exporter::append16(uint16_t n)
+  {
+    uint8_t buf[2];
+    envelope::write16(buf, n);
+
+    return append(buf, sizeof(buf));
+  }
+
+  inline bool exporter::append64(uint64_t n)
+  {
+    uint8_t buf[8];
+    envelope::write64(buf, n);
+
+    return append(buf, sizeof(buf));
+  }
+
+  inline bool exporter::append(const void* data, size_t len)
+  {
+    if (reserve(len)) {
+      memcpy(_M_body + _M_length, data, len);
+      _M_length += len;
+
+      return true;
+    }
+
+    return false;
+  }
+
+  inline void* exporter::start_routine(void* arg)
+  {
+    static_cast<exporter*>(arg)->run();
+    return nullptr;
+  }
+}
+
+#endif // NET_EXPORTER_H
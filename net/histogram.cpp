@@ -0,0 +1,66 @@
+#include "net/histogram.h"
+
+void net::histogram::merge(const histogram& other)
+{
+  for (size_t i = 0; i < buckets; i++) {
+    const uint64_t n = other._M_counts[i].load(std::memory_order_relaxed);
+    if (n > 0) {
+      _M_counts[i].fetch_add(n, std::memory_order_relaxed);
+    }
+  }
+
+  const uint64_t n = other.count();
+  if (n > 0) {
+    _M_count.fetch_add(n, std::memory_order_relaxed);
+    _M_sum.fetch_add(other._M_sum.load(std::memory_order_relaxed),
+                     std::memory_order_relaxed);
+
+    update_min(other._M_min.load(std::memory_order_relaxed));
+    update_max(other._M_max.load(std::memory_order_relaxed));
+  }
+}
+
+void net::histogram::reset()
+{
+  for (size_t i = 0; i < buckets; i++) {
+    _M_counts[i].store(0, std::memory_order_relaxed);
+  }
+
+  _M_count.store(0, std::memory_order_relaxed);
+  _M_sum.store(0, std::memory_order_relaxed);
+  _M_min.store(UINT64_MAX, std::memory_order_relaxed);
+  _M_max.store(0, std::memory_order_relaxed);
+}
+
+uint64_t net::histogram::percentile(double p) const
+{
+  const uint64_t n = count();
+  if (n == 0) {
+    return 0;
+  }
+
+  // Compute rank of the value.
+  uint64_t rank = (p >= 100.0) ?
+                    n :
+                    static_cast<uint64_t>((p / 100.0) * n + 0.5);
+
+  if (rank == 0) {
+    rank = 1;
+  }
+
+  // Search bucket.
+  uint64_t total = 0;
+  for (size_t i = 0; i < buckets; i++) {
+    total += _M_counts[i].load(std::memory_order_relaxed);
+
+    if (total >= rank) {
+      // Don't report more than the maximum value recorded.
+      const uint64_t value = highest(i);
+      const uint64_t maxval = max();
+
+      return (value < maxval) ? value : maxval;
+    }
+  }
+
+  return max();
+}
@@ -0,0 +1,182 @@
+#ifndef NET_HISTOGRAM_H
+#define NET_HISTOGRAM_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <atomic>
+
+namespace net {
+  // Histogram.
+  //
+  // Log-linear histogram of 64-bit values (e.g. latencies in nanoseconds):
+  // the values below 2 * sub_buckets are counted exactly and the rest in
+  // buckets whose width is at most 1/sub_buckets of their value (about 3%).
+  //
+  // Values can be recorded from several threads without locking and
+  // histograms can be merged; a histogram being updated can be read, the
+  // result is a consistent enough approximation.
+  class histogram {
+    public:
+      // Number of sub-buckets per power of two.
+      static constexpr const unsigned sub_bucket_bits = 5;
+      static constexpr const size_t sub_buckets = 1u << sub_bucket_bits;
+
+      // Number of buckets.
+      static constexpr const size_t buckets = (65 - sub_bucket_bits) *
+                                              sub_buckets;
+
+      // Constructor.
+      histogram();
+
+      // Record value.
+      void record(uint64_t value);
+
+      // Add the values recorded in another histogram.
+      void merge(const histogram& other);
+
+      // Reset.
+      void reset();
+
+      // Get number of values recorded.
+      uint64_t count() const;
+
+      // Get number of values recorded in a bucket.
+      uint64_t count(size_t idx) const;
+
+      // Get sum of the values recorded.
+      uint64_t sum() const;
+
+      // Get minimum / maximum value recorded (0 if no values).
+      uint64_t min() const;
+      uint64_t max() const;
+
+      // Get mean value.
+      double mean() const;
+
+      // Get the value below which 'p' percent of the values fall (upper
+      // bound of the bucket).
+      uint64_t percentile(double p) const;
+
+      // Get bucket index of a value.
+      static size_t bucket(uint64_t value);
+
+      // Get highest value of a bucket.
+      static uint64_t highest(size_t idx);
+
+    private:
+      // Counters.
+      std::atomic<uint64_t> _M_counts[buckets];
+
+      // Number of values, sum, minimum and maximum.
+      std::atomic<uint64_t> _M_count;
+      std::atomic<uint64_t> _M_sum;
+      std::atomic<uint64_t> _M_min;
+      std::atomic<uint64_t> _M_max;
+
+      // Update minimum / maximum.
+      void update_min(uint64_t value);
+      void update_max(uint64_t value);
+
+      // Disable copy constructor and assignment operator.
+      histogram(const histogram&) = delete;
+      histogram& operator=(const histogram&) = delete;
+  };
+
+  inline histogram::histogram()
+  {
+    reset();
+  }
+
+  inline void histogram::record(uint64_t value)
+  {
+    _M_counts[bucket(value)].fetch_add(1, std::memory_order_relaxed);
+
+    _M_count.fetch_add(1, std::memory_order_relaxed);
+    _M_sum.fetch_add(value, std::memory_order_relaxed);
+
+    update_min(value);
+    update_max(value);
+  }
+
+  inline uint64_t histogram::count() const
+  {
+    return _M_count.load(std::memory_order_relaxed);
+  }
+
+  inline uint64_t histogram::count(size_t idx) const
+  {
+    return _M_counts[idx].load(std::memory_order_relaxed);
+  }
+
+  inline uint64_t histogram::sum() const
+  {
+    return _M_sum.load(std::memory_order_relaxed);
+  }
+
+  inline uint64_t histogram::min() const
+  {
+    return (count() > 0) ? _M_min.load(std::memory_order_relaxed) : 0;
+  }
+
+  inline uint64_t histogram::max() const
+  {
+    return _M_max.load(std::memory_order_relaxed);
+  }
+
+  inline double histogram::mean() const
+  {
+    const uint64_t n = count();
+    return (n > 0) ?
+             static_cast<double>(_M_sum.load(std::memory_order_relaxed)) / n :
+             0.0;
+  }
+
+  inline size_t histogram::bucket(uint64_t value)
+  {
+    // If the value is counted exactly...
+    if (value < 2 * sub_buckets) {
+      return static_cast<size_t>(value);
+    }
+
+    // Position of the most significant bit.
+    const unsigned msb = 63 - __builtin_clzll(value);
+    const unsigned shift = msb - sub_bucket_bits;
+
+    return ((shift + 1) * sub_buckets) +
+           static_cast<size_t>((value >> shift) - sub_buckets);
+  }
+
+  inline uint64_t histogram::highest(size_t idx)
+  {
+    // If the bucket counts a single value...
+    if (idx < 2 * sub_buckets) {
+      return idx;
+    }
+
+    const unsigned shift = (idx / sub_buckets) - 1;
+    const uint64_t first = static_cast<uint64_t>(sub_buckets +
+                                                 (idx % sub_buckets)) << shift;
+
+    return first + ((static_cast<uint64_t>(1) << shift) - 1);
+  }
+
+  inline void histogram::update_min(uint64_t value)
+  {
+    uint64_t cur = _M_min.load(std::memory_order_relaxed);
+    while ((value < cur) &&
+           (!_M_min.compare_exchange_weak(cur,
+                                          value,
+                                          std::memory_order_relaxed)));
+  }
+
+  inline void histogram::update_max(uint64_t value)
+  {
+    uint64_t cur = _M_max.load(std::memory_order_relaxed);
+    while ((value > cur) &&
+           (!_M_max.compare_exchange_weak(cur,
+                                          value,
+                                          std::memory_order_relaxed)));
+  }
+}
+
+#endif // NET_HISTOGRAM_H
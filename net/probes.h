@@ -0,0 +1,33 @@
+#ifndef NET_PROBES_H
+#define NET_PROBES_H
+
+// USDT probes (provider "netbuf").
+//
+// Compiled out unless USDT is defined (requires <sys/sdt.h>, e.g. from
+// systemtap-sdt-dev); the arguments are not evaluated then. The probes can
+// be listed with: bpftrace -l 'usdt:./libnetbuf.so:netbuf:*'
+//
+//   buffers_enqueue(buffers, count, queued)  Buffers added to the back.
+//   buffers_requeue(buffers, count, queued)  Buffers returned to the front.
+//   buffers_dequeue(buffers, count)          Buffers removed.
+//   send_start(sender, bytes)                Write to the socket.
+//   send_finish(sender, ok)
+//   spill_start(sender)                      Queued buffers saved to disk.
+//   spill_finish(sender, buffers, bytes)
+//   replay_start(sender)                     Files sent from disk.
+//   replay_finish(sender, ok)
+//   allocator_refill(allocator, buffers)     Buffers allocated.
+
+#if USDT
+  #include <sys/sdt.h>
+
+  #define NET_PROBE1(name, a) DTRACE_PROBE1(netbuf, name, a)
+  #define NET_PROBE2(name, a, b) DTRACE_PROBE2(netbuf, name, a, b)
+  #define NET_PROBE3(name, a, b, c) DTRACE_PROBE3(netbuf, name, a, b, c)
+#else
+  #define NET_PROBE1(name, a)
+  #define NET_PROBE2(name, a, b)
+  #define NET_PROBE3(name, a, b, c)
+#endif // USDT
+
+#endif // NET_PROBES_H
@@ -0,0 +1,689 @@
+#include <string.h>
+#include <errno.h>
+#include <new>
+#include "net/receiver.h"
+#include "net/crc32c.h"
+
+bool net::receiver::start(encryption enc, void* user)
+{
+  // Listen.
+  if (_M_listener.listen(_M_sockaddr)) {
+    _M_encryption = enc;
+
+    _M_user = user;
+
+    _M_fds[0].fd = _M_listener.fd();
+    _M_fds[0].events = POLLIN;
+
+    _M_running = true;
+
+    // Start thread.
+    if (pthread_create(&_M_thread, nullptr, start_routine, this) == 0) {
+      return true;
+    }
+
+    _M_running = false;
+
+    _M_listener.close();
+  }
+
+  return false;
+}
+
+void net::receiver::stop()
+{
+  // If the thread is running...
+  if (_M_running) {
+    _M_running = false;
+    pthread_join(_M_thread, nullptr);
+
+    // Close connections.
+    while (_M_nconnections > 0) {
+      close(_M_nconnections - 1);
+    }
+
+    _M_listener.close();
+  }
+}
+
+void net::receiver::run()
+{
+  do {
+    // Wait for events.
+    if (poll(_M_fds, 1 + _M_nconnections, poll_timeout) > 0) {
+      // Process connections (in reverse order, as closing a connection moves
+      // the last connection to its position).
+      for (size_t i = _M_nconnections; i > 0; i--) {
+        if (_M_fds[i].revents) {
+          connection& conn = *_M_connections[i - 1];
+
+          if (!(conn._M_handshaking ? handshake(i - 1) :
+                                      (this->*_M_process)(conn))) {
+            close(i - 1);
+          }
+        }
+      }
+
+      // If there are new connections...
+      if (_M_fds[0].revents & POLLIN) {
+        accept();
+      }
+    }
+
+    // If the connections are encrypted...
+    if (_M_encryption == encryption::yes) {
+      expire_handshakes();
+    }
+  } while (_M_running);
+}
+
+void net::receiver::accept()
+{
+  do {
+    // Accept new connection.
+    socket sock;
+    if (_M_listener.accept(sock)) {
+      // If there are too many connections...
+      if (_M_nconnections == max_connections) {
+        continue;
+      }
+
+      // Send acknowledgements without delay.
+      sock.set_tcp_no_delay(true);
+
+      connection* conn = new (std::nothrow) connection(sock);
+      if (conn) {
+        // If the connection is not encrypted or the TLS handshake could be
+        // prepared (it is performed by the poll loop, so a slow client
+        // doesn't hold up the other connections)...
+        if ((_M_encryption == encryption::no) || (conn->begin_handshake())) {
+          if (_M_encryption == encryption::yes) {
+            conn->_M_handshaking = true;
+            conn->_M_handshake_deadline = time(nullptr) + handshake_timeout;
+          }
+
+          _M_connections[_M_nconnections] = conn;
+
+          // Wait for data (the client starts the TLS handshake).
+          _M_fds[1 + _M_nconnections].fd = conn->fd();
+          _M_fds[1 + _M_nconnections].events = POLLIN;
+          _M_fds[1 + _M_nconnections].revents = 0;
+
+          _M_nconnections++;
+        } else {
+          delete conn;
+        }
+      }
+    } else {
+      return;
+    }
+  } while (true);
+}
+
+bool net::receiver::handshake(size_t idx)
+{
+  connection& conn = *_M_connections[idx];
+
+  // Continue TLS handshake.
+  bool done;
+  short events;
+  if (!conn.handshake(done, events)) {
+    return false;
+  }
+
+  // If the handshake has not been completed yet...
+  if (!done) {
+    // Wait for the socket to be readable or writable.
+    _M_fds[1 + idx].events = events;
+    return true;
+  }
+
+  conn._M_handshaking = false;
+
+  _M_fds[1 + idx].events = POLLIN;
+
+  // Process the data which might have been sent right after the handshake.
+  return (this->*_M_process)(conn);
+}
+
+void net::receiver::expire_handshakes()
+{
+  const time_t now = time(nullptr);
+
+  for (size_t i = _M_nconnections; i > 0; i--) {
+    const connection* conn = _M_connections[i - 1];
+
+    if ((conn->_M_handshaking) && (now >= conn->_M_handshake_deadline)) {
+      close(i - 1);
+    }
+  }
+}
+
+bool net::receiver::process_envelopes(connection& conn)
+{
+  do {
+    // If the receive buffer is full...
+    if (conn._M_length == conn._M_size) {
+      const size_t size = (conn._M_size > 0) ? conn._M_size * 2 :
+                                               initial_buffer_size;
+
+      uint8_t* data = static_cast<uint8_t*>(realloc(conn._M_data, size));
+      if (!data) {
+        return false;
+      }
+
+      conn._M_data = data;
+      conn._M_size = size;
+    }
+
+    // Receive.
+    const ssize_t ret = conn.recv(conn._M_data + conn._M_length,
+                                  conn._M_size - conn._M_length);
+
+    // If data has been received...
+    if (ret > 0) {
+      conn._M_length += ret;
+
+      bool ack = false;
+
+      // Credit to be granted.
+      size_t bytes = 0;
+      size_t records = 0;
+
+      // Process complete envelopes.
+      size_t offset = 0;
+      bool more = true;
+      do {
+        switch (_M_decoder.decode(conn._M_data + offset,
+                                  conn._M_length - offset)) {
+          case envelope::decoder::result::ok:
+            switch (_M_decoder.envelope_type()) {
+              case envelope::type::data:
+                // If the envelope has not been received before...
+                if (_M_decoder.sequence() > conn._M_sequence) {
+                  if (!_M_fn(_M_decoder, _M_user)) {
+                    return false;
+                  }
+
+                  conn._M_sequence = _M_decoder.sequence();
+                }
+
+                // Grant again the credit consumed by the envelope.
+                bytes += _M_decoder.size() -
+                         envelope::header_size -
+                         (_M_decoder.count() * 4);
+
+                records += _M_decoder.count();
+
+                ack = conn._M_hello;
+                break;
+              case envelope::type::hello:
+                conn._M_hello = true;
+                conn._M_session = _M_decoder.sequence();
+                conn._M_sequence = find_session(conn._M_session);
+
+                conn._M_flow_control =
+                  ((_M_decoder.flags() & envelope::flow_control) != 0);
+
+                // Grant initial credit.
+                bytes = _M_credit_bytes;
+                records = _M_credit_records;
+
+                ack = true;
+                break;
+              default:
+                break;
+            }
+
+            offset += _M_decoder.size();
+            break;
+          case envelope::decoder::result::incomplete:
+            // If the envelope is too big...
+            if (_M_decoder.size() > max_envelope_size) {
+              return false;
+            }
+
+            // If the envelope doesn't fit in the receive buffer...
+            if (_M_decoder.size() > conn._M_size) {
+              uint8_t* data = static_cast<uint8_t*>(
+                                realloc(conn._M_data, _M_decoder.size())
+                              );
+
+              if (!data) {
+                return false;
+              }
+
+              conn._M_data = data;
+              conn._M_size = _M_decoder.size();
+            }
+
+            more = false;
+            break;
+          case envelope::decoder::result::error:
+          default:
+            return false;
+        }
+      } while (more);
+
+      // Move incomplete envelope to the beginning of the buffer.
+      if (offset > 0) {
+        memmove(conn._M_data, conn._M_data + offset, conn._M_length - offset);
+        conn._M_length -= offset;
+      }
+
+      // Send acknowledgement (if needed).
+      if ((ack) && (!acknowledge(conn, bytes, records))) {
+        return false;
+      }
+    } else if (ret == 0) {
+      // The peer has closed the connection.
+      return false;
+    } else {
+      return (errno == EAGAIN);
+    }
+  } while (true);
+}
+
+bool net::receiver::process_buffers(connection& conn)
+{
+  do {
+    ssize_t ret;
+
+    // If a big record is being received and there is no data left in the
+    // receive buffer...
+    if ((conn._M_receiving) &&
+        (conn._M_length == 0) &&
+        (conn._M_lengths[conn._M_record] - conn._M_offset >=
+         direct_receive_size)) {
+      if (!begin_record(conn)) {
+        return false;
+      }
+
+      // Receive directly into the buffer.
+      uint8_t* data = static_cast<uint8_t*>(conn._M_last->data()) +
+                      conn._M_offset;
+
+      ret = conn.recv(data, conn._M_lengths[conn._M_record] - conn._M_offset);
+
+      if (ret > 0) {
+        conn._M_crc = crc32c(conn._M_crc, data, ret);
+        conn._M_offset += ret;
+      }
+    } else {
+      // If the receive buffer has not been allocated yet...
+      if (!conn._M_data) {
+        if ((conn._M_data = static_cast<uint8_t*>(
+                              malloc(initial_buffer_size)
+                            )) == nullptr) {
+          return false;
+        }
+
+        conn._M_size = initial_buffer_size;
+      }
+
+      // Receive.
+      ret = conn.recv(conn._M_data + conn._M_length,
+                      conn._M_size - conn._M_length);
+
+      if (ret > 0) {
+        conn._M_length += ret;
+      }
+    }
+
+    // If data has been received...
+    if (ret > 0) {
+      if (!consume(conn)) {
+        return false;
+      }
+    } else if (ret == 0) {
+      // The peer has closed the connection.
+      return false;
+    } else {
+      return (errno == EAGAIN);
+    }
+  } while (true);
+}
+
+bool net::receiver::consume(connection& conn)
+{
+  bool ack = false;
+
+  // Credit to be granted.
+  size_t bytes = 0;
+  size_t records = 0;
+
+  size_t offset = 0;
+  bool more = true;
+  do {
+    // If an envelope is being received...
+    if (conn._M_receiving) {
+      // Copy the data in the receive buffer to the records.
+      while (conn._M_record < conn._M_count) {
+        if (!begin_record(conn)) {
+          return false;
+        }
+
+        size_t len = conn._M_lengths[conn._M_record] - conn._M_offset;
+        if (len > conn._M_length - offset) {
+          len = conn._M_length - offset;
+        }
+
+        if (len > 0) {
+          const uint8_t* data = conn._M_data + offset;
+
+          memcpy(static_cast<uint8_t*>(conn._M_last->data()) + conn._M_offset,
+                 data,
+                 len);
+
+          conn._M_crc = crc32c(conn._M_crc, data, len);
+
+          conn._M_offset += len;
+          offset += len;
+        }
+
+        // If the record is not complete...
+        if (conn._M_offset < conn._M_lengths[conn._M_record]) {
+          break;
+        }
+
+        conn._M_record++;
+        conn._M_offset = 0;
+      }
+
+      // If the envelope is not complete...
+      if (conn._M_record < conn._M_count) {
+        more = false;
+        continue;
+      }
+
+      conn._M_receiving = false;
+
+      // Verify CRC.
+      if (conn._M_crc != conn._M_envelope_crc) {
+        return false;
+      }
+
+      // If the envelope has not been received before...
+      if (conn._M_envelope_sequence > conn._M_sequence) {
+        // If the envelope has records...
+        if (conn._M_first) {
+          buffer* first = conn._M_first;
+          buffer* last = conn._M_last;
+
+          conn._M_first = nullptr;
+          conn._M_last = nullptr;
+          conn._M_nbuffers = 0;
+
+          if (!_M_fnbuffers(first, last, _M_user)) {
+            conn._M_first = first;
+            conn._M_last = last;
+
+            return false;
+          }
+        }
+
+        conn._M_sequence = conn._M_envelope_sequence;
+      } else {
+        release(conn);
+      }
+
+      // Grant again the credit consumed by the envelope.
+      bytes += conn._M_bytes;
+      records += conn._M_count;
+
+      ack = conn._M_hello;
+    } else {
+      switch (_M_decoder.decode_header(conn._M_data + offset,
+                                       conn._M_length - offset)) {
+        case envelope::decoder::result::ok:
+          switch (_M_decoder.envelope_type()) {
+            case envelope::type::data:
+              {
+                // If the envelope is too big...
+                if (_M_decoder.size() > max_envelope_size) {
+                  return false;
+                }
+
+                const uint8_t* hdr = conn._M_data + offset;
+
+                conn._M_envelope_sequence = _M_decoder.sequence();
+                conn._M_envelope_crc =
+                  envelope::read32(hdr + envelope::header_size - 4);
+
+                conn._M_count = _M_decoder.count();
+                conn._M_bytes = _M_decoder.size() -
+                                envelope::header_size -
+                                (conn._M_count * 4);
+
+                for (size_t i = 0; i < conn._M_count; i++) {
+                  conn._M_lengths[i] =
+                    envelope::read32(hdr + envelope::header_size + (i * 4));
+                }
+
+                conn._M_crc = crc32c(crc32c(0,
+                                            hdr,
+                                            envelope::header_size - 4),
+                                     hdr + envelope::header_size,
+                                     conn._M_count * 4);
+
+                conn._M_record = 0;
+                conn._M_offset = 0;
+
+                conn._M_receiving = true;
+              }
+
+              break;
+            case envelope::type::hello:
+              conn._M_hello = true;
+              conn._M_session = _M_decoder.sequence();
+              conn._M_sequence = find_session(conn._M_session);
+
+              conn._M_flow_control =
+                ((_M_decoder.flags() & envelope::flow_control) != 0);
+
+              // Grant initial credit.
+              bytes = _M_credit_bytes;
+              records = _M_credit_records;
+
+              ack = true;
+              break;
+            default:
+              // Only data envelopes are expected to carry records.
+              if (_M_decoder.count() > 0) {
+                return false;
+              }
+
+              break;
+          }
+
+          offset += envelope::header_size + (_M_decoder.count() * 4);
+          break;
+        case envelope::decoder::result::incomplete:
+          more = false;
+          break;
+        case envelope::decoder::result::error:
+        default:
+          return false;
+      }
+    }
+  } while (more);
+
+  // Move the remaining data to the beginning of the buffer.
+  if (offset > 0) {
+    memmove(conn._M_data, conn._M_data + offset, conn._M_length - offset);
+    conn._M_length -= offset;
+  }
+
+  // Send acknowledgement (if needed).
+  return ((!ack) || (acknowledge(conn, bytes, records)));
+}
+
+bool net::receiver::begin_record(connection& conn)
+{
+  // If the buffer for the record has already been obtained...
+  if (conn._M_nbuffers > conn._M_record) {
+    return true;
+  }
+
+  // Get buffer.
+  buffer* buf = _M_allocator->get();
+  if (buf) {
+    if (buf->resize(conn._M_lengths[conn._M_record])) {
+      if (conn._M_first) {
+        conn._M_last->next(buf);
+        buf->prev(conn._M_last);
+      } else {
+        conn._M_first = buf;
+        buf->prev(nullptr);
+      }
+
+      buf->next(nullptr);
+      conn._M_last = buf;
+
+      conn._M_nbuffers++;
+
+      return true;
+    }
+
+    _M_allocator->put(buf);
+  }
+
+  return false;
+}
+
+void net::receiver::release(connection& conn)
+{
+  buffer* buf = conn._M_first;
+  while (buf) {
+    buffer* next = (buf != conn._M_last) ? buf->next() : nullptr;
+
+    _M_allocator->put(buf);
+
+    buf = next;
+  }
+
+  conn._M_first = nullptr;
+  conn._M_last = nullptr;
+  conn._M_nbuffers = 0;
+}
+
+bool net::receiver::acknowledge(connection& conn,
+                                size_t bytes,
+                                size_t records)
+{
+  uint8_t buf[(2 * envelope::header_size) + 4 + envelope::credit_size];
+
+  // Encode acknowledgement.
+  _M_encoder.encode(envelope::type::ack, conn._M_sequence);
+  memcpy(buf, _M_encoder.data(), _M_encoder.length());
+
+  size_t len = _M_encoder.length();
+
+  // If the sender has requested flow control and there is credit to be
+  // granted...
+  if ((conn._M_flow_control) && ((bytes > 0) || (records > 0))) {
+    uint8_t credit[envelope::credit_size];
+    envelope::write64(credit, bytes);
+    envelope::write32(credit + 8,
+                      (records <= 0xffffffffu) ?
+                        static_cast<uint32_t>(records) :
+                        0xffffffffu);
+
+    // Encode credit.
+    _M_encoder.encode(envelope::type::credit, 0, 0, credit, sizeof(credit));
+
+    memcpy(buf + len, _M_encoder.data(), _M_encoder.length());
+    len += _M_encoder.length();
+
+    memcpy(buf + len, credit, sizeof(credit));
+    len += sizeof(credit);
+  }
+
+  return conn.send(buf, len, socket_timeout);
+}
+
+void net::receiver::close(size_t idx)
+{
+  connection* conn = _M_connections[idx];
+
+  // Remember the last envelope received in the session.
+  if (conn->_M_hello) {
+    save_session(conn->_M_session, conn->_M_sequence);
+  }
+
+  // Return the buffers of the envelope being received (if any).
+  release(*conn);
+
+  delete conn;
+
+  // Move last connection to this position.
+  _M_nconnections--;
+
+  if (idx < _M_nconnections) {
+    _M_connections[idx] = _M_connections[_M_nconnections];
+    _M_fds[1 + idx] = _M_fds[1 + _M_nconnections];
+  }
+}
+
+uint64_t net::receiver::find_session(uint64_t id) const
+{
+  uint64_t sequence = 0;
+
+  // Search session.
+  for (size_t i = 0; i < _M_nsessions; i++) {
+    if (_M_sessions[i].id == id) {
+      sequence = _M_sessions[i].sequence;
+      break;
+    }
+  }
+
+  // The sender might have reconnected before the previous connection has
+  // been closed.
+  for (size_t i = 0; i < _M_nconnections; i++) {
+    const connection* conn = _M_connections[i];
+    if ((conn->_M_hello) &&
+        (conn->_M_session == id) &&
+        (conn->_M_sequence > sequence)) {
+      sequence = conn->_M_sequence;
+    }
+  }
+
+  return sequence;
+}
+
+void net::receiver::save_session(uint64_t id, uint64_t sequence)
+{
+  // Search session.
+  for (size_t i = 0; i < _M_nsessions; i++) {
+    if (_M_sessions[i].id == id) {
+      if (sequence > _M_sessions[i].sequence) {
+        _M_sessions[i].sequence = sequence;
+      }
+
+      return;
+    }
+  }
+
+  // If there is room for a new session...
+  if (_M_nsessions < max_sessions) {
+    _M_sessions[_M_nsessions].id = id;
+    _M_sessions[_M_nsessions].sequence = sequence;
+
+    _M_nsessions++;
+  } else {
+    // Replace oldest session.
+    _M_sessions[_M_next_session].id = id;
+    _M_sessions[_M_next_session].sequence = sequence;
+
+    _M_next_session = (_M_next_session + 1) % max_sessions;
+  }
+}
+
+bool net::receiver::connection::begin_handshake()
+{
+  // Create TLS socket (takes ownership of the socket).
+  _M_sslsock = new (std::nothrow) ssl::socket(_M_sock);
+
+  return ((_M_sslsock) &&
+          (_M_sslsock->begin_handshake(ssl::socket::mode::server)));
+}
@@ -0,0 +1,420 @@
+#ifndef NET_RECEIVER_H
+#define NET_RECEIVER_H
+
+#include <stdint.h>
+#include <time.h>
+#include <poll.h>
+#include <pthread.h>
+#include "net/buffer.h"
+#include "net/envelope.h"
+#include "net/socket.h"
+#include "net/ssl/socket.h"
+
+namespace net {
+  // Receiver.
+  //
+  // Accepts connections from senders using envelope framing, passes the
+  // received envelopes to a callback and acknowledges them. Envelopes
+  // resent by a sender after reconnecting are acknowledged but not passed to
+  // the callback again.
+  //
+  // Senders which request flow control are granted an initial credit and,
+  // after their envelopes have been passed to the callback, the credit they
+  // consumed is granted again: a slow callback slows the senders down
+  // without making them block.
+  //
+  // Alternatively, the records can be received directly into buffers from
+  // an allocator and handed to a callback which takes ownership of them
+  // (e.g. to pass them to a sender without copying them).
+  class receiver {
+    public:
+      // Envelope callback. The decoder is positioned at the first record and
+      // the records are only valid during the call. If the callback returns
+      // false, the connection is closed without acknowledging the envelope.
+      typedef bool (*fnenvelope)(envelope::decoder& decoder, void* user);
+
+      // Buffers callback. The records of the envelope are in the buffers
+      // [first, last]; if the callback returns true, it takes ownership of
+      // them, otherwise they are returned to the allocator and the connection
+      // is closed without acknowledging the envelope.
+      typedef bool (*fnbuffers)(buffer* first, buffer* last, void* user);
+
+      // Constructor.
+      receiver() = default;
+
+      // Destructor.
+      ~receiver();
+
+      // Start.
+      enum class encryption {
+        yes,
+        no
+      };
+
+      bool start(const char* address,
+                 encryption enc,
+                 fnenvelope fn,
+                 void* user);
+
+      bool start(const char* address,
+                 in_port_t port,
+                 encryption enc,
+                 fnenvelope fn,
+                 void* user);
+
+      bool start(const char* address,
+                 encryption enc,
+                 buffer::allocator& allocator,
+                 fnbuffers fn,
+                 void* user);
+
+      bool start(const char* address,
+                 in_port_t port,
+                 encryption enc,
+                 buffer::allocator& allocator,
+                 fnbuffers fn,
+                 void* user);
+
+      // Stop.
+      void stop();
+
+      // Set credit granted to each sender which requests flow control (must
+      // be called before start()).
+      void set_credit(size_t bytes, size_t records);
+
+    private:
+      // Default credit.
+      static constexpr const size_t default_credit_bytes = 16 * 1024 * 1024;
+      static constexpr const size_t default_credit_records = 16 * 1024;
+
+      // Maximum number of connections.
+      static constexpr const size_t max_connections = 256;
+
+      // Maximum number of sessions remembered.
+      static constexpr const size_t max_sessions = 1024;
+
+      // Maximum envelope size.
+      static constexpr const size_t max_envelope_size = 256 * 1024 * 1024;
+
+      // Initial size of the receive buffer.
+      static constexpr const size_t initial_buffer_size = 64 * 1024;
+
+      // Records which are not in the receive buffer and have at least this
+      // number of bytes left are received directly into their buffer.
+      static constexpr const size_t direct_receive_size = 16 * 1024;
+
+      // Poll timeout in milliseconds.
+      static constexpr const int poll_timeout = 250;
+
+      // Socket timeout in milliseconds.
+      static constexpr const int socket_timeout = socket::default_timeout;
+
+      // Time in seconds a new connection has to complete the TLS handshake.
+      static constexpr const time_t handshake_timeout = socket_timeout / 1000;
+
+      // Connection.
+      class connection {
+        public:
+          // Constructor.
+          connection(net::socket& sock);
+
+          // Destructor.
+          ~connection();
+
+          // Prepare TLS handshake.
+          bool begin_handshake();
+
+          // Perform TLS handshake without blocking (see
+          // ssl::socket::handshake()).
+          bool handshake(bool& done, short& events);
+
+          // Receive.
+          ssize_t recv(void* buf, size_t len);
+
+          // Send.
+          bool send(const void* buf, size_t len, int timeout);
+
+          // Get socket descriptor.
+          int fd() const;
+
+          // Is the TLS handshake being performed? Until when?
+          bool _M_handshaking = false;
+          time_t _M_handshake_deadline;
+
+          // Receive buffer.
+          uint8_t* _M_data = nullptr;
+          size_t _M_size = 0;
+          size_t _M_length = 0;
+
+          // Has the sender sent hello?
+          bool _M_hello = false;
+
+          // Session identifier.
+          uint64_t _M_session = 0;
+
+          // Sequence number of the last envelope received.
+          uint64_t _M_sequence = 0;
+
+          // Has the sender requested flow control?
+          bool _M_flow_control = false;
+
+          // Envelope being received into buffers.
+          bool _M_receiving = false;
+          uint64_t _M_envelope_sequence;
+          uint32_t _M_envelope_crc;
+          uint32_t _M_crc;
+          size_t _M_count;
+          size_t _M_bytes;
+          uint32_t _M_lengths[envelope::max_records];
+
+          // Record being received and number of bytes received.
+          size_t _M_record;
+          size_t _M_offset;
+
+          // Buffers of the records received so far.
+          buffer* _M_first = nullptr;
+          buffer* _M_last = nullptr;
+          size_t _M_nbuffers = 0;
+
+        private:
+          net::socket _M_sock;
+          ssl::socket* _M_sslsock = nullptr;
+
+          // Disable copy constructor and assignment operator.
+          connection(const connection&) = delete;
+          connection& operator=(const connection&) = delete;
+      };
+
+      // Session.
+      struct session {
+        // Session identifier.
+        uint64_t id;
+
+        // Sequence number of the last envelope received.
+        uint64_t sequence;
+      };
+
+      // Socket address.
+      socket::address _M_sockaddr;
+
+      // Listener socket.
+      socket _M_listener;
+
+      // Encryption.
+      encryption _M_encryption;
+
+      // Credit.
+      size_t _M_credit_bytes = default_credit_bytes;
+      size_t _M_credit_records = default_credit_records;
+
+      // Envelope callback.
+      fnenvelope _M_fn;
+      void* _M_user;
+
+      // Buffer allocator and buffers callback.
+      buffer::allocator* _M_allocator = nullptr;
+      fnbuffers _M_fnbuffers;
+
+      // Process data received on a connection.
+      typedef bool (receiver::*fnprocess)(connection&);
+      fnprocess _M_process;
+
+      // Connections.
+      connection* _M_connections[max_connections];
+      size_t _M_nconnections = 0;
+
+      // Poll descriptors (the first one is the listener).
+      struct pollfd _M_fds[1 + max_connections];
+
+      // Sessions.
+      session _M_sessions[max_sessions];
+      size_t _M_nsessions = 0;
+      size_t _M_next_session = 0;
+
+      // Envelope decoder.
+      envelope::decoder _M_decoder;
+
+      // Envelope encoder (acknowledgements).
+      envelope::encoder _M_encoder;
+
+      // Thread id.
+      pthread_t _M_thread;
+
+      // Running?
+      bool _M_running = false;
+
+      // Start.
+      bool start(encryption enc, fnenvelope fn, void* user);
+      bool start(encryption enc,
+                 buffer::allocator& allocator,
+                 fnbuffers fn,
+                 void* user);
+
+      bool start(encryption enc, void* user);
+
+      // Run.
+      void run();
+
+      // Accept new connections.
+      void accept();
+
+      // Continue the TLS handshake of a connection (returns false on error).
+      bool handshake(size_t idx);
+
+      // Close the connections which haven't completed the TLS handshake in
+      // time.
+      void expire_handshakes();
+
+      // Process data received on a connection (envelopes).
+      bool process_envelopes(connection& conn);
+
+      // Process data received on a connection (buffers).
+      bool process_buffers(connection& conn);
+
+      // Process the data in the receive buffer (buffers).
+      bool consume(connection& conn);
+
+      // Get buffer for the record being received.
+      bool begin_record(connection& conn);
+
+      // Return the buffers of the envelope being received to the allocator.
+      void release(connection& conn);
+
+      // Send acknowledgement and grant credit (if the sender has requested
+      // flow control).
+      bool acknowledge(connection& conn, size_t bytes, size_t records);
+
+      // Close connection.
+      void close(size_t idx);
+
+      // Get sequence number of the last envelope received in a session.
+      uint64_t find_session(uint64_t id) const;
+
+      // Save session.
+      void save_session(uint64_t id, uint64_t sequence);
+
+      // Start routine.
+      static void* start_routine(void* arg);
+
+      // Disable copy constructor and assignment operator.
+      receiver(const receiver&) = delete;
+      receiver& operator=(const receiver&) = delete;
+  };
+
+  inline receiver::~receiver()
+  {
+    stop();
+  }
+
+  inline bool receiver::start(const char* address,
+                              encryption enc,
+                              fnenvelope fn,
+                              void* user)
+  {
+    return _M_sockaddr.build(address) ? start(enc, fn, user) : false;
+  }
+
+  inline bool receiver::start(const char* address,
+                              in_port_t port,
+                              encryption enc,
+                              fnenvelope fn,
+                              void* user)
+  {
+    return _M_sockaddr.build(address, port) ? start(enc, fn, user) : false;
+  }
+
+  inline bool receiver::start(const char* address,
+                              encryption enc,
+                              buffer::allocator& allocator,
+                              fnbuffers fn,
+                              void* user)
+  {
+    return _M_sockaddr.build(address) ? start(enc, allocator, fn, user) :
+                                        false;
+  }
+
+  inline bool receiver::start(const char* address,
+                              in_port_t port,
+                              encryption enc,
+                              buffer::allocator& allocator,
+                              fnbuffers fn,
+                              void* user)
+  {
+    return _M_sockaddr.build(address, port) ?
+             start(enc, allocator, fn, user) :
+             false;
+  }
+
+  inline bool receiver::start(encryption enc, fnenvelope fn, void* user)
+  {
+    _M_fn = fn;
+    _M_process = &receiver::process_envelopes;
+
+    return start(enc, user);
+  }
+
+  inline bool receiver::start(encryption enc,
+                              buffer::allocator& allocator,
+                              fnbuffers fn,
+                              void* user)
+  {
+    _M_allocator = &allocator;
+    _M_fnbuffers = fn;
+    _M_process = &receiver::process_buffers;
+
+    return start(enc, user);
+  }
+
+  inline void receiver::set_credit(size_t bytes, size_t records)
+  {
+    _M_credit_bytes = bytes;
+    _M_credit_records = records;
+  }
+
+  inline void* receiver::start_routine(void* arg)
+  {
+    static_cast<receiver*>(arg)->run();
+    return nullptr;
+  }
+
+  inline receiver::connection::connection(net::socket& sock)
+    : _M_sock(sock)
+  {
+  }
+
+  inline receiver::connection::~connection()
+  {
+    if (_M_sslsock) {
+      delete _M_sslsock;
+    }
+
+    if (_M_data) {
+      free(_M_data);
+    }
+  }
+
+  inline ssize_t receiver::connection::recv(void* buf, size_t len)
+  {
+    return _M_sslsock ? _M_sslsock->recv(buf, len) : _M_sock.recv(buf, len);
+  }
+
+  inline bool receiver::connection::send(const void* buf,
+                                         size_t len,
+                                         int timeout)
+  {
+    return _M_sslsock ? _M_sslsock->send(buf, len, timeout) :
+                        _M_sock.send(buf, len, timeout);
+  }
+
+  inline int receiver::connection::fd() const
+  {
+    return _M_sslsock ? _M_sslsock->fd() : _M_sock.fd();
+  }
+
+  inline bool receiver::connection::handshake(bool& done, short& events)
+  {
+    return _M_sslsock->handshake(done, events);
+  }
+}
+
+#endif // NET_RECEIVER_H
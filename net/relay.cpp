@@ -0,0 +1,27 @@
+#include "net/relay.h"
+
+bool net::relay::start(const char* address,
+                       receiver::encryption inenc,
+                       const char* next_hop,
+                       sender::encryption outenc,
+                       const char* directory)
+{
+  // Start sender.
+  if (_M_sender.start(next_hop, outenc, directory)) {
+    // Start receiver.
+    if (_M_receiver.start(address, inenc, _M_allocator, forward, this)) {
+      return true;
+    }
+
+    _M_sender.stop();
+  }
+
+  return false;
+}
+
+void net::relay::stop()
+{
+  // Stop receiving before stopping the sender.
+  _M_receiver.stop();
+  _M_sender.stop();
+}
@@ -0,0 +1,93 @@
+#ifndef NET_RELAY_H
+#define NET_RELAY_H
+
+#include "net/buffer.h"
+#include "net/receiver.h"
+#include "net/sender.h"
+
+namespace net {
+  // Relay.
+  //
+  // Accepts connections from senders using envelope framing and forwards the
+  // records to the next hop. The records are received directly into buffers
+  // which are handed to the sender without copying them; if the next hop is
+  // not available, the sender writes them to disk and replays them later.
+  //
+  // The envelopes are acknowledged as soon as their records have been
+  // queued in the sender. If the sender rejects them (overflow policies
+  // 'block' and 'reject'), the connection is closed without acknowledging
+  // the envelope and the upstream sender resends it. Only the 'spill'
+  // overflow policy is lossless: with 'drop_oldest' and 'drop_newest', the
+  // sender discards records which have already been acknowledged.
+  class relay {
+    public:
+      // Constructor.
+      relay(buffer::allocator& allocator);
+
+      // Destructor.
+      ~relay();
+
+      // Start.
+      bool start(const char* address,
+                 receiver::encryption inenc,
+                 const char* next_hop,
+                 sender::encryption outenc,
+                 const char* directory);
+
+      // Stop.
+      void stop();
+
+      // Get receiver (to configure it before start()).
+      receiver& input();
+
+      // Get sender (to configure it before start(); envelope framing is
+      // used by default).
+      sender& output();
+
+    private:
+      // Buffer allocator.
+      buffer::allocator& _M_allocator;
+
+      // Receiver.
+      receiver _M_receiver;
+
+      // Sender.
+      sender _M_sender;
+
+      // Forward buffers.
+      static bool forward(buffer* first, buffer* last, void* user);
+
+      // Disable copy constructor and assignment operator.
+      relay(const relay&) = delete;
+      relay& operator=(const relay&) = delete;
+  };
+
+  inline relay::relay(buffer::allocator& allocator)
+    : _M_allocator(allocator),
+      _M_sender(allocator)
+  {
+    _M_sender.set_framing(sender::framing::envelope);
+  }
+
+  inline relay::~relay()
+  {
+    stop();
+  }
+
+  inline receiver& relay::input()
+  {
+    return _M_receiver;
+  }
+
+  inline sender& relay::output()
+  {
+    return _M_sender;
+  }
+
+  inline bool relay::forward(buffer* first, buffer* last, void* user)
+  {
+    return static_cast<relay*>(user)->_M_sender.try_send(first, last);
+  }
+}
+
+#endif // NET_RELAY_H
@@ -1,16 +1,33 @@
 #include <stdio.h>
 #include <fcntl.h>
 #include <dirent.h>
+#include <errno.h>
 #include <sys/stat.h>
 #include <sys/mman.h>
+#include <sys/random.h>
+#include <new>
 #include "net/sender.h"
+#include "net/probes.h"
+
+constexpr const char net::sender::rejected_suffix[];
 
 bool net::sender::start(encryption enc, const char* directory)
 {
   const size_t dirlen = strlen(directory);
 
-  // If the directory name is not too long...
-  if (dirlen < sizeof(_M_directory)) {
+  // Acknowledgements require envelope framing, flow control requires
+  // acknowledgements and transmit timestamps require latency histograms
+  // and no encryption (the kernel timestamps the encrypted bytes).
+  if (((_M_window > 0) && (_M_framing != framing::envelope)) ||
+      ((_M_flow_control) && (_M_window == 0)) ||
+      ((_M_tx_timestamps) &&
+       ((!_M_record_latency) || (enc == encryption::yes)))) {
+    return false;
+  }
+
+  // If the queues have been allocated and the directory name is not too
+  // long...
+  if ((_M_queues) && (dirlen < sizeof(_M_directory))) {
     // If the directory exists...
     struct stat sbuf;
     if ((stat(directory, &sbuf) == 0) && (S_ISDIR(sbuf.st_mode))) {
@@ -23,18 +40,141 @@ bool net::sender::start(encryption enc, const char* directory)
         _M_connect = &sender::connect_insecure;
         _M_disconnect = &sender::disconnect_insecure;
         _M_send = &sender::send_insecure;
+        _M_sendv = &sender::sendv_insecure;
+        _M_recv = &sender::recv_insecure;
+        _M_wait_readable = &sender::wait_readable_insecure;
         _M_connected = &sender::connected_insecure;
-
-        _M_connection_closed_by_peer =
-          &sender::connection_closed_by_peer_insecure;
+        _M_tcp_info = &sender::tcp_info_insecure;
+        _M_cork = &sender::cork_insecure;
+        _M_pace = &sender::pace_insecure;
+
+        // If the writes have to be timestamped...
+        if (_M_tx_timestamps) {
+          _M_connect = &sender::connect_timestamped;
+          _M_send = &sender::send_timestamped;
+          _M_sendv = &sender::sendv_timestamped;
+          _M_wait_readable = &sender::wait_readable_timestamped;
+        }
       } else {
         _M_connect = &sender::connect_secure;
         _M_disconnect = &sender::disconnect_secure;
         _M_send = &sender::send_secure;
+        _M_sendv = &sender::sendv_secure;
+        _M_recv = &sender::recv_secure;
+        _M_wait_readable = &sender::wait_readable_secure;
         _M_connected = &sender::connected_secure;
+        _M_tcp_info = &sender::tcp_info_secure;
+        _M_cork = &sender::cork_secure;
+        _M_pace = &sender::pace_secure;
+      }
+
+      // If the envelopes have to be acknowledged...
+      if (_M_window > 0) {
+        // Allocate in-flight envelopes.
+        if (!_M_inflight) {
+          _M_inflight = new (std::nothrow) inflight[_M_window];
+          if (!_M_inflight) {
+            return false;
+          }
+        }
+
+        // Generate session identifier.
+        if (getrandom(&_M_session,
+                      sizeof(_M_session),
+                      0) != sizeof(_M_session)) {
+          _M_session = (static_cast<uint64_t>(time(nullptr)) << 32) ^
+                       static_cast<uint64_t>(getpid());
+        }
+      }
+
+      // If the latency has to be recorded...
+      if ((_M_record_latency) && (!_M_latency)) {
+        // Allocate latency histograms.
+        _M_latency = new (std::nothrow) latency_histograms();
+        if (!_M_latency) {
+          return false;
+        }
+      }
+
+      // If the writes have to be timestamped...
+      if ((_M_tx_timestamps) && (!_M_tx_pending)) {
+        // Allocate buffers waiting for transmit timestamps.
+        _M_tx_pending = new (std::nothrow) tx_pending[max_tx_pending];
+        if (!_M_tx_pending) {
+          return false;
+        }
+      }
+
+      // If the files on disk are accounted to the tenants (by the sender
+      // which spills them)...
+      if ((!_M_replay_only) &&
+          ((_M_ntenants > 1) || (_M_tenants[0].max_spill_bytes > 0))) {
+        // Account the files left on disk by a previous run.
+        account_files();
+      }
+
+      // If the sender doesn't share the token buckets of another sender...
+      if (!_M_replay_only) {
+        // Fill the token buckets (the burst is at least a token).
+        _M_byte_bucket.set(_M_max_rate_bytes,
+                           ((_M_max_rate_bytes * rate_burst) / 1000) + 1);
+
+        _M_message_bucket.set(_M_max_rate_messages,
+                              ((_M_max_rate_messages * rate_burst) / 1000) +
+                              1);
+
+        // Split the byte rate evenly among the connections (this one and the
+        // replay connections, if any) for kernel pacing.
+        const uint64_t connections = (_M_replay_share > 0) ?
+                                       1 + _M_replay_count :
+                                       1;
+
+        _M_pacing_rate = (_M_max_rate_bytes + connections - 1) / connections;
+      }
+
+      // If the buffers on disk have to be sent on other connections...
+      if ((_M_replay_share > 0) && (!_M_replay_only)) {
+        // Allocate the senders of the replay connections.
+        for (; _M_nreplay < _M_replay_count; _M_nreplay++) {
+          _M_replay[_M_nreplay] = new (std::nothrow) sender(_M_allocator);
+          if (!_M_replay[_M_nreplay]) {
+            return false;
+          }
+        }
+
+        for (unsigned i = 0; i < _M_nreplay; i++) {
+          sender* replay = _M_replay[i];
+
+          replay->_M_sockaddr = _M_sockaddr;
+          replay->_M_framing = _M_framing;
+          replay->_M_window = _M_window;
+          replay->_M_flow_control = _M_flow_control;
+          replay->_M_max_retransmits = _M_max_retransmits;
+          replay->_M_replay_share = _M_replay_share;
+          replay->_M_replay_rate = (_M_replay_rate + _M_nreplay - 1) /
+                                   _M_nreplay;
+          replay->_M_max_rate_bytes = _M_max_rate_bytes;
+          replay->_M_max_rate_messages = _M_max_rate_messages;
+          replay->_M_kernel_pacing = _M_kernel_pacing;
+          replay->_M_limiter = this;
+          replay->_M_pacing_rate = _M_pacing_rate;
+          replay->_M_replay_only = true;
+          replay->_M_spiller = this;
+          replay->_M_replay_index = i;
+          replay->_M_replay_count = _M_nreplay;
+
+          // Start the sender of the replay connection.
+          if (!replay->start(enc, directory)) {
+            for (; i > 0; i--) {
+              _M_replay[i - 1]->stop();
+            }
+
+            return false;
+          }
+        }
 
-        _M_connection_closed_by_peer =
-          &sender::connection_closed_by_peer_secure;
+        // The files are sent by the replay connections.
+        _M_state = state::sending_queued_buffers;
       }
 
       _M_running = true;
@@ -45,6 +185,10 @@ bool net::sender::start(encryption enc, const char* directory)
       }
 
       _M_running = false;
+
+      for (unsigned i = 0; i < _M_nreplay; i++) {
+        _M_replay[i]->stop();
+      }
     }
   }
 
@@ -57,34 +201,478 @@ void net::sender::stop()
   if (_M_running) {
     _M_running = false;
     pthread_join(_M_thread, nullptr);
+
+    // Stop the senders of the replay connections (if any).
+    for (unsigned i = 0; i < _M_nreplay; i++) {
+      _M_replay[i]->stop();
+    }
+  }
+}
+
+bool net::sender::set_lanes(unsigned n, const unsigned* weights)
+{
+  if ((n > 0) && (n <= max_lanes)) {
+    for (unsigned i = 0; i < n; i++) {
+      if ((weights) && (weights[i] == 0)) {
+        return false;
+      }
+    }
+
+    for (unsigned i = 0; i < n; i++) {
+      _M_weights[i] = weights ? weights[i] : 1;
+    }
+
+    // Allocate queues.
+    if (!allocate_queues(n, _M_ntenants)) {
+      return false;
+    }
+
+    _M_weighted = (weights != nullptr);
+
+    return true;
   }
+
+  return false;
 }
 
-void net::sender::send(buffer* buf)
+bool net::sender::set_tenants(unsigned n, size_t quantum)
 {
-  if (_M_buffers.push_back(buf) > max_queued_buffers) {
-    // Save buffers to disk.
-    save_buffers();
+  if ((n > 0) && (n <= max_tenants) && (quantum > 0)) {
+    // Allocate queues.
+    if (!allocate_queues(_M_nlanes, n)) {
+      return false;
+    }
 
-    _M_state = state::sending_files;
+    _M_quantum = quantum;
+
+    return true;
   }
+
+  return false;
 }
 
-void net::sender::send(buffer* first, buffer* last)
+bool net::sender::allocate_queues(unsigned nlanes, unsigned ntenants)
 {
-  if (_M_buffers.push_back(first, last) > max_queued_buffers) {
-    // Save buffers to disk.
-    save_buffers();
+  buffers* queues = new (std::nothrow) buffers[nlanes * ntenants];
+  if (queues) {
+    if (_M_queues) {
+      delete [] _M_queues;
+    }
+
+    _M_queues = queues;
+    _M_nlanes = nlanes;
+    _M_ntenants = ntenants;
 
-    _M_state = state::sending_files;
+    return true;
   }
+
+  return false;
 }
 
-void net::sender::run()
+void net::sender::send(buffer* buf, unsigned priority, unsigned tenant)
+{
+  if (!try_send(buf, priority, tenant)) {
+    // Return buffer to the allocator.
+    _M_allocator.put(buf);
+  }
+}
+
+void net::sender::send(buffer* first,
+                        buffer* last,
+                        unsigned priority,
+                        unsigned tenant)
+{
+  if (!try_send(first, last, priority, tenant)) {
+    // Return buffers to the allocator.
+    discard(first, last);
+  }
+}
+
+bool net::sender::try_send(buffer* buf, unsigned priority, unsigned tenant)
+{
+  // Timestamp buffer (if the latency has to be recorded).
+  buf->timestamp(_M_latency ? monotonic_time() : 0);
+
+  return enqueue(buf,
+                 buf,
+                 1,
+                 buf->length(),
+                 (priority < _M_nlanes) ? priority : _M_nlanes - 1,
+                 (tenant < _M_ntenants) ? tenant : 0);
+}
+
+bool net::sender::try_send(buffer* first,
+                           buffer* last,
+                           unsigned priority,
+                           unsigned tenant)
+{
+  // Timestamp buffers (if the latency has to be recorded).
+  const uint64_t now = _M_latency ? monotonic_time() : 0;
+
+  size_t count = 0;
+  size_t bytes = 0;
+
+  buffer* buf = first;
+  do {
+    buf->timestamp(now);
+
+    count++;
+    bytes += buf->length();
+
+    if (buf == last) {
+      break;
+    }
+
+    buf = buf->next();
+  } while (true);
+
+  return enqueue(first,
+                 last,
+                 count,
+                 bytes,
+                 (priority < _M_nlanes) ? priority : _M_nlanes - 1,
+                 (tenant < _M_ntenants) ? tenant : 0);
+}
+
+bool net::sender::enqueue(buffer* first,
+                          buffer* last,
+                          size_t count,
+                          size_t bytes,
+                          unsigned lane,
+                          unsigned t)
+{
+  buffers& lanebufs = queue(lane, t);
+
+  // The lower of the limits of the lane and the quotas of the tenant
+  // apply.
+  const tenant& ten = _M_tenants[t];
+
+  const size_t max_buffers =
+    (ten.max_queued_buffers < _M_max_queued_buffers[lane]) ?
+      ten.max_queued_buffers :
+      _M_max_queued_buffers[lane];
+
+  const size_t max_bytes = (ten.max_queued_bytes < _M_max_queued_bytes[lane]) ?
+                             ten.max_queued_bytes :
+                             _M_max_queued_bytes[lane];
+
+  // Number of buffers in the queue after adding the new ones.
+  size_t queued;
+
+  switch (_M_overflow) {
+    case overflow::block:
+      // If there is no room for the buffers...
+      if ((queued = lanebufs.push_back(first,
+                                       last,
+                                       max_buffers,
+                                       max_bytes,
+                                       0)) == 0) {
+        _M_counters.add(producer_waits);
+
+        // Wait for room.
+        const uint64_t start = monotonic_time();
+
+        queued = lanebufs.push_back(first,
+                                    last,
+                                    max_buffers,
+                                    max_bytes,
+                                    _M_block_timeout);
+
+        _M_counters.add(producer_wait_time, monotonic_time() - start);
+
+        if (queued == 0) {
+          _M_counters.add(buffers_rejected, count);
+          return false;
+        }
+      }
+
+      break;
+    case overflow::reject:
+      if ((queued = lanebufs.push_back(first,
+                                       last,
+                                       max_buffers,
+                                       max_bytes,
+                                       0)) == 0) {
+        _M_counters.add(buffers_rejected, count);
+        return false;
+      }
+
+      break;
+    case overflow::drop_oldest:
+      queued = lanebufs.push_back(first, last);
+
+      // Discard the oldest buffers while the limits are exceeded (the
+      // newest buffer is always kept).
+      while ((lanebufs.count() > 1) &&
+             ((lanebufs.count() > max_buffers) ||
+              (lanebufs.bytes() > max_bytes))) {
+        buffer* buf = lanebufs.pop_front();
+        if (!buf) {
+          break;
+        }
+
+        _M_counters.add(buffers_evicted);
+
+        // Return buffer to the allocator.
+        _M_allocator.put(buf);
+      }
+
+      break;
+    case overflow::drop_newest:
+      if ((queued = lanebufs.push_back(first,
+                                       last,
+                                       max_buffers,
+                                       max_bytes,
+                                       0)) == 0) {
+        _M_counters.add(buffers_discarded, count);
+
+        // Return buffers to the allocator.
+        discard(first, last);
+
+        return true;
+      }
+
+      break;
+    case overflow::spill:
+    default:
+      if (((queued = lanebufs.push_back(first, last)) > max_buffers) ||
+          (lanebufs.bytes() > max_bytes)) {
+        // Save buffers of the queue to disk.
+        save_buffers(lane, t);
+
+        set_state(state::sending_files);
+      }
+
+      break;
+  }
+
+  _M_counters.add(buffers_enqueued, count);
+  _M_counters.add(bytes_enqueued, bytes);
+
+  // If the queue was empty, wake up the thread waiting for buffers (with a
+  // single queue, it waits on the queue).
+  if ((_M_nlanes * _M_ntenants > 1) && (queued == count)) {
+    sem_post(&_M_doorbell);
+  }
+
+  return true;
+}
+
+void net::sender::discard(buffer* first, buffer* last)
+{
+  do {
+    buffer* next = first->next();
+
+    _M_allocator.put(first);
+
+    if (first == last) {
+      return;
+    }
+
+    first = next;
+  } while (true);
+}
+
+size_t net::sender::pop(buffer*& first,
+                        buffer*& last,
+                        unsigned min_lane,
+                        unsigned timeout)
+{
+  if (min_lane >= _M_nlanes) {
+    return 0;
+  }
+
+  // If there is a single queue...
+  if (_M_nlanes * _M_ntenants == 1) {
+    _M_lane = 0;
+    _M_tenant = 0;
+
+    return (timeout > 0) ? _M_queues[0].pop(first,
+                                            last,
+                                            _M_max_batch_buffers,
+                                            _M_max_batch_bytes,
+                                            timeout) :
+                           _M_queues[0].pop(first,
+                                            last,
+                                            _M_max_batch_buffers,
+                                            _M_max_batch_bytes);
+  }
+
+  struct timespec ts;
+  bool deadline = false;
+
+  do {
+    // Select lane.
+    const unsigned lane = select_lane(min_lane);
+
+    // If there is a lane with buffers...
+    if (lane < _M_nlanes) {
+      // If there is a single tenant...
+      if (_M_ntenants == 1) {
+        const size_t count = _M_queues[lane].pop(first,
+                                                 last,
+                                                 _M_max_batch_buffers,
+                                                 _M_max_batch_bytes);
+
+        // The queue might have been emptied meanwhile (drop_oldest).
+        if (count > 0) {
+          _M_lane = lane;
+          _M_tenant = 0;
+
+          return count;
+        }
+      } else {
+        // Select tenant.
+        const unsigned t = select_tenant(lane);
+
+        if (t < _M_ntenants) {
+          int64_t& deficit = _M_tenants[t].deficit[lane];
+
+          // Take at most the deficit of the tenant.
+          const size_t max_bytes =
+            ((_M_max_batch_bytes == 0) ||
+             (static_cast<size_t>(deficit) < _M_max_batch_bytes)) ?
+              static_cast<size_t>(deficit) :
+              _M_max_batch_bytes;
+
+          const size_t count = queue(lane, t).pop(first,
+                                                  last,
+                                                  _M_max_batch_buffers,
+                                                  max_bytes);
+
+          // The queue might have been emptied meanwhile (drop_oldest).
+          if (count > 0) {
+            // Deduct the bytes of the batch from the deficit.
+            for (const buffer* buf = first; ; buf = buf->next()) {
+              deficit -= buf->length();
+
+              if (buf == last) {
+                break;
+              }
+            }
+
+            _M_lane = lane;
+            _M_tenant = t;
+
+            return count;
+          }
+        }
+      }
+    } else if (timeout > 0) {
+      if (!deadline) {
+        // Compute absolute time.
+        clock_gettime(CLOCK_REALTIME, &ts);
+
+        ts.tv_sec += (timeout / 1000);
+        ts.tv_nsec += ((timeout % 1000) * 1000000);
+
+        if (ts.tv_nsec >= 1000000000l) {
+          ts.tv_sec++;
+          ts.tv_nsec -= 1000000000l;
+        }
+
+        deadline = true;
+      }
+
+      // Wait for a lane to become non-empty.
+      if ((sem_timedwait(&_M_doorbell, &ts) != 0) && (errno == ETIMEDOUT)) {
+        first = nullptr;
+        last = nullptr;
+
+        return 0;
+      }
+    } else {
+      first = nullptr;
+      last = nullptr;
+
+      return 0;
+    }
+  } while (true);
+}
+
+unsigned net::sender::select_lane(unsigned min_lane)
+{
+  // If the lanes are drained by strict priority...
+  if (!_M_weighted) {
+    // Select the highest lane with buffers.
+    for (unsigned i = _M_nlanes; i > min_lane; i--) {
+      if (queued(i - 1) > 0) {
+        return i - 1;
+      }
+    }
+
+    return _M_nlanes;
+  }
+
+  // Weighted round-robin: the current lane is served while it has buffers
+  // and batches left, then the next lower one (the lowest is followed by
+  // the highest).
+  for (unsigned i = 0; i <= _M_nlanes; i++) {
+    if ((_M_rr_batches > 0) &&
+        (_M_rr_lane >= min_lane) &&
+        (queued(_M_rr_lane) > 0)) {
+      _M_rr_batches--;
+      return _M_rr_lane;
+    }
+
+    _M_rr_lane = (_M_rr_lane > 0) ? _M_rr_lane - 1 : _M_nlanes - 1;
+    _M_rr_batches = _M_weights[_M_rr_lane];
+  }
+
+  return _M_nlanes;
+}
+
+unsigned net::sender::select_tenant(unsigned lane)
+{
+  unsigned& t = _M_drr[lane];
+
+  for (unsigned i = 0; ; i++) {
+    // Check every round that the lane still has buffers.
+    if ((i % _M_ntenants == 0) && (queued(lane) == 0)) {
+      return _M_ntenants;
+    }
+
+    int64_t& deficit = _M_tenants[t].deficit[lane];
+
+    // If the tenant has buffers...
+    if (queue(lane, t).count() > 0) {
+      // If the tenant has deficit left...
+      if (deficit > 0) {
+        return t;
+      }
+    } else if (deficit > 0) {
+      // An idle tenant doesn't accumulate deficit.
+      deficit = 0;
+    }
+
+    // Next tenant's turn.
+    t = (t + 1 < _M_ntenants) ? t + 1 : 0;
+
+    if (queue(lane, t).count() > 0) {
+      _M_tenants[t].deficit[lane] += _M_quantum;
+    }
+  }
+}
+
+bool net::sender::send_priority_buffers()
 {
-  // Sleep interval in microseconds.
-  static constexpr const useconds_t sleep_interval = 250000;
+  buffer* first;
+  buffer* last;
+
+  // While there is credit and there are buffers in the lanes above the
+  // lowest one...
+  while ((has_credit()) && (pop(first, last, 1, 0) > 0)) {
+    // Send queued buffers.
+    if (!send_buffers(first, last)) {
+      return false;
+    }
+  }
+
+  return true;
+}
 
+void net::sender::run()
+{
   // Error sending?
   bool error_sending = false;
 
@@ -92,6 +680,29 @@ void net::sender::run()
     // Save current time.
     _M_current_time = time(nullptr);
 
+    // If the TCP connection has to be sampled...
+    if ((!error_sending) &&
+        (_M_current_time - _M_last_tcp_sample >= tcp_info_interval) &&
+        (connected())) {
+      _M_last_tcp_sample = _M_current_time;
+
+      // If the connection suffers persistent retransmissions...
+      if (!sample_tcp_connection()) {
+#if DEBUG
+        printf("[sender::run] Persistent retransmissions, disconnecting.\n");
+#endif
+
+        _M_counters.add(retransmission_failovers);
+        trace::record(trace::event::retransmission_failover);
+
+        // Disconnect.
+        disconnect();
+
+        error_sending = true;
+        continue;
+      }
+    }
+
     // If there was an error sending...
     if (error_sending) {
       // If we can try to connect now...
@@ -125,67 +736,80 @@ void net::sender::run()
 
     // If we are sending queued buffers...
     if (_M_state == state::sending_queued_buffers) {
-      // Get queued buffers.
-      buffer* first;
-      buffer* last;
-      if (_M_buffers.pop(first, last, sleep_interval / 1000) > 0) {
-#if DEBUG
-        printf("[sender::run] There are queued buffers to be sent.\n");
-#endif
+      // If we are connected but the receiver hasn't granted credit...
+      if ((!has_credit()) && (connected())) {
+        // Wait for credit.
+        if (!wait_credit(sleep_interval / 1000)) {
+          error_sending = true;
+          continue;
+        }
 
-        // Connect (if not already connected).
-        if (connect()) {
-          // For each queued buffer...
-          do {
-            // Send queued buffer.
-            if (send(first->data(), first->length())) {
+        // If there is still no credit...
+        if (!has_credit()) {
+          // If there has been no credit for a long time (and the buffers
+          // can be written to disk)...
+          if ((_M_overflow == overflow::spill) &&
+              (_M_current_time - _M_last_credit >= credit_timeout)) {
 #if DEBUG
-              printf("[sender::run] Queued buffer sent.\n");
+            printf("[sender::run] No credit, saving buffers to disk.\n");
 #endif
 
-              // If not the last buffer...
-              if (first != last) {
-                buffer* next = first->next();
+            // Save buffers to disk.
+            save_buffers();
 
-                // Return buffer to the allocator.
-                _M_allocator.put(first);
-
-                first = next;
-              } else {
-                // Last buffer.
+            set_state(state::sending_files);
+          }
 
-                // Return buffer to the allocator.
-                _M_allocator.put(first);
+          continue;
+        }
+      }
 
-                break;
-              }
-            } else {
+      // Get a batch of queued buffers.
+      buffer* first;
+      buffer* last;
+      if (pop(first, last, 0, sleep_interval / 1000) > 0) {
 #if DEBUG
-              printf("[sender::run] Error sending queued buffer.\n");
+        printf("[sender::run] There are queued buffers to be sent.\n");
 #endif
 
-              // Return buffers to the buffer pool.
-              _M_buffers.push_front(first, last);
-
-              error_sending = true;
-
-              break;
-            }
-          } while (true);
+        // Connect (if not already connected).
+        if (connect()) {
+          // Send queued buffers (waiting for more, if they have to linger).
+          error_sending = (_M_linger > 0) ? !send_lingering(first, last) :
+                                            !send_buffers(first, last);
         } else {
 #if DEBUG
           printf("[sender::run] Error connecting.\n");
 #endif
 
           // Return buffers to the buffer pool.
-          _M_buffers.push_front(first, last);
+          queue(_M_lane, _M_tenant).push_front(first, last);
 
           error_sending = true;
         }
       } else {
-        // If we are connected and have been idle for a long time...
-        if ((connected()) &&
-            (_M_current_time - _M_last_socket_operation >= idle_timeout)) {
+        // Receive the transmit timestamps of the last writes.
+        if ((_M_tx_enabled) && (connected())) {
+          receive_tx_timestamps();
+        }
+
+        // If there are unacknowledged envelopes...
+        if (_M_inflight_count > 0) {
+          // Receive acknowledgements. If the connection has been closed, the
+          // unacknowledged envelopes will be resent after reconnecting.
+          if ((!connected()) || (connection_closed_by_peer())) {
+#if DEBUG
+            printf("[sender::run] Connection closed.\n");
+#endif
+
+            // Disconnect.
+            disconnect();
+
+            error_sending = true;
+          }
+        } else if ((connected()) &&
+                   (_M_current_time - _M_last_socket_operation >=
+                    idle_timeout)) {
 #if DEBUG
           printf("[sender::run] Disconnecting.\n");
 #endif
@@ -198,6 +822,9 @@ void net::sender::run()
 #endif // DEBUG
         }
       }
+    } else if ((_M_replay_only) && (!has_files())) {
+      // The replay connection has no files to send.
+      error_sending = !replay_idle();
     } else {
       // There might be buffers on disk.
 
@@ -205,9 +832,19 @@ void net::sender::run()
       printf("[sender::run] There might be buffers on disk to be sent.\n");
 #endif
 
+      const uint64_t replayed = _M_counters.get(files_replayed);
+
       // Send buffers on disk.
       error_sending = !send_files();
 
+      // If the replay connection had no new files to send (they might be
+      // waiting for acknowledgements)...
+      if ((_M_replay_only) &&
+          (!error_sending) &&
+          (_M_counters.get(files_replayed) == replayed)) {
+        error_sending = !replay_idle();
+      }
+
 #if DEBUG
       printf("[sender::run] %s.\n",
              error_sending ?
@@ -217,41 +854,899 @@ void net::sender::run()
     }
   } while (_M_running);
 
+  // Save in-flight buffers to disk (if any).
+  save_inflight();
+
   // Save buffers to disk (if any).
   save_buffers();
 }
 
-bool net::sender::send(const void* buf, size_t len)
+void net::sender::stats(statistics& st) const
 {
-  // Save time of the last socket operation.
-  _M_last_socket_operation = _M_current_time;
+  uint64_t values[ncounters];
+  _M_counters.snapshot(values);
 
-  // Send data if the peer has not closed the connection.
-  if ((!connection_closed_by_peer()) && ((this->*_M_send)(buf, len))) {
-    return true;
-  } else {
-    // Disconnect.
-    disconnect();
+  // Add the counters of the replay connections (if any).
+  for (unsigned i = 0; i < _M_nreplay; i++) {
+    uint64_t replay[ncounters];
+    _M_replay[i]->_M_counters.snapshot(replay);
 
-    return false;
+    for (size_t j = 0; j < ncounters; j++) {
+      values[j] += replay[j];
+    }
   }
+
+  st.buffers_enqueued = values[buffers_enqueued];
+  st.bytes_enqueued = values[bytes_enqueued];
+  st.buffers_sent = values[buffers_sent];
+  st.bytes_sent = values[bytes_sent];
+  st.buffers_spilled = values[buffers_spilled];
+  st.bytes_spilled = values[bytes_spilled];
+  st.files_replayed = values[files_replayed];
+  st.bytes_replayed = values[bytes_replayed];
+  st.buffers_dropped = values[buffers_dropped];
+  st.files_rejected = values[files_rejected];
+  st.buffers_rejected = values[buffers_rejected];
+  st.buffers_evicted = values[buffers_evicted];
+  st.buffers_discarded = values[buffers_discarded];
+  st.buffers_over_quota = values[buffers_over_quota];
+  st.producer_waits = values[producer_waits];
+  st.producer_wait_time = values[producer_wait_time];
+  st.linger_size_flushes = values[linger_size_flushes];
+  st.linger_time_flushes = values[linger_time_flushes];
+  st.connects = values[connects];
+  st.connect_failures = values[connect_failures];
+  st.retransmission_failovers = values[retransmission_failovers];
+  st.queued_buffers = 0;
+  st.queued_bytes = 0;
+  for (unsigned i = 0; i < _M_nlanes * _M_ntenants; i++) {
+    st.queued_buffers += _M_queues[i].count();
+    st.queued_bytes += _M_queues[i].bytes();
+  }
+  st.save_time = values[save_time];
+  st.scan_time = values[scan_time];
+  st.io_time = values[io_time];
+  st.network_time = values[network_time];
+  st.throttle_time = values[throttle_time];
+
+  uint64_t tcp[ntcp_gauges];
+  for (size_t i = 0; i < ntcp_gauges; i++) {
+    tcp[i] = _M_tcp[i].load(std::memory_order_relaxed);
+  }
+
+  st.tcp_rtt = tcp[tcp_rtt];
+  st.tcp_rtt_var = tcp[tcp_rtt_var];
+  st.tcp_cwnd = tcp[tcp_cwnd];
+  st.tcp_retransmits = tcp[tcp_retransmits];
+  st.tcp_unacked = tcp[tcp_unacked];
+  st.tcp_notsent_bytes = tcp[tcp_notsent_bytes];
+  st.tcp_pacing_rate = tcp[tcp_pacing_rate];
 }
 
-bool net::sender::send_files()
+bool net::sender::sample_tcp_connection()
 {
-  // Connect (if not already connected).
-  if (connect()) {
-    // Open directory.
-    DIR* dir = opendir(_M_directory);
+  // Get TCP information (not available for Unix-domain sockets).
+  socket::tcp_information info;
+  if ((this->*_M_tcp_info)(info)) {
+    _M_tcp[tcp_rtt].store(static_cast<uint64_t>(info.info.tcpi_rtt) * 1000,
+                          std::memory_order_relaxed);
 
-    // If the directory could be opened...
-    if (dir) {
-      // For each directory entry...
+    _M_tcp[tcp_rtt_var].store(
+      static_cast<uint64_t>(info.info.tcpi_rttvar) * 1000,
+      std::memory_order_relaxed
+    );
+
+    _M_tcp[tcp_cwnd].store(info.info.tcpi_snd_cwnd,
+                           std::memory_order_relaxed);
+
+    _M_tcp[tcp_retransmits].store(info.info.tcpi_total_retrans,
+                                  std::memory_order_relaxed);
+
+    _M_tcp[tcp_unacked].store(info.info.tcpi_unacked,
+                              std::memory_order_relaxed);
+
+    _M_tcp[tcp_notsent_bytes].store(info.notsent_bytes,
+                                    std::memory_order_relaxed);
+
+    _M_tcp[tcp_pacing_rate].store(info.pacing_rate,
+                                  std::memory_order_relaxed);
+
+    // 'tcpi_retransmits' is the number of consecutive retransmission
+    // timeouts of the oldest unacknowledged segment.
+    return ((_M_max_retransmits == 0) ||
+            (info.info.tcpi_retransmits < _M_max_retransmits));
+  }
+
+  return true;
+}
+
+bool net::sender::send(const void* buf, size_t len)
+{
+  // If the rate is limited...
+  if ((_M_max_rate_bytes > 0) || (_M_max_rate_messages > 0)) {
+    throttle(len);
+  }
+
+  // Save time of the last socket operation.
+  _M_last_socket_operation = _M_current_time;
+
+  NET_PROBE2(send_start, this, len);
+
+  // Send data if the peer has not closed the connection.
+  const bool closed = connection_closed_by_peer();
+  if ((!closed) &&
+      ((_M_latency) ?
+         send_timed(buf, len) :
+         (this->*_M_send)(buf, len))) {
+    NET_PROBE2(send_finish, this, true);
+
+    return true;
+  } else {
+    NET_PROBE2(send_finish, this, false);
+
+    trace::record(trace::event::send_error, closed ? 0 : errno);
+
+    // Disconnect.
+    disconnect();
+
+    return false;
+  }
+}
+
+bool net::sender::sendv(struct iovec* iov, unsigned iovcnt)
+{
+  // If the rate is limited...
+  if ((_M_max_rate_bytes > 0) || (_M_max_rate_messages > 0)) {
+    throttle(length(iov, iovcnt));
+  }
+
+  // Save time of the last socket operation.
+  _M_last_socket_operation = _M_current_time;
+
+  NET_PROBE2(send_start, this, length(iov, iovcnt));
+
+  // Send data if the peer has not closed the connection.
+  const bool closed = connection_closed_by_peer();
+  if ((!closed) &&
+      ((_M_latency) ?
+         sendv_timed(iov, iovcnt) :
+         (this->*_M_sendv)(iov, iovcnt))) {
+    NET_PROBE2(send_finish, this, true);
+
+    return true;
+  } else {
+    NET_PROBE2(send_finish, this, false);
+
+    trace::record(trace::event::send_error, closed ? 0 : errno);
+
+    // Disconnect.
+    disconnect();
+
+    return false;
+  }
+}
+
+void net::sender::throttle(size_t len)
+{
+  const uint64_t start = monotonic_time();
+  uint64_t now = start;
+
+  do {
+    // Time to wait for the messages (and the bytes, unless the kernel paces
+    // the connection).
+    uint64_t delay = _M_limiter->_M_message_bucket.delay(now);
+
+    if (!_M_kernel_paced) {
+      const uint64_t d = _M_limiter->_M_byte_bucket.delay(now);
+      if (d > delay) {
+        delay = d;
+      }
+    }
+
+    // If there is no need to wait or the sender is being stopped...
+    if ((delay == 0) || (!_M_running)) {
+      break;
+    }
+
+    usleep((delay < sleep_interval * 1000ull) ?
+             static_cast<useconds_t>((delay + 999) / 1000) :
+             sleep_interval);
+
+    now = monotonic_time();
+  } while (true);
+
+  if (now > start) {
+    _M_counters.add(throttle_time, now - start);
+  }
+
+  // The bytes sent by a connection paced by the kernel are taken as well, so
+  // the connections which are not paced by the kernel don't exceed the
+  // budget.
+  _M_limiter->_M_message_bucket.take(1);
+  _M_limiter->_M_byte_bucket.take(len);
+}
+
+bool net::sender::send_buffers(buffer* first, buffer* last)
+{
+  // If the buffers have to be sent in envelopes...
+  if (_M_framing == framing::envelope) {
+    return send_envelopes(first, last);
+  }
+
+  // For each queued buffer...
+  do {
+    const uint64_t start = _M_latency ? monotonic_time() : 0;
+
+    // Send queued buffer.
+    if (send(first->data(), first->length())) {
+#if DEBUG
+      printf("[sender::send_buffers] Queued buffer sent.\n");
+#endif
+
+      if (_M_latency) {
+        record_queue_wait(start, first, 1);
+
+        if (_M_tx_enabled) {
+          track_tx(first, 1);
+        }
+      }
+
+      _M_counters.add(buffers_sent);
+      _M_counters.add(bytes_sent, first->length());
+
+      // If not the last buffer...
+      if (first != last) {
+        buffer* next = first->next();
+
+        // Return buffer to the allocator.
+        _M_allocator.put(first);
+
+        first = next;
+      } else {
+        // Last buffer.
+
+        // Return buffer to the allocator.
+        _M_allocator.put(first);
+
+        return true;
+      }
+    } else {
+#if DEBUG
+      printf("[sender::send_buffers] Error sending queued buffer.\n");
+#endif
+
+      // Return buffers to the buffer pool.
+      queue(_M_lane, _M_tenant).push_front(first, last);
+
+      return false;
+    }
+  } while (true);
+}
+
+bool net::sender::send_lingering(buffer* first, buffer* last)
+{
+  // Number of bytes of the batch.
+  size_t bytes = length(first, last);
+
+  // If the batch is big enough or the socket couldn't be corked...
+  if (((_M_batch_bytes > 0) && (bytes >= _M_batch_bytes)) || (!cork(true))) {
+    return send_buffers(first, last);
+  }
+
+  const uint64_t deadline = monotonic_time() + (_M_linger * 1000000ull);
+
+  bool ret;
+  do {
+    // Send queued buffers.
+    if ((ret = send_buffers(first, last)) == false) {
+      break;
+    }
+
+    // If the batch is big enough...
+    if ((_M_batch_bytes > 0) && (bytes >= _M_batch_bytes)) {
+      _M_counters.add(linger_size_flushes);
+      break;
+    }
+
+    // If there is no credit or the window is full, flush the batch (the
+    // receiver cannot acknowledge what it hasn't received).
+    if ((!has_credit()) ||
+        ((_M_window > 0) && (_M_inflight_count == _M_window))) {
+      break;
+    }
+
+    // Wait for more buffers until the linger time expires.
+    const uint64_t now = monotonic_time();
+    const unsigned timeout = (now < deadline) ?
+                               (deadline - now + 999999) / 1000000 :
+                               0;
+
+    if ((timeout == 0) || (pop(first, last, 0, timeout) == 0)) {
+      _M_counters.add(linger_time_flushes);
+      break;
+    }
+
+    bytes += length(first, last);
+  } while (true);
+
+  // Uncork (sends the partial segment).
+  cork(false);
+
+  return ret;
+}
+
+bool net::sender::send_envelopes(buffer* first, buffer* last)
+{
+  do {
+    // If there is no credit (with flow control, a full window counts as no
+    // credit: a slow receiver withholds both)...
+    if (!has_credit()) {
+      // Return buffers to the buffer pool, they will be sent when the
+      // receiver grants more credit.
+      queue(_M_lane, _M_tenant).push_front(first, last);
+
+      return true;
+    }
+
+    // If the envelopes are acknowledged, wait until there is room in the
+    // window.
+    if ((_M_window > 0) && (!wait_window())) {
+      // Return buffers to the buffer pool.
+      queue(_M_lane, _M_tenant).push_front(first, last);
+
+      return false;
+    }
+
+    // Encode envelope header (within the credit, if flow control is
+    // enabled).
+    const size_t count = _M_flow_control ?
+                           _M_encoder.encode(_M_sequence,
+                                             first,
+                                             last,
+                                             _M_credit_records,
+                                             _M_credit_bytes) :
+                           _M_encoder.encode(_M_sequence, first, last);
+
+    // If the first buffer is too big to be sent in an envelope...
+    if (count == 0) {
+#if DEBUG
+      printf("[sender::send_envelopes] Discarding oversized buffer.\n");
+#endif
+
+      _M_counters.add(buffers_dropped);
+
+      // If not the last buffer...
+      if (first != last) {
+        buffer* next = first->next();
+
+        // Return buffer to the allocator.
+        _M_allocator.put(first);
+
+        first = next;
+
+        continue;
+      } else {
+        // Return buffer to the allocator.
+        _M_allocator.put(first);
+
+        return true;
+      }
+    }
+
+    _M_iov[0].iov_base = const_cast<void*>(_M_encoder.data());
+    _M_iov[0].iov_len = _M_encoder.length();
+
+    size_t bytes = 0;
+
+    buffer* buf = first;
+    for (size_t i = 1; i <= count; i++) {
+      _M_iov[i].iov_base = const_cast<void*>(buf->data());
+      _M_iov[i].iov_len = buf->length();
+
+      bytes += buf->length();
+
+      if (i < count) {
+        buf = buf->next();
+      }
+    }
+
+    const uint64_t start = _M_latency ? monotonic_time() : 0;
+
+    // Send envelope.
+    if (sendv(_M_iov, 1 + count)) {
+      consume_credit(count, bytes);
+
+      _M_counters.add(buffers_sent, count);
+      _M_counters.add(bytes_sent, bytes);
+
+      if (_M_latency) {
+        record_queue_wait(start, first, count);
+
+        if (_M_tx_enabled) {
+          track_tx(first, count);
+        }
+      }
+
+#if DEBUG
+      printf("[sender::send_envelopes] Envelope with %zu buffer(s) sent.\n",
+             count);
+#endif
+
+      // 'buf' points to the last buffer of the envelope.
+      const bool done = (buf == last);
+      buffer* next = done ? nullptr : buf->next();
+
+      // If the envelopes are acknowledged...
+      if (_M_window > 0) {
+        // Keep buffers until the envelope is acknowledged.
+        add_inflight(_M_sequence, first, buf, nullptr);
+      } else {
+        // Return buffers to the allocator.
+        for (size_t i = count; i > 0; i--) {
+          buffer* b = first->next();
+
+          _M_allocator.put(first);
+
+          first = b;
+        }
+      }
+
+      _M_sequence++;
+
+      if (done) {
+        return true;
+      }
+
+      first = next;
+    } else {
+#if DEBUG
+      printf("[sender::send_envelopes] Error sending envelope.\n");
+#endif
+
+      // Return buffers to the buffer pool.
+      queue(_M_lane, _M_tenant).push_front(first, last);
+
+      return false;
+    }
+  } while (true);
+}
+
+bool net::sender::send_envelope(uint64_t sequence, buffer* first, buffer* last)
+{
+  // Encode envelope header.
+  const size_t count = _M_encoder.encode(sequence, first, last);
+
+  _M_iov[0].iov_base = const_cast<void*>(_M_encoder.data());
+  _M_iov[0].iov_len = _M_encoder.length();
+
+  size_t bytes = 0;
+
+  for (size_t i = 1; i <= count; i++) {
+    _M_iov[i].iov_base = const_cast<void*>(first->data());
+    _M_iov[i].iov_len = first->length();
+
+    bytes += first->length();
+
+    first = first->next();
+  }
+
+  // Send envelope.
+  if (sendv(_M_iov, 1 + count)) {
+    consume_credit(count, bytes);
+    return true;
+  }
+
+  return false;
+}
+
+net::sender::file_result
+net::sender::send_file_envelope(uint64_t sequence, const char* filename)
+{
+  file_result res = file_result::ignored;
+
+  uint64_t start = monotonic_time();
+
+  // Open file for reading.
+  const int fd = open(filename, O_RDONLY);
+
+  // If the file could be opened...
+  if (fd != -1) {
+    struct stat sbuf;
+    if (fstat(fd, &sbuf) == 0) {
+      const size_t filesize = sbuf.st_size;
+
+      // Map file into memory (unless it is too big to be sent in an
+      // envelope).
+      void* base = MAP_FAILED;
+      if (filesize > envelope::max_record_length) {
+        res = file_result::too_big;
+      } else {
+        base = mmap(nullptr, filesize, PROT_READ, MAP_SHARED, fd, 0);
+      }
+
+      // If the file could be mapped into memory...
+      if (base != MAP_FAILED) {
+        // Read the file ahead (the envelope header needs the whole file).
+        madvise(base, filesize, MADV_WILLNEED);
+
+        // Encode envelope header.
+        if (_M_encoder.encode(sequence, base, filesize)) {
+          struct iovec iov[2];
+          iov[0].iov_base = const_cast<void*>(_M_encoder.data());
+          iov[0].iov_len = _M_encoder.length();
+          iov[1].iov_base = base;
+          iov[1].iov_len = filesize;
+
+          uint64_t now = monotonic_time();
+          _M_counters.add(io_time, now - start);
+
+          const uint64_t io = _M_counters.get(io_time);
+
+          // Send envelope.
+          if (sendv(iov, 2)) {
+            consume_credit(1, filesize);
+            res = file_result::sent;
+          } else {
+            res = file_result::error;
+          }
+
+          start = account_network_time(now, io);
+        }
+
+        munmap(base, filesize);
+      }
+    }
+
+    close(fd);
+  }
+
+  _M_counters.add(io_time, monotonic_time() - start);
+
+  return res;
+}
+
+bool net::sender::receive_control(size_t& count)
+{
+  count = 0;
+
+  do {
+    // Receive.
+    const ssize_t ret = (this->*_M_recv)(_M_recvbuf + _M_recvlen,
+                                         sizeof(_M_recvbuf) - _M_recvlen);
+
+    // If data has been received...
+    if (ret > 0) {
+      _M_recvlen += ret;
+
+      // Process complete envelopes.
+      size_t offset = 0;
+      do {
+        switch (_M_decoder.decode(_M_recvbuf + offset, _M_recvlen - offset)) {
+          case envelope::decoder::result::ok:
+            switch (_M_decoder.envelope_type()) {
+              case envelope::type::ack:
+                process_ack(_M_decoder.sequence());
+                count++;
+
+                break;
+              case envelope::type::credit:
+                {
+                  const void* data;
+                  size_t len;
+                  if ((_M_decoder.next(data, len)) &&
+                      (len == envelope::credit_size)) {
+                    const uint8_t* p = static_cast<const uint8_t*>(data);
+                    _M_credit_bytes += envelope::read64(p);
+                    _M_credit_records += envelope::read32(p + 8);
+
+                    _M_last_credit = _M_current_time;
+                  } else {
+                    return false;
+                  }
+                }
+
+                break;
+              default:
+                break;
+            }
+
+            offset += _M_decoder.size();
+            break;
+          case envelope::decoder::result::incomplete:
+            // If the envelope doesn't fit in the buffer...
+            if (_M_decoder.size() > sizeof(_M_recvbuf)) {
+              return false;
+            }
+
+            // Move incomplete envelope to the beginning of the buffer.
+            memmove(_M_recvbuf, _M_recvbuf + offset, _M_recvlen - offset);
+            _M_recvlen -= offset;
+
+            offset = 0;
+            break;
+          case envelope::decoder::result::error:
+          default:
+            return false;
+        }
+      } while (offset > 0);
+    } else if (ret == 0) {
+      // The peer has closed the connection.
+      return false;
+    } else {
+      return (errno == EAGAIN);
+    }
+  } while (true);
+}
+
+bool net::sender::resume_session()
+{
+  // Discard received data and credit from a previous connection.
+  _M_recvlen = 0;
+
+  _M_credit_bytes = 0;
+  _M_credit_records = 0;
+  _M_last_credit = _M_current_time;
+
+  // Send hello.
+  _M_encoder.encode(envelope::type::hello,
+                    _M_session,
+                    _M_flow_control ? envelope::flow_control : 0);
+  if ((this->*_M_send)(_M_encoder.data(), _M_encoder.length())) {
+    // Wait for the acknowledgement.
+    size_t count;
+    do {
+      if ((!(this->*_M_wait_readable)(socket_timeout)) ||
+          (!receive_control(count))) {
+        // Disconnect.
+        disconnect();
+
+        return false;
+      }
+    } while (count == 0);
+
+#if DEBUG
+    printf("[sender::resume_session] Resending %zu envelope(s).\n",
+           _M_inflight_count);
+#endif
+
+    // Resend the in-flight envelopes which have not been acknowledged (more
+    // acknowledgements might arrive while resending).
+    uint64_t sequence = 0;
+    while (_M_inflight_count > 0) {
+      const inflight& head = _M_inflight[_M_inflight_head];
+      if (sequence < head.sequence) {
+        sequence = head.sequence;
+      }
+
+      const size_t n = sequence - head.sequence;
+      if (n >= _M_inflight_count) {
+        break;
+      }
+
+      inflight& env = _M_inflight[(_M_inflight_head + n) % _M_window];
+
+      // Wait for credit (if needed).
+      if ((!has_credit()) &&
+          ((!wait_credit(socket_timeout)) || (!has_credit()))) {
+        // Disconnect.
+        disconnect();
+
+        return false;
+      }
+
+      // If the envelope carries buffers...
+      if (env.first) {
+        if (!send_envelope(env.sequence, env.first, env.last)) {
+          return false;
+        }
+      } else if (env.filename) {
+        if (send_file_envelope(env.sequence,
+                               env.filename) == file_result::error) {
+          return false;
+        }
+      }
+
+      sequence++;
+    }
+
+    return true;
+  }
+
+  // Disconnect.
+  disconnect();
+
+  return false;
+}
+
+bool net::sender::wait_window()
+{
+  // While the window is full...
+  while (_M_inflight_count == _M_window) {
+    // Wait for acknowledgements.
+    size_t count;
+    if ((!(this->*_M_wait_readable)(socket_timeout)) ||
+        (!receive_control(count))) {
+#if DEBUG
+      printf("[sender::wait_window] Error waiting for acknowledgements.\n");
+#endif
+
+      // Disconnect.
+      disconnect();
+
+      return false;
+    }
+  }
+
+  return true;
+}
+
+bool net::sender::wait_credit(int timeout)
+{
+  // If there is no credit...
+  if (!has_credit()) {
+    // Wait for the socket to be readable and receive credit.
+    size_t count;
+    if ((this->*_M_wait_readable)(timeout)) {
+      if (!receive_control(count)) {
+        // Disconnect.
+        disconnect();
+
+        return false;
+      }
+    } else if (errno != ETIMEDOUT) {
+      // Disconnect.
+      disconnect();
+
+      return false;
+    }
+  }
+
+  return true;
+}
+
+void net::sender::add_inflight(uint64_t sequence,
+                               buffer* first,
+                               buffer* last,
+                               char* filename)
+{
+  inflight& env = _M_inflight[(_M_inflight_head + _M_inflight_count) %
+                              _M_window];
+
+  env.sequence = sequence;
+  env.first = first;
+  env.last = last;
+  env.tenant = _M_tenant;
+  env.filename = filename;
+
+  _M_inflight_count++;
+}
+
+void net::sender::process_ack(uint64_t sequence)
+{
+  // Release the in-flight envelopes which have been acknowledged.
+  while ((_M_inflight_count > 0) &&
+         (_M_inflight[_M_inflight_head].sequence <= sequence)) {
+    release(_M_inflight[_M_inflight_head]);
+
+    _M_inflight_head = (_M_inflight_head + 1) % _M_window;
+    _M_inflight_count--;
+  }
+}
+
+void net::sender::release(inflight& env)
+{
+  // If the envelope carries buffers...
+  if (env.first) {
+    // Return buffers to the allocator.
+    buffer* buf = env.first;
+    do {
+      buffer* next = buf->next();
+      const bool done = (buf == env.last);
+
+      _M_allocator.put(buf);
+
+      if (done) {
+        break;
+      }
+
+      buf = next;
+    } while (true);
+  } else if (env.filename) {
+    // Remove file.
+    remove_file(env.filename);
+
+    free(env.filename);
+  }
+}
+
+void net::sender::save_inflight()
+{
+  unsigned count = 0u;
+
+  uint64_t saved = 0;
+  uint64_t bytes = 0;
+
+  // For each in-flight envelope...
+  for (; _M_inflight_count > 0; _M_inflight_count--) {
+    inflight& env = _M_inflight[_M_inflight_head];
+
+    // If the envelope carries buffers...
+    if (env.first) {
+      // Save buffers to disk and return them to the allocator.
+      buffer* buf = env.first;
+      do {
+        buffer* next = buf->next();
+        const bool done = (buf == env.last);
+
+        if (save_buffer(buf, env.tenant, count)) {
+          _M_counters.add(buffers_spilled);
+          _M_counters.add(bytes_spilled, buf->length());
+
+          _M_tenants[env.tenant].spilled.fetch_add(buf->length(),
+                                                   std::memory_order_relaxed);
+
+          saved++;
+          bytes += buf->length();
+        } else {
+          _M_counters.add(buffers_dropped);
+        }
+
+        _M_allocator.put(buf);
+
+        if (done) {
+          break;
+        }
+
+        buf = next;
+      } while (true);
+    } else if (env.filename) {
+      // The file is still on disk.
+      free(env.filename);
+    }
+
+    _M_inflight_head = (_M_inflight_head + 1) % _M_window;
+  }
+
+  if (saved > 0) {
+    trace::record(trace::event::spill, saved, bytes);
+  }
+}
+
+bool net::sender::send_files()
+{
+  NET_PROBE1(replay_start, this);
+
+  // Time not spent on file I/O or sending is spent scanning the directory.
+  const uint64_t start = monotonic_time();
+  const uint64_t other = _M_counters.get(io_time) +
+                        _M_counters.get(network_time);
+
+  const bool ret = scan_files();
+
+  _M_counters.add(scan_time,
+                  (monotonic_time() - start) -
+                  ((_M_counters.get(io_time) +
+                    _M_counters.get(network_time)) - other));
+
+  NET_PROBE2(replay_finish, this, ret);
+
+  return ret;
+}
+
+bool net::sender::scan_files()
+{
+  // Connect (if not already connected).
+  if (connect()) {
+    // Open directory.
+    DIR* dir = opendir(_M_directory);
+
+    // If the directory could be opened...
+    if (dir) {
+      // For each directory entry...
       struct dirent* entry;
       while ((entry = readdir(dir)) != nullptr) {
-        // If neither the current directory nor the parent directory...
-        if ((strcmp(entry->d_name, ".") != 0) &&
-            (strcmp(entry->d_name, "..") != 0)) {
+        // If a buffer on disk (not sent by another replay connection)...
+        if ((spooled(entry->d_name)) && (replays(entry->d_name))) {
           // Compose filename.
           char filename[PATH_MAX + 256];
           snprintf(filename,
@@ -260,35 +1755,239 @@ bool net::sender::send_files()
                    _M_directory,
                    entry->d_name);
 
+          // If the receiver hasn't granted credit...
+          if (!has_credit()) {
+            const uint64_t start = monotonic_time();
+            const uint64_t io = _M_counters.get(io_time);
+
+            const bool credit = ((wait_credit(sleep_interval / 1000)) &&
+                                 (has_credit()));
+
+            account_network_time(start, io);
+
+            if (!credit) {
+              closedir(dir);
+
+              // If the connection has not been closed, the files will be sent
+              // when the receiver grants more credit.
+              return connected();
+            }
+          }
+
+          // Send the queued buffers of the priority lanes first.
+          if (!send_priority_buffers()) {
+            closedir(dir);
+
+            return false;
+          }
+
           // If the file exists and is a regular file...
           struct stat sbuf;
           if ((stat(filename, &sbuf) == 0) && (S_ISREG(sbuf.st_mode))) {
+            const uint64_t start = monotonic_time();
+
             // Send file.
-            if (send_file(filename, sbuf.st_size)) {
-              // Remove file.
-              unlink(filename);
-            } else {
+            if (!send_file(filename, sbuf.st_size)) {
               closedir(dir);
 
-              return false;
-            }
-          }
-        }
-      }
+              return false;
+            }
+
+            // If the replay connection has to leave time to the live one or
+            // its rate is limited...
+            if ((_M_replay_only) &&
+                ((_M_replay_share < 100) || (_M_replay_rate > 0))) {
+              pause_replay(monotonic_time() - start, sbuf.st_size);
+            }
+          }
+        }
+      }
+
+      closedir(dir);
+
+      // The replay connection keeps sending files.
+      if (!_M_replay_only) {
+        set_state(state::sending_queued_buffers);
+      }
+
+      return true;
+    }
+  }
+
+  return false;
+}
+
+bool net::sender::has_files() const
+{
+  // Open directory.
+  DIR* dir = opendir(_M_directory);
+
+  // If the directory could be opened...
+  if (dir) {
+    // For each directory entry...
+    struct dirent* entry;
+    while ((entry = readdir(dir)) != nullptr) {
+      // If a buffer on disk...
+      if (spooled(entry->d_name)) {
+        closedir(dir);
+        return true;
+      }
+    }
+
+    closedir(dir);
+  }
+
+  return false;
+}
+
+bool net::sender::replay_idle()
+{
+  // If there are unacknowledged envelopes...
+  if (_M_inflight_count > 0) {
+    // Receive acknowledgements. If the connection has been closed, the
+    // unacknowledged envelopes will be resent after reconnecting.
+    if ((!connected()) || (connection_closed_by_peer())) {
+      // Disconnect.
+      disconnect();
+
+      return false;
+    }
+  } else if ((connected()) &&
+             (_M_current_time - _M_last_socket_operation >= idle_timeout)) {
+    // Disconnect.
+    disconnect();
+  }
+
+  usleep(sleep_interval);
+
+  return true;
+}
+
+bool net::sender::replays(const char* name) const
+{
+  if ((!_M_replay_only) || (_M_replay_count == 1)) {
+    return true;
+  }
+
+  // FNV-1a.
+  uint32_t hash = 2166136261u;
+  for (; *name; name++) {
+    hash = (hash ^ static_cast<uint8_t>(*name)) * 16777619u;
+  }
 
-      closedir(dir);
+  return (hash % _M_replay_count == _M_replay_index);
+}
 
-      _M_state = state::sending_queued_buffers;
+void net::sender::pause_replay(uint64_t elapsed, size_t filesize)
+{
+  // Pause to leave the rest of the time to the live connection.
+  uint64_t pause = (elapsed * (100 - _M_replay_share)) / _M_replay_share;
 
-      return true;
+  // If the rate is limited...
+  if (_M_replay_rate > 0) {
+    // Time the file should have taken at the maximum rate.
+    const uint64_t min = static_cast<uint64_t>((filesize * 1e9) /
+                                               _M_replay_rate);
+
+    if ((min > elapsed) && (min - elapsed > pause)) {
+      pause = min - elapsed;
     }
   }
 
-  return false;
+  // The pause is accounted as network time.
+  _M_counters.add(network_time, pause);
+
+  // Sleep in steps of at most 'sleep_interval' (stop() might be waiting).
+  while ((pause > 0) && (_M_running)) {
+    const uint64_t step = (pause < sleep_interval * 1000ull) ?
+                            pause :
+                            sleep_interval * 1000ull;
+
+    usleep(step / 1000);
+
+    pause -= step;
+  }
 }
 
 bool net::sender::send_file(const char* filename, size_t filesize)
 {
+  // If the file has to be sent in an envelope...
+  if (_M_framing == framing::envelope) {
+    // If the envelopes are not acknowledged...
+    if (_M_window == 0) {
+      switch (send_file_envelope(_M_sequence, filename)) {
+        case file_result::sent:
+          _M_sequence++;
+
+          _M_counters.add(files_replayed);
+          _M_counters.add(bytes_replayed, filesize);
+          trace::record(trace::event::replay, filesize);
+
+          // Remove file.
+          remove_file(filename);
+          return true;
+        case file_result::ignored:
+          _M_counters.add(buffers_dropped);
+
+          // Remove file.
+          remove_file(filename);
+          return true;
+        case file_result::too_big:
+          reject_file(filename);
+          return true;
+        case file_result::error:
+        default:
+          return false;
+      }
+    }
+
+    // If the file has already been sent and is waiting to be
+    // acknowledged...
+    for (size_t i = 0; i < _M_inflight_count; i++) {
+      const inflight& env = _M_inflight[(_M_inflight_head + i) % _M_window];
+      if ((env.filename) && (strcmp(env.filename, filename) == 0)) {
+        return true;
+      }
+    }
+
+    // Wait until there is room in the window.
+    const uint64_t start = monotonic_time();
+    const uint64_t io = _M_counters.get(io_time);
+
+    const bool room = wait_window();
+
+    account_network_time(start, io);
+
+    if (!room) {
+      return false;
+    }
+
+    switch (send_file_envelope(_M_sequence, filename)) {
+      case file_result::sent:
+        _M_counters.add(files_replayed);
+        _M_counters.add(bytes_replayed, filesize);
+        trace::record(trace::event::replay, filesize);
+
+        // The file will be removed when the envelope is acknowledged.
+        add_inflight(_M_sequence++, nullptr, nullptr, strdup(filename));
+        return true;
+      case file_result::ignored:
+        _M_counters.add(buffers_dropped);
+
+        // Remove file.
+        remove_file(filename);
+        return true;
+      case file_result::too_big:
+        reject_file(filename);
+        return true;
+      case file_result::error:
+      default:
+        return false;
+    }
+  }
+
+  uint64_t start = monotonic_time();
+
   // Open file for reading.
   const int fd = open(filename, O_RDONLY);
 
@@ -299,65 +1998,265 @@ bool net::sender::send_file(const char* filename, size_t filesize)
 
     // If the file could be mapped into memory...
     if (base != MAP_FAILED) {
+      // Read the file ahead while the first pages are being sent.
+      madvise(base, filesize, MADV_WILLNEED);
+
+      const uint64_t now = monotonic_time();
+      _M_counters.add(io_time, now - start);
+
       // Send file content.
       const bool ret = send(base, filesize);
 
+      start = account_network_time(now, _M_counters.get(io_time));
+
       munmap(base, filesize);
       close(fd);
 
+      _M_counters.add(io_time, monotonic_time() - start);
+
+      // Remove file (if it has been sent).
+      if (ret) {
+        _M_counters.add(files_replayed);
+        _M_counters.add(bytes_replayed, filesize);
+        trace::record(trace::event::replay, filesize);
+
+        remove_file(filename);
+      }
+
       return ret;
     }
 
     close(fd);
   }
 
+  _M_counters.add(io_time, monotonic_time() - start);
+
   // Ignore file.
+  _M_counters.add(buffers_dropped);
+
+  remove_file(filename);
+
   return true;
 }
 
+uint64_t net::sender::account_network_time(uint64_t start, uint64_t io)
+{
+  const uint64_t now = monotonic_time();
+
+  _M_counters.add(network_time,
+                  (now - start) - (_M_counters.get(io_time) - io));
+
+  return now;
+}
+
+void net::sender::reject_file(const char* filename)
+{
+#if DEBUG
+  printf("[sender::reject_file] File '%s' too big to be sent.\n", filename);
+#endif
+
+  _M_counters.add(files_rejected);
+
+  char newname[PATH_MAX + 256 + sizeof(rejected_suffix)];
+  snprintf(newname, sizeof(newname), "%s%s", filename, rejected_suffix);
+
+  // If the file cannot be renamed, it will be tried again in the next scan.
+  rename(filename, newname);
+}
+
+bool net::sender::spooled(const char* name)
+{
+  // If a hidden file (a file being written, see save_buffer()), the current
+  // directory or the parent directory...
+  if (name[0] == '.') {
+    return false;
+  }
+
+  // If a rejected file...
+  const size_t len = strlen(name);
+  const size_t suffixlen = sizeof(rejected_suffix) - 1;
+
+  return ((len <= suffixlen) ||
+          (strcmp(name + len - suffixlen, rejected_suffix) != 0));
+}
+
+void net::sender::remove_file(const char* filename)
+{
+  const uint64_t start = monotonic_time();
+
+  sender& spiller = *_M_spiller;
+
+  // If there are several tenants or a disk quota...
+  if ((spiller._M_ntenants > 1) ||
+      (spiller._M_tenants[0].max_spill_bytes > 0)) {
+    // Deduct the file from the disk usage of its tenant.
+    const unsigned t = spiller.file_tenant(filename);
+
+    struct stat sbuf;
+    if ((t < spiller._M_ntenants) && (stat(filename, &sbuf) == 0)) {
+      spiller._M_tenants[t].spilled.fetch_sub(sbuf.st_size,
+                                              std::memory_order_relaxed);
+    }
+  }
+
+  unlink(filename);
+
+  _M_counters.add(io_time, monotonic_time() - start);
+}
+
+unsigned net::sender::file_tenant(const char* filename) const
+{
+  if (_M_ntenants > 1) {
+    // The tenant is the extension of the file.
+    const char* dot = strrchr(filename, '.');
+    const char* slash = strrchr(filename, '/');
+
+    if ((dot) && ((!slash) || (dot > slash))) {
+      const unsigned long t = strtoul(dot + 1, nullptr, 10);
+      if (t < _M_ntenants) {
+        return static_cast<unsigned>(t);
+      }
+    }
+
+    return _M_ntenants;
+  }
+
+  return 0;
+}
+
+void net::sender::account_files()
+{
+  for (unsigned t = 0; t < _M_ntenants; t++) {
+    _M_tenants[t].spilled.store(0, std::memory_order_relaxed);
+  }
+
+  // Open directory.
+  DIR* dir = opendir(_M_directory);
+
+  // If the directory could be opened...
+  if (dir) {
+    // For each directory entry...
+    struct dirent* entry;
+    while ((entry = readdir(dir)) != nullptr) {
+      // If a buffer on disk...
+      if (spooled(entry->d_name)) {
+        const unsigned t = file_tenant(entry->d_name);
+
+        // Compose filename.
+        char filename[PATH_MAX + 256];
+        snprintf(filename,
+                 sizeof(filename),
+                 "%s/%s",
+                 _M_directory,
+                 entry->d_name);
+
+        // Add the file to the disk usage of its tenant (the file is
+        // deducted when it is removed, see remove_file()).
+        struct stat sbuf;
+        if ((t < _M_ntenants) &&
+            (stat(filename, &sbuf) == 0) &&
+            (S_ISREG(sbuf.st_mode))) {
+          _M_tenants[t].spilled.fetch_add(sbuf.st_size,
+                                          std::memory_order_relaxed);
+        }
+      }
+    }
+
+    closedir(dir);
+  }
+}
+
 bool net::sender::save_buffers()
 {
   bool ret = true;
 
+  // Save the lanes from the highest one.
+  for (unsigned i = _M_nlanes; i > 0; i--) {
+    for (unsigned t = 0; t < _M_ntenants; t++) {
+      if (!save_buffers(i - 1, t)) {
+        ret = false;
+      }
+    }
+  }
+
+  return ret;
+}
+
+bool net::sender::save_buffers(unsigned lane, unsigned t)
+{
+  NET_PROBE1(spill_start, this);
+
+  const uint64_t start = monotonic_time();
+
+  bool ret = true;
+
   unsigned count = 0u;
 
+  uint64_t saved = 0;
+  uint64_t bytes = 0;
+
+  tenant& ten = _M_tenants[t];
+
   // Get queued buffers.
   buffer* first;
   buffer* last;
-  if (_M_buffers.pop(first, last) > 0) {
+  if (queue(lane, t).pop(first, last) > 0) {
     // For each queued buffer...
     do {
-      // Save buffer to disk.
-      if (save_buffer(first, count)) {
-        // If not the last buffer...
-        if (first != last) {
-          buffer* next = first->next();
-
-          // Return buffer to the allocator.
-          _M_allocator.put(first);
+      const int64_t len = static_cast<int64_t>(first->length());
+
+      // If the tenant would exceed its disk quota...
+      if ((ten.max_spill_bytes > 0) &&
+          (ten.spilled.load(std::memory_order_relaxed) + len >
+           static_cast<int64_t>(ten.max_spill_bytes))) {
+        _M_counters.add(buffers_over_quota);
+      } else if (save_buffer(first, t, count)) {
+        // Save buffer to disk.
+        _M_counters.add(buffers_spilled);
+        _M_counters.add(bytes_spilled, first->length());
+
+        ten.spilled.fetch_add(len, std::memory_order_relaxed);
+
+        saved++;
+        bytes += first->length();
+      } else {
+        _M_counters.add(buffers_dropped);
+        ret = false;
+      }
 
-          first = next;
-        } else {
-          // Last buffer.
+      // If not the last buffer...
+      if (first != last) {
+        buffer* next = first->next();
 
-          // Return buffer to the allocator.
-          _M_allocator.put(first);
+        // Return buffer to the allocator.
+        _M_allocator.put(first);
 
-          break;
-        }
+        first = next;
       } else {
+        // Last buffer.
+
         // Return buffer to the allocator.
         _M_allocator.put(first);
 
-        ret = false;
+        break;
       }
     } while (true);
   }
 
+  _M_counters.add(save_time, monotonic_time() - start);
+
+  if (saved > 0) {
+    trace::record(trace::event::spill, saved, bytes);
+  }
+
+  NET_PROBE3(spill_finish, this, saved, bytes);
+
   return ret;
 }
 
-bool net::sender::save_buffer(const buffer* buf, unsigned& count)
+bool net::sender::save_buffer(const buffer* buf,
+                              unsigned t,
+                              unsigned& count)
 {
   struct tm tm;
   localtime_r(&_M_current_time, &tm);
@@ -365,25 +2264,354 @@ bool net::sender::save_buffer(const buffer* buf, unsigned& count)
   // Work with a copy of 'count'.
   unsigned cnt = count;
 
-  char filename[PATH_MAX + 23];
+  char filename[PATH_MAX + 27];
+  char tmpname[PATH_MAX + 28];
   struct stat sbuf;
 
+  const size_t dirlen = strlen(_M_directory);
+
   // Search a filename which is not in use.
   do {
-    snprintf(filename,
-             sizeof(filename),
-             "%s/%04u%02u%02u-%02u%02u%02u_%06u",
+    const int len = snprintf(filename,
+                             sizeof(filename),
+                             "%s/%04u%02u%02u-%02u%02u%02u_%06u",
+                             _M_directory,
+                             1900 + tm.tm_year,
+                             1 + tm.tm_mon,
+                             tm.tm_mday,
+                             tm.tm_hour,
+                             tm.tm_min,
+                             tm.tm_sec,
+                             cnt++);
+
+    // If there are several tenants, append the tenant (for the disk
+    // quotas).
+    if ((_M_ntenants > 1) &&
+        (len > 0) &&
+        (static_cast<size_t>(len) < sizeof(filename))) {
+      snprintf(filename + len, sizeof(filename) - len, ".%u", t);
+    }
+
+    // Temporary name: the name of the file hidden (see spooled()).
+    snprintf(tmpname,
+             sizeof(tmpname),
+             "%s/.%s",
              _M_directory,
-             1900 + tm.tm_year,
-             1 + tm.tm_mon,
-             tm.tm_mday,
-             tm.tm_hour,
-             tm.tm_min,
-             tm.tm_sec,
-             cnt++);
-  } while (stat(filename, &sbuf) == 0);
+             filename + dirlen + 1);
+  } while ((stat(filename, &sbuf) == 0) || (stat(tmpname, &sbuf) == 0));
 
   count = cnt;
 
-  return buf->save(filename);
+  const uint64_t start = _M_latency ? monotonic_time() : 0;
+
+  // Write the file under the temporary name and rename it once complete,
+  // so the replay connections never send a partial file.
+  bool ret = buf->save(tmpname);
+  if ((ret) && (rename(tmpname, filename) != 0)) {
+    unlink(tmpname);
+    ret = false;
+  }
+
+  if (_M_latency) {
+    _M_latency->spill.record(monotonic_time() - start);
+  }
+
+  return ret;
+}
+
+bool net::sender::connect_timed()
+{
+  const uint64_t start = monotonic_time();
+
+  // Connect.
+  if ((this->*_M_connect)()) {
+    const uint64_t now = monotonic_time();
+    _M_latency->connect.record(now - start);
+
+    pace();
+
+    // If the envelopes have to be acknowledged...
+    if (_M_window > 0) {
+      // Resume session.
+      if (!resume_session()) {
+        _M_counters.add(connect_failures);
+        trace::record(trace::event::connect_failure, errno);
+
+        return false;
+      }
+
+      _M_latency->handshake.record(monotonic_time() - now);
+    }
+
+    _M_counters.add(connects);
+    trace::record(trace::event::connect);
+
+    return true;
+  }
+
+  _M_counters.add(connect_failures);
+  trace::record(trace::event::connect_failure, errno);
+
+  return false;
+}
+
+bool net::sender::send_timed(const void* buf, size_t len)
+{
+  const uint64_t start = monotonic_time();
+
+  const bool ret = (this->*_M_send)(buf, len);
+
+  _M_latency->send.record(monotonic_time() - start);
+
+  return ret;
+}
+
+bool net::sender::sendv_timed(struct iovec* iov, unsigned iovcnt)
+{
+  const uint64_t start = monotonic_time();
+
+  const bool ret = (this->*_M_sendv)(iov, iovcnt);
+
+  _M_latency->send.record(monotonic_time() - start);
+
+  return ret;
+}
+
+void net::sender::record_queue_wait(uint64_t now,
+                                    const buffer* buf,
+                                    size_t count)
+{
+  for (; count > 0; count--) {
+    // If the buffer was timestamped when it was queued...
+    if (buf->timestamp() != 0) {
+      _M_latency->queue_wait.record(now - buf->timestamp());
+    }
+
+    buf = buf->next();
+  }
+}
+
+bool net::sender::connect_timestamped()
+{
+  // Connect.
+  if (connect_insecure()) {
+    // Discard the buffers waiting for timestamps of the previous connection
+    // (the offsets restart from 0).
+    _M_tx_bytes = 0;
+
+    _M_tx_pending_head = 0;
+    _M_tx_pending_count = 0;
+
+    _M_tx_scheduled = 0;
+    _M_tx_sent = 0;
+
+    // Enable transmit timestamps (if they are not supported, the connection
+    // is used without them).
+    _M_tx_enabled = _M_sock.set_tx_timestamping(true);
+
+    return true;
+  }
+
+  return false;
+}
+
+bool net::sender::sendv_timestamped(struct iovec* iov, unsigned iovcnt)
+{
+  // Receive the pending transmit timestamps (the error queue is limited by
+  // the size of the receive buffer).
+  if (_M_tx_enabled) {
+    receive_tx_timestamps();
+  }
+
+  // Skip empty buffers.
+  while ((iovcnt > 0) && (iov->iov_len == 0)) {
+    iov++;
+    iovcnt--;
+  }
+
+  // While there is data to be sent...
+  while (iovcnt > 0) {
+    // Send.
+    ssize_t ret = _M_sock.writev(iov, iovcnt);
+
+    // If some data could be sent...
+    if (ret >= 0) {
+      _M_tx_bytes += static_cast<uint32_t>(ret);
+
+      // Skip the buffers which have been completely sent.
+      while ((iovcnt > 0) && (static_cast<size_t>(ret) >= iov->iov_len)) {
+        ret -= iov->iov_len;
+
+        iov++;
+        iovcnt--;
+      }
+
+      // If a buffer has been partially sent...
+      if (ret > 0) {
+        iov->iov_base = static_cast<uint8_t*>(iov->iov_base) + ret;
+        iov->iov_len -= ret;
+      }
+    } else {
+      // If the send operation would block...
+      if (errno == EAGAIN) {
+        // Wait for the socket to be writable.
+        if (!wait_timestamped(POLLOUT, socket_timeout)) {
+          return false;
+        }
+      } else {
+        return false;
+      }
+    }
+  }
+
+  return true;
+}
+
+bool net::sender::wait_timestamped(short events, int timeout)
+{
+  struct pollfd fd;
+  fd.fd = _M_sock.fd();
+  fd.events = events;
+
+  do {
+    switch (poll(&fd, 1, timeout)) {
+      case 1:
+        // If only POLLERR has been reported, there might be transmit
+        // timestamps in the error queue.
+        if ((fd.revents & (events | POLLHUP)) == 0) {
+          // If there were transmit timestamps, wait again; otherwise, it is
+          // a socket error, which will be reported by the next operation.
+          if (receive_tx_timestamps() > 0) {
+            continue;
+          }
+        }
+
+        return true;
+      case 0: // Timeout.
+        errno = ETIMEDOUT;
+
+        // Fall through.
+      default:
+        return false;
+    }
+  } while (true);
+}
+
+size_t net::sender::receive_tx_timestamps()
+{
+  socket::tx_timestamp timestamps[max_tx_timestamps];
+
+  size_t count = 0;
+
+  do {
+    // Receive transmit timestamps.
+    const ssize_t ret = _M_sock.recv_tx_timestamps(timestamps,
+                                                   max_tx_timestamps);
+
+    if (ret <= 0) {
+      return count;
+    }
+
+    // The kernel timestamps are taken from CLOCK_REALTIME and the buffers
+    // are timestamped with CLOCK_MONOTONIC.
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+
+    const uint64_t offset = (static_cast<uint64_t>(ts.tv_sec) *
+                             1000000000ull) +
+                            ts.tv_nsec -
+                            monotonic_time();
+
+    for (ssize_t i = 0; i < ret; i++) {
+      process_tx_timestamp(timestamps[i], timestamps[i].time - offset);
+    }
+
+    count += ret;
+
+    // If the error queue has been emptied...
+    if (static_cast<size_t>(ret) < max_tx_timestamps) {
+      return count;
+    }
+  } while (true);
+}
+
+void net::sender::process_tx_timestamp(const socket::tx_timestamp& ts,
+                                       uint64_t t)
+{
+  histogram* hist;
+  size_t n;
+
+  switch (ts.t) {
+    case socket::tx_timestamp::type::scheduled:
+      hist = &_M_latency->tx_scheduled;
+      n = _M_tx_scheduled;
+      break;
+    case socket::tx_timestamp::type::sent:
+      hist = &_M_latency->tx_sent;
+      n = _M_tx_sent;
+      break;
+    case socket::tx_timestamp::type::acknowledged:
+      hist = &_M_latency->tx_acknowledged;
+      n = 0;
+      break;
+    default:
+      return;
+  }
+
+  // The timestamp applies to the buffers whose last byte has been written
+  // up to the timestamped byte (the writes are timestamped in order).
+  while (n < _M_tx_pending_count) {
+    const tx_pending& p = _M_tx_pending[(_M_tx_pending_head + n) %
+                                        max_tx_pending];
+
+    if (static_cast<int32_t>(p.end - ts.id) > 0) {
+      break;
+    }
+
+    if (t > p.timestamp) {
+      hist->record(t - p.timestamp);
+    }
+
+    n++;
+  }
+
+  switch (ts.t) {
+    case socket::tx_timestamp::type::scheduled:
+      _M_tx_scheduled = n;
+      break;
+    case socket::tx_timestamp::type::sent:
+      _M_tx_sent = n;
+      break;
+    default:
+      // The acknowledged buffers don't wait for more timestamps.
+      _M_tx_pending_head = (_M_tx_pending_head + n) % max_tx_pending;
+      _M_tx_pending_count -= n;
+
+      _M_tx_scheduled = (_M_tx_scheduled > n) ? _M_tx_scheduled - n : 0;
+      _M_tx_sent = (_M_tx_sent > n) ? _M_tx_sent - n : 0;
+
+      break;
+  }
+}
+
+void net::sender::track_tx(const buffer* buf, size_t count)
+{
+  // Offset of the last byte written.
+  const uint32_t end = _M_tx_bytes - 1;
+
+  for (; (count > 0) && (_M_tx_pending_count < max_tx_pending); count--) {
+    // If the buffer was timestamped when it was queued...
+    if (buf->timestamp() != 0) {
+      tx_pending& p = _M_tx_pending[(_M_tx_pending_head +
+                                     _M_tx_pending_count) %
+                                    max_tx_pending];
+
+      p.end = end;
+      p.timestamp = buf->timestamp();
+
+      _M_tx_pending_count++;
+    }
+
+    buf = buf->next();
+  }
 }
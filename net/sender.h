@@ -4,7 +4,15 @@
 #include <stdint.h>
 #include <time.h>
 #include <limits.h>
+#include <errno.h>
+#include <poll.h>
+#include <semaphore.h>
 #include "net/buffers.h"
+#include "net/counters.h"
+#include "net/histogram.h"
+#include "net/token_bucket.h"
+#include "net/trace.h"
+#include "net/envelope.h"
 #include "net/socket.h"
 #include "net/ssl/socket.h"
 
@@ -12,6 +20,25 @@ namespace net {
   // Sender.
   class sender {
     public:
+      // Maximum number of priority lanes.
+      static constexpr const unsigned max_lanes = 8;
+
+      // Maximum number of tenants.
+      static constexpr const unsigned max_tenants = 64;
+
+      // Maximum number of replay connections.
+      static constexpr const unsigned max_replay_connections = 16;
+
+      // Suffix of the files too big to be sent in an envelope.
+      static constexpr const char rejected_suffix[] = ".rejected";
+
+      // Maximum linger time in milliseconds (the kernel sends the partial
+      // segments of a corked socket after 200 ms).
+      static constexpr const unsigned max_linger = 200;
+
+      // Default quantum (bytes) of the deficit round-robin across tenants.
+      static constexpr const size_t default_quantum = 64 * 1024;
+
       // Constructor.
       sender(buffer::allocator& allocator);
 
@@ -33,11 +60,274 @@ namespace net {
       // Stop.
       void stop();
 
-      // Send buffer.
+      // Set framing (must be called before start()).
+      enum class framing {
+        none,     // Raw buffer bytes back-to-back.
+        envelope  // Each batch is sent as an envelope (see net/envelope.h).
+      };
+
+      void set_framing(framing f);
+
+      // Set maximum number of unacknowledged envelopes (must be called before
+      // start()). If 0 (default), the buffers are considered delivered as
+      // soon as they have been sent; otherwise, envelope framing is required
+      // and the buffers are kept until the receiver acknowledges them.
+      void set_window(size_t window);
+
+      // Set credit-based flow control (must be called before start()). If
+      // enabled (requires acknowledgements), the sender only sends what the
+      // receiver has granted instead of blocking; if no credit is granted for
+      // 'credit_timeout' seconds, the queued buffers are written to disk.
+      void set_flow_control(bool on);
+
+      // Set number of consecutive retransmission timeouts of the TCP
+      // connection after which it is considered broken and closed (0:
+      // disabled, default). The connection is sampled every
+      // 'tcp_info_interval' seconds; if the envelopes are acknowledged, the
+      // unacknowledged ones are resent after reconnecting.
+      void set_max_retransmits(unsigned n);
+
+      // Set priority lanes (must be called before start()). The buffers are
+      // queued in the lane of their priority (0: lowest, 'n' - 1: highest)
+      // and the lanes are drained by strict priority ('weights': nullptr) or
+      // by weighted round-robin (lane 'i' sends up to 'weights[i]' batches in
+      // turn). While the buffers on disk are being sent, the queued buffers
+      // of the lanes above the lowest one are sent between files.
+      bool set_lanes(unsigned n, const unsigned* weights = nullptr);
+
+      // Set tenants (must be called before start()). Each lane is split into
+      // a queue per tenant and the queues of a lane are drained by deficit
+      // round-robin: in its turn, a tenant can send 'quantum' bytes more (a
+      // batch exceeding its deficit is sent and the excess is deducted from
+      // its next turns).
+      bool set_tenants(unsigned n, size_t quantum = default_quantum);
+
+      // Set quotas of a tenant (must be called before start()): maximum
+      // number of queued buffers and bytes of each of its queues (the lower
+      // of these and the limits of the lane apply) and maximum number of
+      // bytes written to disk and not sent yet (0: no limit). The buffers
+      // exceeding the disk quota are discarded instead of written to disk.
+      void set_tenant_quota(unsigned tenant,
+                            size_t buffers,
+                            size_t bytes,
+                            size_t spill_bytes);
+
+      // Set maximum number of queued buffers and bytes of every lane / of
+      // the lane of the priority (see set_overflow()).
+      void set_max_queued(size_t buffers, size_t bytes);
+      void set_max_queued(unsigned priority, size_t buffers, size_t bytes);
+
+      // Overflow policy (when the new buffers would exceed the maximum
+      // number of queued buffers or bytes of their lane).
+      enum class overflow {
+        spill,       // Write the queued buffers of the lane to disk
+                     // (default).
+        block,       // Wait for room up to 'timeout' milliseconds, then
+                     // reject the new buffers.
+        reject,      // Reject the new buffers.
+        drop_oldest, // Discard the oldest queued buffers.
+        drop_newest  // Discard the new buffers.
+      };
+
+      // Set overflow policy (must be called before start()). The buffers
+      // rejected by try_send() are kept by the caller, the ones rejected by
+      // send() are discarded.
+      void set_overflow(overflow policy, unsigned timeout = 0);
+
+      // Set maximum number of buffers and bytes sent in a batch (0: no
+      // limit). A buffer bigger than 'bytes' is sent in a batch on its own.
+      void set_max_batch(size_t buffers, size_t bytes);
+
+      // Set linger time in milliseconds (up to max_linger) and batch size
+      // (must be called before start()). When the queued buffers taken at
+      // once add up to less than 'batch_bytes', the socket is corked and the
+      // sender waits up to 'linger' milliseconds for more buffers, so they
+      // are packed in full segments (0: don't linger, default; 'batch_bytes'
+      // 0: linger until the time expires).
+      void set_linger(unsigned linger, size_t batch_bytes);
+
+      // Send the buffers on disk on other connections (must be called
+      // before start()), so the queued buffers keep flowing on the first
+      // connection while the backlog is being sent. Each file is sent by one
+      // of the 'connections' replay connections (chosen by its name), which
+      // spend at most 'share' percent of the time sending files (1-100, 0
+      // disables the replay connections).
+      void set_concurrent_replay(unsigned share, unsigned connections = 1);
+
+      // Set maximum number of bytes per second sent by the replay
+      // connections altogether (0: no limit, default).
+      void set_replay_rate(uint64_t bytes_per_second);
+
+      // Limit the bytes and the messages (buffers, envelopes or files written
+      // at once) sent per second (must be called before start(); 0: no
+      // limit, default). If 'kernel_pacing' is set, the bytes are paced by
+      // the kernel (SO_MAX_PACING_RATE) unless the socket doesn't support
+      // it. The limits apply to the sender and its replay connections
+      // altogether: they take from the same token buckets and, with kernel
+      // pacing, each connection is paced at an even share of the byte rate.
+      void set_rate_limit(uint64_t bytes_per_second,
+                          uint64_t messages_per_second = 0,
+                          bool kernel_pacing = false);
+
+      // Enable latency histograms (must be called before start()). The
+      // buffers are timestamped when they are queued.
+      void set_latency_histograms(bool on);
+
+      // Enable kernel transmit timestamps (must be called before start(),
+      // requires latency histograms and no encryption). The kernel reports
+      // when the last byte of each write entered the packet scheduler, was
+      // passed to the network device and was acknowledged by the peer; the
+      // timestamps are matched to the buffers of the write by byte offset.
+      void set_tx_timestamps(bool on);
+
+      // Send buffer (priority 0 and tenant 0 if not specified; the
+      // priorities above the highest lane are sent in the highest lane and
+      // the unknown tenants are accounted to tenant 0).
       void send(buffer* buf);
+      void send(buffer* buf, unsigned priority, unsigned tenant = 0);
 
       // Send buffers.
       void send(buffer* first, buffer* last);
+      void send(buffer* first,
+                buffer* last,
+                unsigned priority,
+                unsigned tenant = 0);
+
+      // Try to send buffer / buffers (returns false if they have been
+      // rejected, see set_overflow()).
+      bool try_send(buffer* buf);
+      bool try_send(buffer* buf, unsigned priority, unsigned tenant = 0);
+      bool try_send(buffer* first, buffer* last);
+      bool try_send(buffer* first,
+                    buffer* last,
+                    unsigned priority,
+                    unsigned tenant = 0);
+
+      // Statistics (times in nanoseconds).
+      struct statistics {
+        // Buffers accepted by send() and try_send().
+        uint64_t buffers_enqueued;
+        uint64_t bytes_enqueued;
+
+        // Buffers sent (the buffers resent after reconnecting are not
+        // counted again).
+        uint64_t buffers_sent;
+        uint64_t bytes_sent;
+
+        // Buffers written to disk.
+        uint64_t buffers_spilled;
+        uint64_t bytes_spilled;
+
+        // Files sent from disk.
+        uint64_t files_replayed;
+        uint64_t bytes_replayed;
+
+        // Buffers discarded (too big to be sent in an envelope or which
+        // couldn't be written to disk) and files which couldn't be read.
+        uint64_t buffers_dropped;
+
+        // Files too big to be sent in an envelope (they are left on disk
+        // with the suffix 'rejected_suffix' and not sent again).
+        uint64_t files_rejected;
+
+        // Buffers rejected, queued buffers discarded to make room for new
+        // ones and new buffers discarded (see set_overflow()).
+        uint64_t buffers_rejected;
+        uint64_t buffers_evicted;
+        uint64_t buffers_discarded;
+
+        // Buffers discarded because their tenant exceeded its disk quota.
+        uint64_t buffers_over_quota;
+
+        // Times send() / try_send() waited for room and time waiting.
+        uint64_t producer_waits;
+        uint64_t producer_wait_time;
+
+        // Corked batches flushed because they reached the batch size and
+        // because the linger time expired (see set_linger()).
+        uint64_t linger_size_flushes;
+        uint64_t linger_time_flushes;
+
+        // Connections established and failed connection attempts.
+        uint64_t connects;
+        uint64_t connect_failures;
+
+        // Connections closed because of persistent retransmissions.
+        uint64_t retransmission_failovers;
+
+        // Number of queued buffers and bytes (all lanes).
+        uint64_t queued_buffers;
+        uint64_t queued_bytes;
+
+        // Time writing buffers to disk.
+        uint64_t save_time;
+
+        // Time scanning the directory (readdir() and stat()).
+        uint64_t scan_time;
+
+        // Time opening, mapping, closing and removing files (the files are
+        // mapped into memory, so reading them is accounted as network time).
+        uint64_t io_time;
+
+        // Time sending files (including waiting for acknowledgements,
+        // credit and the rate limits).
+        uint64_t network_time;
+
+        // Time waiting for the rate limits (see set_rate_limit()).
+        uint64_t throttle_time;
+
+        // Last sample of the TCP connection (0 if not available).
+        uint64_t tcp_rtt;            // Smoothed RTT (nanoseconds).
+        uint64_t tcp_rtt_var;        // RTT variance (nanoseconds).
+        uint64_t tcp_cwnd;           // Congestion window (segments).
+        uint64_t tcp_retransmits;    // Segments retransmitted.
+        uint64_t tcp_unacked;        // Segments not acknowledged.
+        uint64_t tcp_notsent_bytes;  // Bytes in the send queue not sent.
+        uint64_t tcp_pacing_rate;    // Bytes per second.
+      };
+
+      // Get statistics, including the replay connection (the counters are
+      // read without locking, so the snapshot might not be consistent across
+      // counters).
+      void stats(statistics& st) const;
+
+      // Latency histograms (nanoseconds).
+      struct latency_histograms {
+        // From send() until the buffer is passed to the socket (including
+        // the time waiting for acknowledgements and credit and the failed
+        // attempts to send it).
+        histogram queue_wait;
+
+        // Time in send_insecure() / send_secure() (one value per write,
+        // which might carry several buffers).
+        histogram send;
+
+        // Connection establishment (including the TLS handshake).
+        histogram connect;
+
+        // Session handshake (hello, acknowledgement and resending the
+        // in-flight envelopes).
+        histogram handshake;
+
+        // Writing a buffer to disk.
+        histogram spill;
+
+        // From send() until the write carrying the buffer entered the packet
+        // scheduler, was passed to the network device and was acknowledged
+        // by the peer (kernel timestamps, see set_tx_timestamps()).
+        histogram tx_scheduled;
+        histogram tx_sent;
+        histogram tx_acknowledged;
+
+        // Add the values recorded in other histograms.
+        void merge(const latency_histograms& other);
+
+        // Reset.
+        void reset();
+      };
+
+      // Get latency histograms (returns false if they are not enabled).
+      bool latency(latency_histograms& h) const;
 
     private:
       // Idle timeout in seconds (after this time an idle connection is closed).
@@ -46,13 +336,41 @@ namespace net {
       // Reconnection time in seconds.
       static constexpr const time_t reconnection_time = 30;
 
-      // Maximum number of queued buffers. Reached this limit, the buffers are
+      // Time in seconds without credit after which the queued buffers are
       // written to disk.
-      static constexpr const size_t max_queued_buffers = 10000;
+      static constexpr const time_t credit_timeout = 5;
+
+      // Sleep interval in microseconds.
+      static constexpr const useconds_t sleep_interval = 250000;
+
+      // Burst of the rate limits in milliseconds (the tokens accumulated
+      // while idle).
+      static constexpr const unsigned rate_burst = 100;
+
+      // Default maximum number of queued buffers and bytes of a lane.
+      static constexpr const size_t default_max_queued_buffers = 10000;
+      static constexpr const size_t default_max_queued_bytes =
+        64 * 1024 * 1024;
+
+      // Default maximum number of buffers and bytes taken from the queue at
+      // once (0: no limit). The bytes are bounded by the largest send buffer
+      // of a TCP socket (net.ipv4.tcp_wmem).
+      static constexpr const size_t default_max_batch_buffers = 0;
+      static constexpr const size_t default_max_batch_bytes = 4 * 1024 * 1024;
 
       // Socket timeout in milliseconds.
       static constexpr const int socket_timeout = socket::default_timeout;
 
+      // Interval in seconds between samples of the TCP connection.
+      static constexpr const time_t tcp_info_interval = 1;
+
+      // Maximum number of buffers waiting for transmit timestamps (the
+      // buffers sent meanwhile are not measured).
+      static constexpr const size_t max_tx_pending = 16384;
+
+      // Maximum number of transmit timestamps received at once.
+      static constexpr const size_t max_tx_timestamps = 64;
+
       // Buffer allocator.
       buffer::allocator& _M_allocator;
 
@@ -66,20 +384,170 @@ namespace net {
       typedef bool (sender::*fnconnect)();
       typedef void (sender::*fndisconnect)();
       typedef bool (sender::*fnsend)(const void*, size_t);
+      typedef bool (sender::*fnsendv)(struct iovec*, unsigned);
+      typedef ssize_t (sender::*fnrecv)(void*, size_t);
+      typedef bool (sender::*fnwait_readable)(int);
       typedef bool (sender::*fnconnected)() const;
-      typedef bool (sender::*fnconnection_closed_by_peer)();
+      typedef bool (sender::*fntcp_info)(socket::tcp_information&);
+      typedef bool (sender::*fncork)(bool);
+      typedef bool (sender::*fnpace)(uint64_t);
 
       fnconnect _M_connect;
       fndisconnect _M_disconnect;
       fnsend _M_send;
+      fnsendv _M_sendv;
+      fnrecv _M_recv;
+      fnwait_readable _M_wait_readable;
       fnconnected _M_connected;
-      fnconnection_closed_by_peer _M_connection_closed_by_peer;
+      fntcp_info _M_tcp_info;
+      fncork _M_cork;
+      fnpace _M_pace;
 
       // Directory where to store the buffers.
       char _M_directory[PATH_MAX];
 
-      // Buffers.
-      buffers _M_buffers;
+      // Priority lanes.
+      unsigned _M_nlanes = 1;
+
+      // Tenants and quantum of the deficit round-robin.
+      unsigned _M_ntenants = 1;
+      size_t _M_quantum = default_quantum;
+
+      // Queues (the queue of tenant 't' in lane 'l' is
+      // _M_queues[(l * _M_ntenants) + t]).
+      buffers* _M_queues = nullptr;
+
+      // Tenant.
+      struct tenant {
+        // Maximum number of queued buffers and bytes of each queue.
+        size_t max_queued_buffers;
+        size_t max_queued_bytes;
+
+        // Maximum number of bytes on disk (0: no limit) and bytes on disk
+        // (the files which existed before starting are not accounted).
+        size_t max_spill_bytes;
+        std::atomic<int64_t> spilled;
+
+        // Deficit in each lane.
+        int64_t deficit[max_lanes];
+      };
+
+      tenant _M_tenants[max_tenants];
+
+      // Sender whose tenants are accounted the files on disk (the replay
+      // connections remove the files spilled by the sender which started
+      // them).
+      sender* _M_spiller = this;
+
+      // Tenant being served in each lane.
+      unsigned _M_drr[max_lanes];
+
+      // Weights of the lanes (weighted round-robin).
+      unsigned _M_weights[max_lanes];
+      bool _M_weighted = false;
+
+      // Lane being served by the weighted round-robin and batches it can
+      // still send.
+      unsigned _M_rr_lane = 0;
+      unsigned _M_rr_batches = 0;
+
+      // Lane and tenant of the buffers being sent.
+      unsigned _M_lane = 0;
+      unsigned _M_tenant = 0;
+
+      // Posted when a lane becomes non-empty (if there are several lanes).
+      sem_t _M_doorbell;
+
+      // Maximum number of queued buffers and bytes of each lane.
+      size_t _M_max_queued_buffers[max_lanes];
+      size_t _M_max_queued_bytes[max_lanes];
+
+      // Overflow policy and time in milliseconds waiting for room.
+      overflow _M_overflow = overflow::spill;
+      unsigned _M_block_timeout = 0;
+
+      // Maximum number of buffers and bytes sent in a batch.
+      size_t _M_max_batch_buffers = default_max_batch_buffers;
+      size_t _M_max_batch_bytes = default_max_batch_bytes;
+
+      // Linger time in milliseconds and batch size.
+      unsigned _M_linger = 0;
+      size_t _M_batch_bytes = 0;
+
+      // Rate limits (bytes and messages per second) and kernel pacing.
+      uint64_t _M_max_rate_bytes = 0;
+      uint64_t _M_max_rate_messages = 0;
+      bool _M_kernel_pacing = false;
+
+      // Token buckets.
+      token_bucket _M_byte_bucket;
+      token_bucket _M_message_bucket;
+
+      // Sender whose token buckets limit this sender (the replay connections
+      // share the buckets of the sender which started them).
+      sender* _M_limiter = this;
+
+      // Pacing rate of the connection (the share of the byte rate).
+      uint64_t _M_pacing_rate = 0;
+
+      // Is the connection paced by the kernel?
+      bool _M_kernel_paced = false;
+
+      // Framing.
+      framing _M_framing = framing::none;
+
+      // Envelope encoder.
+      envelope::encoder _M_encoder;
+
+      // Sequence number of the next envelope.
+      uint64_t _M_sequence = 1;
+
+      // Envelope header and records.
+      struct iovec _M_iov[1 + envelope::max_records];
+
+      // In-flight (unacknowledged) envelope.
+      struct inflight {
+        // Sequence number.
+        uint64_t sequence;
+
+        // Buffers (nullptr if the envelope carries a file) and their tenant.
+        buffer* first;
+        buffer* last;
+        unsigned tenant;
+
+        // Filename (if the envelope carries a file).
+        char* filename;
+      };
+
+      // Maximum number of in-flight envelopes.
+      size_t _M_window = 0;
+
+      // In-flight envelopes (circular buffer, oldest first).
+      inflight* _M_inflight = nullptr;
+      size_t _M_inflight_head = 0;
+      size_t _M_inflight_count = 0;
+
+      // Session identifier.
+      uint64_t _M_session = 0;
+
+      // Flow control?
+      bool _M_flow_control = false;
+
+      // Credit granted by the receiver (the byte credit might be exceeded by
+      // the last envelope sent).
+      int64_t _M_credit_bytes = 0;
+      int64_t _M_credit_records = 0;
+
+      // Time when credit was last granted (or the connection was
+      // established).
+      time_t _M_last_credit = 0;
+
+      // Received data (acknowledgements).
+      uint8_t _M_recvbuf[1024];
+      size_t _M_recvlen = 0;
+
+      // Envelope decoder (acknowledgements).
+      envelope::decoder _M_decoder;
 
       // State.
       enum class state {
@@ -101,6 +569,120 @@ namespace net {
       // Running?
       bool _M_running = false;
 
+      // Percentage of the time a replay connection can spend sending files
+      // (0: no replay connections).
+      unsigned _M_replay_share = 0;
+
+      // Maximum number of bytes per second sent by the replay connections
+      // (a replay connection: by itself) (0: no limit).
+      uint64_t _M_replay_rate = 0;
+
+      // Senders of the replay connections.
+      sender* _M_replay[max_replay_connections];
+      unsigned _M_nreplay = 0;
+
+      // Is this the sender of a replay connection (it only sends the buffers
+      // on disk)? If so, it sends the files whose name hashes to
+      // '_M_replay_index' modulo '_M_replay_count'.
+      bool _M_replay_only = false;
+      unsigned _M_replay_index = 0;
+      unsigned _M_replay_count = 1;
+
+      // Counters.
+      enum counter {
+        buffers_enqueued,
+        bytes_enqueued,
+        buffers_sent,
+        bytes_sent,
+        buffers_spilled,
+        bytes_spilled,
+        files_replayed,
+        bytes_replayed,
+        buffers_dropped,
+        files_rejected,
+        buffers_rejected,
+        buffers_evicted,
+        buffers_discarded,
+        buffers_over_quota,
+        producer_waits,
+        producer_wait_time,
+        linger_size_flushes,
+        linger_time_flushes,
+        connects,
+        connect_failures,
+        retransmission_failovers,
+        save_time,
+        scan_time,
+        io_time,
+        network_time,
+        throttle_time,
+        ncounters
+      };
+
+      counters<ncounters> _M_counters;
+
+      // Last sample of the TCP connection.
+      enum tcp_gauge {
+        tcp_rtt,
+        tcp_rtt_var,
+        tcp_cwnd,
+        tcp_retransmits,
+        tcp_unacked,
+        tcp_notsent_bytes,
+        tcp_pacing_rate,
+        ntcp_gauges
+      };
+
+      std::atomic<uint64_t> _M_tcp[ntcp_gauges];
+
+      // Time of the last sample of the TCP connection.
+      time_t _M_last_tcp_sample = 0;
+
+      // Maximum number of consecutive retransmission timeouts (0: disabled).
+      unsigned _M_max_retransmits = 0;
+
+      // Record latency histograms?
+      bool _M_record_latency = false;
+
+      // Latency histograms.
+      latency_histograms* _M_latency = nullptr;
+
+      // Transmit timestamps?
+      bool _M_tx_timestamps = false;
+
+      // Have the transmit timestamps been enabled on the connection?
+      bool _M_tx_enabled = false;
+
+      // Bytes written on the connection (modulo 2^32).
+      uint32_t _M_tx_bytes = 0;
+
+      // Buffer waiting for transmit timestamps.
+      struct tx_pending {
+        // Offset of the last byte of the write which carried the buffer.
+        uint32_t end;
+
+        // Time when the buffer was queued.
+        uint64_t timestamp;
+      };
+
+      // Buffers waiting for transmit timestamps (circular buffer, oldest
+      // first).
+      tx_pending* _M_tx_pending = nullptr;
+      size_t _M_tx_pending_head = 0;
+      size_t _M_tx_pending_count = 0;
+
+      // Number of buffers (from the oldest one) which have already received
+      // the scheduler / network device timestamp.
+      size_t _M_tx_scheduled = 0;
+      size_t _M_tx_sent = 0;
+
+      // Get monotonic time in nanoseconds.
+      static uint64_t monotonic_time();
+
+      // Get number of bytes of the buffers.
+      static size_t length(const struct iovec* iov, unsigned iovcnt);
+      static size_t length(const buffer* first, const buffer* last);
+
       // Start.
       bool start(encryption enc, const char* directory);
 
@@ -116,11 +698,26 @@ namespace net {
       // Send (insecure).
       bool send_insecure(const void* buf, size_t len);
 
+      // Send multiple buffers (insecure).
+      bool sendv_insecure(struct iovec* iov, unsigned iovcnt);
+
+      // Receive (insecure).
+      ssize_t recv_insecure(void* buf, size_t len);
+
+      // Wait for the socket to be readable (insecure).
+      bool wait_readable_insecure(int timeout);
+
       // Connected (insecure)?
       bool connected_insecure() const;
 
-      // Connection closed by peer (insecure)?
-      bool connection_closed_by_peer_insecure();
+      // Get TCP information (insecure).
+      bool tcp_info_insecure(socket::tcp_information& info);
+
+      // Cork / uncork (insecure).
+      bool cork_insecure(bool on);
+
+      // Set maximum pacing rate (insecure).
+      bool pace_insecure(uint64_t rate);
 
       // Connect (secure).
       bool connect_secure();
@@ -131,38 +728,256 @@ namespace net {
       // Send (secure).
       bool send_secure(const void* buf, size_t len);
 
+      // Send multiple buffers (secure).
+      bool sendv_secure(struct iovec* iov, unsigned iovcnt);
+
+      // Receive (secure).
+      ssize_t recv_secure(void* buf, size_t len);
+
+      // Wait for the socket to be readable (secure).
+      bool wait_readable_secure(int timeout);
+
       // Connected (secure)?
       bool connected_secure() const;
 
-      // Connection closed by peer (secure)?
-      bool connection_closed_by_peer_secure();
+      // Get TCP information (secure).
+      bool tcp_info_secure(socket::tcp_information& info);
+
+      // Cork / uncork (secure).
+      bool cork_secure(bool on);
+
+      // Set maximum pacing rate (secure).
+      bool pace_secure(uint64_t rate);
+
+      // Connect (insecure, transmit timestamps).
+      bool connect_timestamped();
+
+      // Send (insecure, transmit timestamps).
+      bool send_timestamped(const void* buf, size_t len);
+
+      // Send multiple buffers (insecure, transmit timestamps).
+      bool sendv_timestamped(struct iovec* iov, unsigned iovcnt);
+
+      // Wait for the socket to be readable (insecure, transmit timestamps).
+      bool wait_readable_timestamped(int timeout);
+
+      // Wait for the socket (insecure, transmit timestamps). The transmit
+      // timestamps received meanwhile are processed.
+      bool wait_timestamped(short events, int timeout);
+
+      // Receive and process transmit timestamps (returns the number of
+      // timestamps received).
+      size_t receive_tx_timestamps();
+
+      // Process transmit timestamp ('t': monotonic time).
+      void process_tx_timestamp(const socket::tx_timestamp& ts, uint64_t t);
+
+      // Add the buffers of the last write to the buffers waiting for
+      // transmit timestamps.
+      void track_tx(const buffer* buf, size_t count);
+
+      // Set state.
+      void set_state(state s);
+
+      // Queue buffers applying the overflow policy (returns false if they
+      // have been rejected).
+      bool enqueue(buffer* first,
+                   buffer* last,
+                   size_t count,
+                   size_t bytes,
+                   unsigned lane,
+                   unsigned t);
+
+      // Get queue of the tenant in the lane.
+      buffers& queue(unsigned lane, unsigned t);
+
+      // Get number of buffers queued in the lane.
+      size_t queued(unsigned lane) const;
+
+      // Get a batch of queued buffers from the lanes from 'min_lane' up
+      // (timeout in milliseconds); sets the lane and tenant of the buffers
+      // being sent.
+      size_t pop(buffer*& first,
+                 buffer*& last,
+                 unsigned min_lane,
+                 unsigned timeout);
+
+      // Select the next lane to be served (from 'min_lane' up); returns the
+      // number of lanes if they are all empty.
+      unsigned select_lane(unsigned min_lane);
+
+      // Select the next tenant to be served in the lane (deficit
+      // round-robin); returns the number of tenants if the lane is empty.
+      unsigned select_tenant(unsigned lane);
+
+      // Send the queued buffers of the lanes above the lowest one.
+      bool send_priority_buffers();
+
+      // Are there files in the directory?
+      bool has_files() const;
+
+      // Wait while the replay connection has no files to send (receives
+      // the acknowledgements and closes the connection when idle).
+      bool replay_idle();
+
+      // Is the file sent by this sender (replay connections)?
+      bool replays(const char* name) const;
+
+      // Pause the replay connection after sending a file of 'filesize' bytes
+      // for 'elapsed' nanoseconds, so it doesn't exceed its share of the
+      // time and its rate.
+      void pause_replay(uint64_t elapsed, size_t filesize);
+
+      // Return buffers to the allocator.
+      void discard(buffer* first, buffer* last);
 
       // Connect.
       bool connect();
 
+      // Connect and record the latency.
+      bool connect_timed();
+
+      // Send and record the latency.
+      bool send_timed(const void* buf, size_t len);
+
+      // Send multiple buffers and record the latency.
+      bool sendv_timed(struct iovec* iov, unsigned iovcnt);
+
+      // Record the time the buffers have been queued (the buffers queued
+      // before start() are not timestamped).
+      void record_queue_wait(uint64_t now, const buffer* buf, size_t count);
+
       // Disconnect.
       void disconnect();
 
       // Send.
       bool send(const void* buf, size_t len);
 
+      // Send multiple buffers.
+      bool sendv(struct iovec* iov, unsigned iovcnt);
+
+      // Send queued buffers.
+      bool send_buffers(buffer* first, buffer* last);
+
+      // Send queued buffers in envelopes.
+      bool send_envelopes(buffer* first, buffer* last);
+
+      // Send queued buffers on the corked socket and keep sending the
+      // buffers queued meanwhile until the batch size is reached or the
+      // linger time expires.
+      bool send_lingering(buffer* first, buffer* last);
+
+      // Cork / uncork.
+      bool cork(bool on);
+
+      // Let the kernel pace the new connection (if requested).
+      void pace();
+
+      // Wait until the rate limits allow sending a message of 'len' bytes.
+      void throttle(size_t len);
+
       // Connected?
       bool connected() const;
 
       // Connection closed by peer?
       bool connection_closed_by_peer();
 
+      // Sample the TCP connection (returns false if the connection suffers
+      // persistent retransmissions).
+      bool sample_tcp_connection();
+
+      // Receive acknowledgements and credit (returns false if the connection
+      // has been closed or the peer misbehaved). 'count' is set to the number
+      // of acknowledgements received.
+      bool receive_control(size_t& count);
+
+      // Send hello, wait for the acknowledgement and resend the in-flight
+      // envelopes which have not been acknowledged.
+      bool resume_session();
+
+      // Wait until there is room in the window for a new envelope.
+      bool wait_window();
+
+      // Is there credit for sending a new envelope? (with flow control, a
+      // full window also counts as no credit, so the sender doesn't block
+      // waiting for acknowledgements).
+      bool has_credit() const;
+
+      // Consume credit.
+      void consume_credit(size_t count, size_t bytes);
+
+      // Wait for credit (returns false if the connection has been closed).
+      bool wait_credit(int timeout);
+
+      // Add in-flight envelope.
+      void add_inflight(uint64_t sequence,
+                        buffer* first,
+                        buffer* last,
+                        char* filename);
+
+      // Process acknowledgement.
+      void process_ack(uint64_t sequence);
+
+      // Release in-flight envelope.
+      void release(inflight& envelope);
+
+      // Save in-flight buffers to disk.
+      void save_inflight();
+
+      // Send envelope.
+      bool send_envelope(uint64_t sequence, buffer* first, buffer* last);
+
+      // Send file in an envelope.
+      enum class file_result {
+        sent,
+        ignored,
+        too_big,
+        error
+      };
+
+      file_result send_file_envelope(uint64_t sequence, const char* filename);
+
+      // Leave a file too big to be sent in an envelope on disk, renamed so
+      // it is not sent again.
+      void reject_file(const char* filename);
+
+      // Is the directory entry a buffer on disk to be sent (neither a file
+      // being written nor a rejected file)?
+      static bool spooled(const char* name);
+
       // Send files.
       bool send_files();
 
+      // Scan directory and send files.
+      bool scan_files();
+
       // Send file.
       bool send_file(const char* filename, size_t filesize);
 
-      // Save buffers to disk.
+      // Remove file.
+      void remove_file(const char* filename);
+
+      // Get the tenant a file on disk is accounted to ('_M_ntenants' if
+      // none, see save_buffer()).
+      unsigned file_tenant(const char* filename) const;
+
+      // Set the disk usage of the tenants from the files already on disk.
+      void account_files();
+
+      // Account the time since 'start' as network time, except the file I/O
+      // performed meanwhile ('io' is the file I/O time at 'start'). Returns
+      // the current time.
+      uint64_t account_network_time(uint64_t start, uint64_t io);
+
+      // Save buffers to disk (all queues / queue of the tenant in the lane).
       bool save_buffers();
+      bool save_buffers(unsigned lane, unsigned t);
 
       // Save buffer to disk.
-      bool save_buffer(const buffer* buf, unsigned& count);
+      bool save_buffer(const buffer* buf, unsigned t, unsigned& count);
+
+      // Allocate queues.
+      bool allocate_queues(unsigned nlanes, unsigned ntenants);
 
       // Start routine.
       static void* start_routine(void* arg);
@@ -175,11 +990,235 @@ namespace net {
   inline sender::sender(buffer::allocator& allocator)
     : _M_allocator(allocator)
   {
+    for (size_t i = 0; i < ntcp_gauges; i++) {
+      _M_tcp[i].store(0, std::memory_order_relaxed);
+    }
+
+    for (unsigned i = 0; i < max_lanes; i++) {
+      _M_weights[i] = 1;
+      _M_max_queued_buffers[i] = default_max_queued_buffers;
+      _M_max_queued_bytes[i] = default_max_queued_bytes;
+      _M_drr[i] = 0;
+    }
+
+    for (unsigned i = 0; i < max_tenants; i++) {
+      _M_tenants[i].max_queued_buffers = SIZE_MAX;
+      _M_tenants[i].max_queued_bytes = SIZE_MAX;
+      _M_tenants[i].max_spill_bytes = 0;
+      _M_tenants[i].spilled.store(0, std::memory_order_relaxed);
+
+      for (unsigned j = 0; j < max_lanes; j++) {
+        _M_tenants[i].deficit[j] = 0;
+      }
+    }
+
+    // Allocate queue (start() fails if it couldn't be allocated).
+    allocate_queues(1, 1);
+
+    sem_init(&_M_doorbell, 0, 0);
   }
 
   inline sender::~sender()
   {
     stop();
+
+    if (_M_inflight) {
+      delete [] _M_inflight;
+    }
+
+    if (_M_latency) {
+      delete _M_latency;
+    }
+
+    if (_M_tx_pending) {
+      delete [] _M_tx_pending;
+    }
+
+    if (_M_queues) {
+      delete [] _M_queues;
+    }
+
+    for (unsigned i = 0; i < _M_nreplay; i++) {
+      delete _M_replay[i];
+    }
+
+    sem_destroy(&_M_doorbell);
+  }
+
+  inline void sender::set_framing(framing f)
+  {
+    _M_framing = f;
+  }
+
+  inline void sender::set_window(size_t window)
+  {
+    _M_window = window;
+  }
+
+  inline void sender::set_flow_control(bool on)
+  {
+    _M_flow_control = on;
+  }
+
+  inline void sender::set_max_retransmits(unsigned n)
+  {
+    _M_max_retransmits = n;
+  }
+
+  inline void sender::set_tenant_quota(unsigned tenant,
+                                       size_t buffers,
+                                       size_t bytes,
+                                       size_t spill_bytes)
+  {
+    if (tenant < max_tenants) {
+      _M_tenants[tenant].max_queued_buffers = buffers;
+      _M_tenants[tenant].max_queued_bytes = bytes;
+      _M_tenants[tenant].max_spill_bytes = spill_bytes;
+    }
+  }
+
+  inline void sender::set_max_queued(size_t buffers, size_t bytes)
+  {
+    for (unsigned i = 0; i < max_lanes; i++) {
+      _M_max_queued_buffers[i] = buffers;
+      _M_max_queued_bytes[i] = bytes;
+    }
+  }
+
+  inline void sender::set_max_queued(unsigned priority,
+                                     size_t buffers,
+                                     size_t bytes)
+  {
+    if (priority < max_lanes) {
+      _M_max_queued_buffers[priority] = buffers;
+      _M_max_queued_bytes[priority] = bytes;
+    }
+  }
+
+  inline void sender::set_overflow(overflow policy, unsigned timeout)
+  {
+    _M_overflow = policy;
+    _M_block_timeout = timeout;
+  }
+
+  inline void sender::set_max_batch(size_t buffers, size_t bytes)
+  {
+    _M_max_batch_buffers = buffers;
+    _M_max_batch_bytes = bytes;
+  }
+
+  inline void sender::set_linger(unsigned linger, size_t batch_bytes)
+  {
+    _M_linger = (linger <= max_linger) ? linger : max_linger;
+    _M_batch_bytes = batch_bytes;
+  }
+
+  inline void sender::set_rate_limit(uint64_t bytes_per_second,
+                                     uint64_t messages_per_second,
+                                     bool kernel_pacing)
+  {
+    _M_max_rate_bytes = bytes_per_second;
+    _M_max_rate_messages = messages_per_second;
+    _M_kernel_pacing = kernel_pacing;
+  }
+
+  inline void sender::set_concurrent_replay(unsigned share,
+                                            unsigned connections)
+  {
+    _M_replay_share = (share <= 100) ? share : 100;
+    _M_replay_count = (connections == 0) ?
+                        1 :
+                        (connections <= max_replay_connections) ?
+                          connections :
+                          max_replay_connections;
+  }
+
+  inline void sender::set_replay_rate(uint64_t bytes_per_second)
+  {
+    _M_replay_rate = bytes_per_second;
+  }
+
+  inline void sender::set_latency_histograms(bool on)
+  {
+    _M_record_latency = on;
+  }
+
+  inline void sender::set_tx_timestamps(bool on)
+  {
+    _M_tx_timestamps = on;
+  }
+
+  inline buffers& sender::queue(unsigned lane, unsigned t)
+  {
+    return _M_queues[(lane * _M_ntenants) + t];
+  }
+
+  inline size_t sender::queued(unsigned lane) const
+  {
+    const buffers* queues = _M_queues + (lane * _M_ntenants);
+
+    size_t count = 0;
+    for (unsigned i = 0; i < _M_ntenants; i++) {
+      count += queues[i].count();
+    }
+
+    return count;
+  }
+
+  inline void sender::send(buffer* buf)
+  {
+    send(buf, 0u);
+  }
+
+  inline void sender::send(buffer* first, buffer* last)
+  {
+    send(first, last, 0u);
+  }
+
+  inline bool sender::try_send(buffer* buf)
+  {
+    return try_send(buf, 0u);
+  }
+
+  inline bool sender::try_send(buffer* first, buffer* last)
+  {
+    return try_send(first, last, 0u);
+  }
+
+  inline void sender::latency_histograms::merge(const latency_histograms& other)
+  {
+    queue_wait.merge(other.queue_wait);
+    send.merge(other.send);
+    connect.merge(other.connect);
+    handshake.merge(other.handshake);
+    spill.merge(other.spill);
+    tx_scheduled.merge(other.tx_scheduled);
+    tx_sent.merge(other.tx_sent);
+    tx_acknowledged.merge(other.tx_acknowledged);
+  }
+
+  inline void sender::latency_histograms::reset()
+  {
+    queue_wait.reset();
+    send.reset();
+    connect.reset();
+    handshake.reset();
+    spill.reset();
+    tx_scheduled.reset();
+    tx_sent.reset();
+    tx_acknowledged.reset();
+  }
+
+  inline bool sender::latency(latency_histograms& h) const
+  {
+    if (_M_latency) {
+      h.reset();
+      h.merge(*_M_latency);
+
+      return true;
+    }
+
+    return false;
   }
 
   inline bool net::sender::start(const char* address,
@@ -212,15 +1251,39 @@ namespace net {
     return _M_sock.send(buf, len, socket_timeout);
   }
 
+  inline bool sender::sendv_insecure(struct iovec* iov, unsigned iovcnt)
+  {
+    return _M_sock.writev(iov, iovcnt, socket_timeout);
+  }
+
   inline bool sender::connected_insecure() const
   {
     return (_M_sock.fd() != -1);
   }
 
-  inline bool sender::connection_closed_by_peer_insecure()
+  inline bool sender::tcp_info_insecure(socket::tcp_information& info)
   {
-    uint8_t buf[1024];
-    return (_M_sock.recv(buf, sizeof(buf)) == 0);
+    return _M_sock.get_tcp_info(info);
+  }
+
+  inline bool sender::cork_insecure(bool on)
+  {
+    return on ? _M_sock.cork() : _M_sock.uncork();
+  }
+
+  inline bool sender::pace_insecure(uint64_t rate)
+  {
+    return _M_sock.set_max_pacing_rate(rate);
+  }
+
+  inline ssize_t sender::recv_insecure(void* buf, size_t len)
+  {
+    return _M_sock.recv(buf, len);
+  }
+
+  inline bool sender::wait_readable_insecure(int timeout)
+  {
+    return _M_sock.wait_readable(timeout);
   }
 
   inline bool sender::connect_secure()
@@ -238,15 +1301,53 @@ namespace net {
     return _M_sslsock.send(buf, len, socket_timeout);
   }
 
+  inline bool sender::sendv_secure(struct iovec* iov, unsigned iovcnt)
+  {
+    return _M_sslsock.writev(iov, iovcnt, socket_timeout);
+  }
+
   inline bool sender::connected_secure() const
   {
     return (_M_sslsock.fd() != -1);
   }
 
-  inline bool sender::connection_closed_by_peer_secure()
+  inline bool sender::tcp_info_secure(socket::tcp_information& info)
+  {
+    return _M_sslsock.get_tcp_info(info);
+  }
+
+  inline bool sender::cork_secure(bool on)
+  {
+    return on ? _M_sslsock.cork() : _M_sslsock.uncork();
+  }
+
+  inline bool sender::pace_secure(uint64_t rate)
   {
-    uint8_t buf[1024];
-    return (_M_sslsock.recv(buf, sizeof(buf)) == 0);
+    return _M_sslsock.set_max_pacing_rate(rate);
+  }
+
+  inline ssize_t sender::recv_secure(void* buf, size_t len)
+  {
+    return _M_sslsock.recv(buf, len);
+  }
+
+  inline bool sender::wait_readable_secure(int timeout)
+  {
+    return _M_sslsock.wait_readable(timeout);
+  }
+
+  inline bool sender::send_timestamped(const void* buf, size_t len)
+  {
+    struct iovec iov;
+    iov.iov_base = const_cast<void*>(buf);
+    iov.iov_len = len;
+
+    return sendv_timestamped(&iov, 1);
+  }
+
+  inline bool sender::wait_readable_timestamped(int timeout)
+  {
+    return wait_timestamped(POLLIN | POLLRDHUP, timeout);
   }
 
   inline bool sender::connect()
@@ -258,13 +1359,52 @@ namespace net {
       // Save time of the last socket operation.
       _M_last_socket_operation = _M_current_time;
 
-      // Connect.
-      return (this->*_M_connect)();
+      // If the latency has to be recorded...
+      if (_M_latency) {
+        return connect_timed();
+      }
+
+      // Connect and, if the envelopes have to be acknowledged, resume
+      // session.
+      if (((this->*_M_connect)()) &&
+          ((_M_window == 0) || (resume_session()))) {
+        pace();
+
+        _M_counters.add(connects);
+        trace::record(trace::event::connect);
+
+        return true;
+      }
+
+      _M_counters.add(connect_failures);
+      trace::record(trace::event::connect_failure, errno);
+
+      return false;
+    }
+  }
+
+  inline void sender::set_state(state s)
+  {
+    // If there is a replay connection, it sends the buffers on disk.
+    if ((_M_nreplay > 0) && (s == state::sending_files)) {
+      return;
+    }
+
+    if (s != _M_state) {
+      _M_state = s;
+
+      trace::record((s == state::sending_files) ?
+                      trace::event::sending_files :
+                      trace::event::sending_queued_buffers);
     }
   }
 
   inline void sender::disconnect()
   {
+    if (connected()) {
+      trace::record(trace::event::disconnect);
+    }
+
     (this->*_M_disconnect)();
   }
 
@@ -273,9 +1413,45 @@ namespace net {
     return (this->*_M_connected)();
   }
 
+  inline bool sender::cork(bool on)
+  {
+    return (this->*_M_cork)(on);
+  }
+
+  inline void sender::pace()
+  {
+    _M_kernel_paced = ((_M_kernel_pacing) &&
+                       (_M_pacing_rate > 0) &&
+                       ((this->*_M_pace)(_M_pacing_rate)));
+  }
+
   inline bool sender::connection_closed_by_peer()
   {
-    return (this->*_M_connection_closed_by_peer)();
+    // If the envelopes are not acknowledged...
+    if (_M_window == 0) {
+      // Discard data sent by the peer.
+      uint8_t buf[1024];
+      return ((this->*_M_recv)(buf, sizeof(buf)) == 0);
+    } else {
+      size_t count;
+      return !receive_control(count);
+    }
+  }
+
+  inline bool sender::has_credit() const
+  {
+    return ((!_M_flow_control) ||
+            ((_M_credit_bytes > 0) &&
+             (_M_credit_records > 0) &&
+             (_M_inflight_count < _M_window)));
+  }
+
+  inline void sender::consume_credit(size_t count, size_t bytes)
+  {
+    if (_M_flow_control) {
+      _M_credit_records -= count;
+      _M_credit_bytes -= bytes;
+    }
   }
 
   inline void* sender::start_routine(void* arg)
@@ -283,6 +1459,36 @@ namespace net {
     static_cast<sender*>(arg)->run();
     return nullptr;
   }
+
+  inline uint64_t sender::monotonic_time()
+  {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (static_cast<uint64_t>(ts.tv_sec) * 1000000000ull) + ts.tv_nsec;
+  }
+
+  inline size_t sender::length(const struct iovec* iov, unsigned iovcnt)
+  {
+    size_t len = 0;
+    for (unsigned i = 0; i < iovcnt; i++) {
+      len += iov[i].iov_len;
+    }
+
+    return len;
+  }
+
+  inline size_t sender::length(const buffer* first, const buffer* last)
+  {
+    size_t len = 0;
+    for (; ; first = first->next()) {
+      len += first->length();
+
+      if (first == last) {
+        return len;
+      }
+    }
+  }
 }
 
 #endif // NET_SENDER_H
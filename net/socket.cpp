@@ -1,6 +1,7 @@
 #include <stdio.h>
 #include <poll.h>
 #include <errno.h>
+#include <limits.h>
 #include "net/socket.h"
 
 namespace net {
@@ -365,6 +366,76 @@ ssize_t net::socket::recv(void* buf, size_t len, int timeout)
   } while (true);
 }
 
+ssize_t net::socket::recv_tx_timestamps(tx_timestamp* timestamps, size_t n)
+{
+  size_t count = 0;
+
+  while (count < n) {
+    // The payload is not looped back (SOF_TIMESTAMPING_OPT_TSONLY).
+    uint8_t control[256];
+
+    struct msghdr msg;
+    msg.msg_name = nullptr;
+    msg.msg_namelen = 0;
+    msg.msg_iov = nullptr;
+    msg.msg_iovlen = 0;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    msg.msg_flags = 0;
+
+    // Receive from the error queue.
+    if (::recvmsg(_M_fd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+
+      // If the error queue is empty...
+      if (errno == EAGAIN) {
+        break;
+      }
+
+      return -1;
+    }
+
+    const struct scm_timestamping* tss = nullptr;
+    const struct sock_extended_err* serr = nullptr;
+
+    // Parse control messages.
+    for (struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+         cmsg;
+         cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+      if ((cmsg->cmsg_level == SOL_SOCKET) &&
+          (cmsg->cmsg_type == SCM_TIMESTAMPING)) {
+        tss = reinterpret_cast<const struct scm_timestamping*>(
+                CMSG_DATA(cmsg)
+              );
+      } else if (((cmsg->cmsg_level == SOL_IP) &&
+                  (cmsg->cmsg_type == IP_RECVERR)) ||
+                 ((cmsg->cmsg_level == SOL_IPV6) &&
+                  (cmsg->cmsg_type == IPV6_RECVERR))) {
+        serr = reinterpret_cast<const struct sock_extended_err*>(
+                 CMSG_DATA(cmsg)
+               );
+      }
+    }
+
+    // If the message carries a timestamp...
+    if ((tss) &&
+        (serr) &&
+        (serr->ee_errno == ENOMSG) &&
+        (serr->ee_origin == SO_EE_ORIGIN_TIMESTAMPING)) {
+      // The software timestamp is in the first position.
+      tx_timestamp& ts = timestamps[count++];
+      ts.t = static_cast<tx_timestamp::type>(serr->ee_info);
+      ts.id = serr->ee_data;
+      ts.time = (static_cast<uint64_t>(tss->ts[0].tv_sec) * 1000000000ull) +
+                tss->ts[0].tv_nsec;
+    }
+  }
+
+  return count;
+}
+
 ssize_t net::socket::send(const void* buf, size_t len)
 {
   do {
@@ -411,6 +482,76 @@ bool net::socket::send(const void* buf, size_t len, int timeout)
   return true;
 }
 
+ssize_t net::socket::writev(const struct iovec* iov, unsigned iovcnt)
+{
+  struct msghdr msg;
+  msg.msg_name = nullptr;
+  msg.msg_namelen = 0;
+  msg.msg_iov = const_cast<struct iovec*>(iov);
+  msg.msg_iovlen = (iovcnt <= IOV_MAX) ? iovcnt : IOV_MAX;
+  msg.msg_control = nullptr;
+  msg.msg_controllen = 0;
+  msg.msg_flags = 0;
+
+  do {
+    // Send.
+    const ssize_t ret = ::sendmsg(_M_fd, &msg, MSG_NOSIGNAL);
+
+    // If data has been sent...
+    if (ret >= 0) {
+      return ret;
+    } else {
+      if (errno != EINTR) {
+        return -1;
+      }
+    }
+  } while (true);
+}
+
+bool net::socket::writev(struct iovec* iov, unsigned iovcnt, int timeout)
+{
+  // Skip empty buffers.
+  while ((iovcnt > 0) && (iov->iov_len == 0)) {
+    iov++;
+    iovcnt--;
+  }
+
+  // While there is data to be sent...
+  while (iovcnt > 0) {
+    // Send.
+    ssize_t ret = writev(iov, iovcnt);
+
+    // If some data could be sent...
+    if (ret >= 0) {
+      // Skip the buffers which have been completely sent.
+      while ((iovcnt > 0) && (static_cast<size_t>(ret) >= iov->iov_len)) {
+        ret -= iov->iov_len;
+
+        iov++;
+        iovcnt--;
+      }
+
+      // If a buffer has been partially sent...
+      if (ret > 0) {
+        iov->iov_base = static_cast<uint8_t*>(iov->iov_base) + ret;
+        iov->iov_len -= ret;
+      }
+    } else {
+      // If the send operation would block...
+      if (errno == EAGAIN) {
+        // Wait for the socket to be writable.
+        if (!wait_writable(timeout)) {
+          return false;
+        }
+      } else {
+        return false;
+      }
+    }
+  }
+
+  return true;
+}
+
 bool net::socket::wait_readable(int timeout)
 {
   struct pollfd fd;
@@ -486,28 +627,36 @@ bool net::socket::connect(const struct sockaddr& addr,
   // Connect.
   if (connect(addr, addrlen)) {
     // Get socket error.
-    int error;
+    int error = 0;
     if ((get_socket_error(error)) && (error == 0)) {
       return true;
     } else {
-      // Close socket.
+      // Close socket (reporting the socket error in errno).
       ::close(_M_fd);
       _M_fd = -1;
+
+      if (error != 0) {
+        errno = error;
+      }
     }
   } else {
     // If the connection couldn't be completed immediately...
     if (_M_fd != -1) {
       // Wait for the socket to be writable and, in case of success, check that
       // the socket error is 0.
-      int error;
+      int error = 0;
       if ((wait_writable(timeout)) &&
           (get_socket_error(error)) &&
           (error == 0)) {
         return true;
       } else {
-        // Close socket.
+        // Close socket (reporting the socket error in errno).
         ::close(_M_fd);
         _M_fd = -1;
+
+        if (error != 0) {
+          errno = error;
+        }
       }
     }
   }
@@ -522,18 +671,20 @@ bool net::socket::listen(const sockaddr& addr, socklen_t addrlen)
 
   // Success?
   if (_M_fd != -1) {
-    // Reuse address and port and then bind and listen.
+    // Reuse address and port (not supported by Unix-domain sockets) and
+    // then bind and listen.
     static constexpr const int optval = 1;
-    if ((setsockopt(_M_fd,
-                    SOL_SOCKET,
-                    SO_REUSEADDR,
-                    &optval,
-                    sizeof(int)) == 0) &&
-        (setsockopt(_M_fd,
-                    SOL_SOCKET,
-                    SO_REUSEPORT,
-                    &optval,
-                    sizeof(int)) == 0) &&
+    if (((addr.sa_family == AF_UNIX) ||
+         ((setsockopt(_M_fd,
+                      SOL_SOCKET,
+                      SO_REUSEADDR,
+                      &optval,
+                      sizeof(int)) == 0) &&
+          (setsockopt(_M_fd,
+                      SOL_SOCKET,
+                      SO_REUSEPORT,
+                      &optval,
+                      sizeof(int)) == 0))) &&
         (::bind(_M_fd, &addr, addrlen) == 0) &&
         (::listen(_M_fd, SOMAXCONN) == 0)) {
       return true;
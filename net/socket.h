@@ -1,13 +1,17 @@
 #ifndef NET_SOCKET_H
 #define NET_SOCKET_H
 
+#include <stdint.h>
 #include <string.h>
 #include <unistd.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <sys/un.h>
 #include <netinet/in.h>
 #include <netinet/tcp.h>
 #include <arpa/inet.h>
+#include <linux/net_tstamp.h>
+#include <linux/errqueue.h>
 
 namespace net {
   class socket {
@@ -254,6 +258,10 @@ namespace net {
       // Set send buffer size.
       bool set_sendbuf_size(int size);
 
+      // Set maximum pacing rate in bytes per second (the kernel spreads the
+      // segments over time).
+      bool set_max_pacing_rate(uint64_t rate);
+
       // Get keep-alive.
       bool get_keep_alive(bool& on);
 
@@ -266,6 +274,58 @@ namespace net {
       // Set TCP no delay.
       bool set_tcp_no_delay(bool on);
 
+      // TCP information. The struct tcp_info of <netinet/tcp.h> ends at
+      // tcpi_total_retrans, the fields added by newer kernels are appended
+      // (they are left to zero by older kernels).
+      struct tcp_information {
+        struct tcp_info info;
+
+        uint64_t pacing_rate;      // Bytes per second.
+        uint64_t max_pacing_rate;  // Bytes per second.
+        uint64_t bytes_acked;
+        uint64_t bytes_received;
+        uint32_t segs_out;
+        uint32_t segs_in;
+        uint32_t notsent_bytes;
+        uint32_t min_rtt;          // Microseconds.
+      };
+
+      static_assert(sizeof(struct tcp_info) == 104,
+                    "struct tcp_info doesn't end at tcpi_total_retrans");
+
+      // Get TCP information (TCP sockets only).
+      bool get_tcp_info(tcp_information& info);
+
+      // Transmit timestamp.
+      struct tx_timestamp {
+        enum class type : uint32_t {
+          scheduled = SCM_TSTAMP_SCHED,  // Entered the packet scheduler.
+          sent = SCM_TSTAMP_SND,         // Passed to the network device.
+          acknowledged = SCM_TSTAMP_ACK  // Acknowledged by the peer.
+        };
+
+        type t;
+
+        // Offset of the last byte of the send call, counted from the first
+        // byte sent after enabling the timestamps (modulo 2^32).
+        uint32_t id;
+
+        // Time (CLOCK_REALTIME, nanoseconds).
+        uint64_t time;
+      };
+
+      // Set software transmit timestamps (TCP sockets only). For each send
+      // call, the kernel reports when its last byte entered the packet
+      // scheduler, was passed to the network device and was acknowledged
+      // by the peer. The timestamps are queued in the error queue of the
+      // socket (which makes poll() report POLLERR) and have to be read with
+      // recv_tx_timestamps().
+      bool set_tx_timestamping(bool on);
+
+      // Receive transmit timestamps (doesn't block). Returns the number of
+      // timestamps received (0 if the error queue is empty) or -1 on error.
+      ssize_t recv_tx_timestamps(tx_timestamp* timestamps, size_t n);
+
       // Cork.
       bool cork();
 
@@ -292,6 +352,11 @@ namespace net {
       ssize_t send(const void* buf, size_t len);
       bool send(const void* buf, size_t len, int timeout);
 
+      // Send data from multiple buffers ('iov' might be modified by the
+      // version with timeout).
+      ssize_t writev(const struct iovec* iov, unsigned iovcnt);
+      bool writev(struct iovec* iov, unsigned iovcnt, int timeout);
+
       // Wait for the socket to be readable.
       bool wait_readable(int timeout);
 
@@ -801,6 +866,15 @@ namespace net {
     return (setsockopt(_M_fd, SOL_SOCKET, SO_SNDBUF, &size, sizeof(int)) == 0);
   }
 
+  inline bool socket::set_max_pacing_rate(uint64_t rate)
+  {
+    return (setsockopt(_M_fd,
+                       SOL_SOCKET,
+                       SO_MAX_PACING_RATE,
+                       &rate,
+                       sizeof(uint64_t)) == 0);
+  }
+
   inline bool socket::get_keep_alive(bool& on)
   {
     int optval;
@@ -847,6 +921,31 @@ namespace net {
                        sizeof(int)) == 0);
   }
 
+  inline bool socket::get_tcp_info(tcp_information& info)
+  {
+    memset(&info, 0, sizeof(tcp_information));
+
+    socklen_t optlen = sizeof(tcp_information);
+    return (getsockopt(_M_fd, IPPROTO_TCP, TCP_INFO, &info, &optlen) == 0);
+  }
+
+  inline bool socket::set_tx_timestamping(bool on)
+  {
+    const int optval = on ? (SOF_TIMESTAMPING_TX_SCHED |
+                             SOF_TIMESTAMPING_TX_SOFTWARE |
+                             SOF_TIMESTAMPING_TX_ACK |
+                             SOF_TIMESTAMPING_SOFTWARE |
+                             SOF_TIMESTAMPING_OPT_ID |
+                             SOF_TIMESTAMPING_OPT_TSONLY) :
+                            0;
+
+    return (setsockopt(_M_fd,
+                       SOL_SOCKET,
+                       SO_TIMESTAMPING,
+                       &optval,
+                       sizeof(int)) == 0);
+  }
+
   inline bool socket::cork()
   {
     static constexpr const int optval = 1;
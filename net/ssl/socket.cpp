@@ -1,4 +1,6 @@
+#include <string.h>
 #include <errno.h>
+#include <poll.h>
 #include <openssl/err.h>
 #include "net/ssl/socket.h"
 
@@ -74,18 +76,34 @@ bool net::ssl::socket::shutdown(shutdown_how how, int timeout)
 }
 
 bool net::ssl::socket::handshake(mode m, int timeout)
+{
+  // Prepare and perform TLS/SSL handshake.
+  if (begin_handshake(m)) {
+    if (handshake(timeout)) {
+      return true;
+    }
+
+    SSL_free(_M_ssl);
+    _M_ssl = nullptr;
+  }
+
+  return false;
+}
+
+bool net::ssl::socket::begin_handshake(mode m)
 {
   // Create a new SSL structure.
   if ((_M_ssl = SSL_new(_M_ctx)) != nullptr) {
     if (SSL_set_fd(_M_ssl, _M_sock.fd())) {
       if (m == mode::client) {
         SSL_set_connect_state(_M_ssl);
+
+        // Resume session (if any).
+        if ((!_M_session) || (SSL_set_session(_M_ssl, _M_session) == 1)) {
+          return true;
+        }
       } else {
         SSL_set_accept_state(_M_ssl);
-      }
-
-      // Perform TLS/SSL handshake.
-      if (handshake(timeout)) {
         return true;
       }
     }
@@ -97,6 +115,50 @@ bool net::ssl::socket::handshake(mode m, int timeout)
   return false;
 }
 
+bool net::ssl::socket::handshake(bool& done, short& events)
+{
+  done = false;
+
+  do {
+    // Reset errno.
+    errno = 0;
+
+    // Clear the error queue.
+    ERR_clear_error();
+
+    // Perform TLS/SSL handshake.
+    const int ret = SSL_do_handshake(_M_ssl);
+
+    switch (ret) {
+      case 1:
+        done = true;
+        return true;
+      case 0:
+        return false;
+      default:
+        switch (SSL_get_error(_M_ssl, ret)) {
+          case SSL_ERROR_ZERO_RETURN:
+            return false;
+          case SSL_ERROR_WANT_READ:
+            events = POLLIN;
+            return true;
+          case SSL_ERROR_WANT_WRITE:
+            events = POLLOUT;
+            return true;
+          case SSL_ERROR_SYSCALL:
+            if (errno != EINTR) {
+              return false;
+            }
+
+            break;
+          case SSL_ERROR_SSL:
+          default:
+            return false;
+        }
+    }
+  } while (true);
+}
+
 ssize_t net::ssl::socket::recv(void* buf, size_t len)
 {
   do {
@@ -265,6 +327,59 @@ bool net::ssl::socket::send(const void* buf, size_t len, int timeout)
   } while (true);
 }
 
+bool net::ssl::socket::writev(const struct iovec* iov,
+                              unsigned iovcnt,
+                              int timeout)
+{
+  uint8_t buf[max_record_size];
+  size_t used = 0;
+
+  // For each buffer...
+  for (; iovcnt > 0; iov++, iovcnt--) {
+    const uint8_t* data = static_cast<const uint8_t*>(iov->iov_base);
+    size_t len = iov->iov_len;
+
+    // If the buffer is big...
+    if (len >= max_record_size) {
+      // Flush pending data (if any).
+      if ((used > 0) && (!send(buf, used, timeout))) {
+        return false;
+      }
+
+      used = 0;
+
+      // Send buffer.
+      if (!send(data, len, timeout)) {
+        return false;
+      }
+    } else {
+      while (len > 0) {
+        // Append as much data as possible.
+        const size_t n = (len <= sizeof(buf) - used) ? len :
+                                                       sizeof(buf) - used;
+
+        memcpy(buf + used, data, n);
+        used += n;
+
+        data += n;
+        len -= n;
+
+        // If the record is full...
+        if (used == sizeof(buf)) {
+          if (!send(buf, used, timeout)) {
+            return false;
+          }
+
+          used = 0;
+        }
+      }
+    }
+  }
+
+  // Flush pending data (if any).
+  return ((used == 0) || (send(buf, used, timeout)));
+}
+
 bool net::ssl::socket::connect(int timeout)
 {
   // Perform handshake.
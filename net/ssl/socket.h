@@ -43,6 +43,15 @@ namespace net {
 
         bool handshake(mode m, int timeout);
 
+        // Prepare a handshake performed without blocking (see
+        // handshake(bool&, short&)).
+        bool begin_handshake(mode m);
+
+        // Perform handshake without blocking. Returns false on error. If
+        // 'done' is false, it has to be called again when the socket reports
+        // 'events' (POLLIN or POLLOUT).
+        bool handshake(bool& done, short& events);
+
         // Receive.
         ssize_t recv(void* buf, size_t len);
         ssize_t recv(void* buf, size_t len, int timeout);
@@ -51,10 +60,47 @@ namespace net {
         bool send(const void* buf, size_t len);
         bool send(const void* buf, size_t len, int timeout);
 
+        // Send data from multiple buffers (small buffers are coalesced into
+        // TLS records of up to 'max_record_size' bytes).
+        bool writev(const struct iovec* iov, unsigned iovcnt, int timeout);
+
+        // Wait for the socket to be readable.
+        bool wait_readable(int timeout);
+
         // Get socket descriptor.
         int fd() const;
 
+        // Get TCP information (TCP sockets only).
+        bool get_tcp_info(net::socket::tcp_information& info);
+
+        // Cork.
+        bool cork();
+
+        // Uncork.
+        bool uncork();
+
+        // Set maximum pacing rate in bytes per second.
+        bool set_max_pacing_rate(uint64_t rate);
+
+        // Get session (after the handshake) to resume it in a later
+        // connection. The caller has to free it with SSL_SESSION_free().
+        SSL_SESSION* session() const;
+
+        // Set session to be resumed by the next client handshake (the
+        // session must remain valid until the handshake has been performed).
+        void session(SSL_SESSION* sess);
+
+        // Has the session been resumed?
+        bool session_reused() const;
+
+        // Get negotiated cipher suite and protocol version.
+        const char* cipher() const;
+        const char* version() const;
+
       private:
+        // Maximum TLS record size.
+        static constexpr const size_t max_record_size = 16 * 1024;
+
         // Context object.
         static SSL_CTX* _M_ctx;
 
@@ -62,6 +108,9 @@ namespace net {
 
         SSL* _M_ssl = nullptr;
 
+        // Session to be resumed.
+        SSL_SESSION* _M_session = nullptr;
+
         // Connect.
         bool connect(int timeout);
 
@@ -121,10 +170,61 @@ namespace net {
       return ((_M_sock.connect(addr, timeout)) && (connect(timeout)));
     }
 
+    inline bool socket::wait_readable(int timeout)
+    {
+      // Data might have already been read from the socket and buffered.
+      return ((SSL_pending(_M_ssl) > 0) || (_M_sock.wait_readable(timeout)));
+    }
+
     inline int socket::fd() const
     {
       return _M_sock.fd();
     }
+
+    inline bool socket::get_tcp_info(net::socket::tcp_information& info)
+    {
+      return _M_sock.get_tcp_info(info);
+    }
+
+    inline bool socket::cork()
+    {
+      return _M_sock.cork();
+    }
+
+    inline bool socket::uncork()
+    {
+      return _M_sock.uncork();
+    }
+
+    inline bool socket::set_max_pacing_rate(uint64_t rate)
+    {
+      return _M_sock.set_max_pacing_rate(rate);
+    }
+
+    inline SSL_SESSION* socket::session() const
+    {
+      return _M_ssl ? SSL_get1_session(_M_ssl) : nullptr;
+    }
+
+    inline void socket::session(SSL_SESSION* sess)
+    {
+      _M_session = sess;
+    }
+
+    inline bool socket::session_reused() const
+    {
+      return ((_M_ssl) && (SSL_session_reused(_M_ssl) == 1));
+    }
+
+    inline const char* socket::cipher() const
+    {
+      return _M_ssl ? SSL_get_cipher_name(_M_ssl) : nullptr;
+    }
+
+    inline const char* socket::version() const
+    {
+      return _M_ssl ? SSL_get_version(_M_ssl) : nullptr;
+    }
   }
 }
 
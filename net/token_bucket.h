@@ -0,0 +1,121 @@
+#ifndef NET_TOKEN_BUCKET_H
+#define NET_TOKEN_BUCKET_H
+
+#include <stdint.h>
+#include <pthread.h>
+
+namespace net {
+  // Token bucket.
+  //
+  // The bucket is refilled at 'rate' tokens per second up to 'burst' tokens.
+  // Taking tokens never fails: the bucket can go into debt (so a write
+  // bigger than the bucket is not stalled forever) and delay() reports how
+  // long to wait until the debt has been paid off. Several threads can share
+  // a bucket.
+  class token_bucket {
+    public:
+      // Constructor.
+      token_bucket() = default;
+
+      // Destructor.
+      ~token_bucket();
+
+      // Set rate (tokens per second, 0: no limit) and burst (tokens). The
+      // bucket starts full.
+      void set(uint64_t rate, uint64_t burst);
+
+      // Get rate.
+      uint64_t rate() const;
+
+      // Get time in nanoseconds to wait at 'now' (monotonic time in
+      // nanoseconds) until tokens can be taken.
+      uint64_t delay(uint64_t now);
+
+      // Take tokens.
+      void take(uint64_t n);
+
+    private:
+      // Mutex.
+      pthread_mutex_t _M_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+      // Rate and burst.
+      uint64_t _M_rate = 0;
+      double _M_burst = 0;
+
+      // Tokens (negative: debt).
+      double _M_tokens = 0;
+
+      // Time of the last refill (0: never refilled).
+      uint64_t _M_last = 0;
+
+      // Disable copy constructor and assignment operator.
+      token_bucket(const token_bucket&) = delete;
+      token_bucket& operator=(const token_bucket&) = delete;
+  };
+
+  inline token_bucket::~token_bucket()
+  {
+    pthread_mutex_destroy(&_M_mutex);
+  }
+
+  inline void token_bucket::set(uint64_t rate, uint64_t burst)
+  {
+    _M_rate = rate;
+    _M_burst = burst;
+    _M_tokens = burst;
+    _M_last = 0;
+  }
+
+  inline uint64_t token_bucket::rate() const
+  {
+    return _M_rate;
+  }
+
+  inline uint64_t token_bucket::delay(uint64_t now)
+  {
+    if (_M_rate == 0) {
+      return 0;
+    }
+
+    // Lock mutex.
+    pthread_mutex_lock(&_M_mutex);
+
+    // Refill.
+    if ((_M_last != 0) && (now > _M_last)) {
+      _M_tokens += ((now - _M_last) * 1e-9) * _M_rate;
+
+      if (_M_tokens > _M_burst) {
+        _M_tokens = _M_burst;
+      }
+    }
+
+    if (now > _M_last) {
+      _M_last = now;
+    }
+
+    const uint64_t d = (_M_tokens >= 0) ?
+                         0 :
+                         static_cast<uint64_t>((-_M_tokens * 1e9) / _M_rate) +
+                         1;
+
+    // Unlock mutex.
+    pthread_mutex_unlock(&_M_mutex);
+
+    return d;
+  }
+
+  inline void token_bucket::take(uint64_t n)
+  {
+    if (_M_rate > 0) {
+      // Lock mutex.
+      pthread_mutex_lock(&_M_mutex);
+
+      _M_tokens -= n;
+
+      // Unlock mutex.
+      pthread_mutex_unlock(&_M_mutex);
+    }
+  }
+}
+
+#endif // NET_TOKEN_BUCKET_H
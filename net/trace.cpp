@@ -0,0 +1,242 @@
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <signal.h>
+#include <sys/syscall.h>
+#include <new>
+#include "net/trace.h"
+#include "net/envelope.h"
+
+std::atomic<net::trace::ring*> net::trace::_M_rings(nullptr);
+
+thread_local net::trace::owner net::trace::_M_owner;
+
+const uint64_t net::trace::_M_tsc0 = net::trace::tsc();
+const uint64_t net::trace::_M_time0 = net::trace::monotonic_time();
+
+char net::trace::_M_filename[PATH_MAX];
+
+bool net::trace::dump(int fd)
+{
+  // Compute TSC frequency.
+  const uint64_t now = tsc();
+  const uint64_t elapsed = monotonic_time() - _M_time0;
+
+  const uint64_t hz = (elapsed > 0) ?
+                        static_cast<uint64_t>((now - _M_tsc0) *
+                                              (1e9 / elapsed)) :
+                        1000000000ull;
+
+  struct timespec ts;
+  clock_gettime(CLOCK_REALTIME, &ts);
+
+  // Write header.
+  uint8_t header[header_size];
+  memcpy(header, "NBTR", 4);
+  header[4] = 1;
+  envelope::write64(header + 5, hz);
+  envelope::write64(header + 13, now);
+  envelope::write64(header + 21,
+                    (static_cast<uint64_t>(ts.tv_sec) * 1000000000ull) +
+                    ts.tv_nsec);
+
+  if (!write_all(fd, header, sizeof(header))) {
+    return false;
+  }
+
+  // Dump rings.
+  for (ring* r = _M_rings.load(std::memory_order_acquire); r; r = r->next) {
+    if (!dump(fd, *r)) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+bool net::trace::dump(const char* filename)
+{
+  const int fd = open(filename, O_CREAT | O_TRUNC | O_WRONLY, 0644);
+  if (fd != -1) {
+    const bool ret = dump(fd);
+
+    close(fd);
+
+    return ret;
+  }
+
+  return false;
+}
+
+bool net::trace::dump_on_signal(int signum, const char* filename)
+{
+  const size_t len = strlen(filename);
+  if (len < sizeof(_M_filename)) {
+    memcpy(_M_filename, filename, len + 1);
+
+    struct sigaction act;
+    memset(&act, 0, sizeof(struct sigaction));
+    act.sa_handler = signal_handler;
+    act.sa_flags = SA_RESTART;
+    sigemptyset(&act.sa_mask);
+
+    return (sigaction(signum, &act, nullptr) == 0);
+  }
+
+  return false;
+}
+
+const char* net::trace::name(event e)
+{
+  switch (e) {
+    case event::sending_files:
+      return "sending_files";
+    case event::sending_queued_buffers:
+      return "sending_queued_buffers";
+    case event::connect:
+      return "connect";
+    case event::connect_failure:
+      return "connect_failure";
+    case event::disconnect:
+      return "disconnect";
+    case event::send_error:
+      return "send_error";
+    case event::spill:
+      return "spill";
+    case event::replay:
+      return "replay";
+    case event::retransmission_failover:
+      return "retransmission_failover";
+    default:
+      return nullptr;
+  }
+}
+
+net::trace::ring* net::trace::claim()
+{
+  ring* r;
+
+  // Search a ring which is not in use.
+  for (r = _M_rings.load(std::memory_order_acquire); r; r = r->next) {
+    bool used = false;
+    if (r->used.compare_exchange_strong(used, true)) {
+      break;
+    }
+  }
+
+  // If all the rings are in use...
+  if (!r) {
+    // Allocate ring.
+    if ((r = new (std::nothrow) ring) == nullptr) {
+      return nullptr;
+    }
+
+    for (size_t i = 0; i < ring_size; i++) {
+      r->entries[i].tsc.store(0, std::memory_order_relaxed);
+      r->entries[i].e.store(0, std::memory_order_relaxed);
+      r->entries[i].arg0.store(0, std::memory_order_relaxed);
+      r->entries[i].arg1.store(0, std::memory_order_relaxed);
+    }
+
+    r->head.store(0, std::memory_order_relaxed);
+    r->used.store(true, std::memory_order_relaxed);
+    r->tid.store(static_cast<uint32_t>(syscall(SYS_gettid)),
+                 std::memory_order_relaxed);
+
+    // Add ring to the list.
+    r->next = _M_rings.load(std::memory_order_relaxed);
+    while (!_M_rings.compare_exchange_weak(r->next,
+                                           r,
+                                           std::memory_order_release,
+                                           std::memory_order_relaxed));
+  } else {
+    // Discard the events of the previous owner.
+    r->head.store(0, std::memory_order_release);
+    r->tid.store(static_cast<uint32_t>(syscall(SYS_gettid)),
+                 std::memory_order_relaxed);
+  }
+
+  _M_owner.r = r;
+
+  return r;
+}
+
+bool net::trace::dump(int fd, ring& r)
+{
+  const uint64_t head = r.head.load(std::memory_order_acquire);
+  const uint32_t tid = r.tid.load(std::memory_order_relaxed);
+
+  uint64_t idx = (head > ring_size) ? head - ring_size : 0;
+
+  // While there are events to be dumped...
+  while (idx < head) {
+    uint8_t buf[dump_batch * event_size];
+    uint64_t tscs[dump_batch];
+    uint64_t events[dump_batch];
+    uint64_t args[dump_batch][2];
+
+    // Copy events.
+    const uint64_t first = idx;
+    size_t count = 0;
+    for (; (count < dump_batch) && (idx < head); count++, idx++) {
+      const entry& ent = r.entries[idx & (ring_size - 1)];
+      tscs[count] = ent.tsc.load(std::memory_order_relaxed);
+      events[count] = ent.e.load(std::memory_order_relaxed);
+      args[count][0] = ent.arg0.load(std::memory_order_relaxed);
+      args[count][1] = ent.arg1.load(std::memory_order_relaxed);
+    }
+
+    std::atomic_thread_fence(std::memory_order_acquire);
+
+    // Skip the events which might have been overwritten meanwhile.
+    const uint64_t h = r.head.load(std::memory_order_relaxed);
+    const uint64_t oldest = (h >= ring_size) ? h - ring_size + 1 : 0;
+
+    // Encode events.
+    uint8_t* p = buf;
+    for (size_t i = 0; i < count; i++) {
+      if (first + i >= oldest) {
+        envelope::write32(p, tid);
+        envelope::write64(p + 4, tscs[i]);
+        p[12] = static_cast<uint8_t>(events[i]);
+        envelope::write64(p + 13, args[i][0]);
+        envelope::write64(p + 21, args[i][1]);
+
+        p += event_size;
+      }
+    }
+
+    if (!write_all(fd, buf, p - buf)) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+bool net::trace::write_all(int fd, const void* buf, size_t len)
+{
+  const uint8_t* b = static_cast<const uint8_t*>(buf);
+
+  while (len > 0) {
+    const ssize_t ret = write(fd, b, len);
+    if (ret > 0) {
+      b += ret;
+      len -= ret;
+    } else if ((ret == 0) || (errno != EINTR)) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+void net::trace::signal_handler(int)
+{
+  const int error = errno;
+
+  dump(_M_filename);
+
+  errno = error;
+}
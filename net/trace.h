@@ -0,0 +1,193 @@
+#ifndef NET_TRACE_H
+#define NET_TRACE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <time.h>
+#include <limits.h>
+#include <atomic>
+
+#if defined(__x86_64__) || defined(__i386__)
+  #include <x86intrin.h>
+#endif
+
+namespace net {
+  // Trace.
+  //
+  // Each thread records compact events (sender state switches, connections,
+  // send errors, spill batches...) in its own ring of 'ring_size' events,
+  // overwriting the oldest ones. Recording an event takes no locks and
+  // doesn't allocate memory (except the first event of a thread, which
+  // claims a ring), and the events are timestamped with the TSC. The ring of
+  // a thread which has exited is kept until another thread claims it.
+  //
+  // The rings can be dumped at any time, also from a signal handler (see
+  // dump_on_signal()), and the dumps decoded with trace_decode.
+  //
+  // Dump format (integers in network byte order):
+  //   Header: magic "NBTR" (4 bytes), version (1 byte), TSC frequency (Hz),
+  //   TSC and CLOCK_REALTIME (nanoseconds) at the time of the dump (8 bytes
+  //   each).
+  //   Followed by the events, ring by ring (oldest first): thread id (4
+  //   bytes), TSC (8 bytes), event (1 byte) and arguments (8 bytes each).
+  class trace {
+    public:
+      // Number of events per ring (power of 2).
+      static constexpr const size_t ring_size = 4096;
+
+      // Events.
+      enum class event : uint8_t {
+        sending_files = 1,          // Sender state switch.
+        sending_queued_buffers = 2, // Sender state switch.
+        connect = 3,                // Connection established.
+        connect_failure = 4,        // arg0: errno.
+        disconnect = 5,             // Connection closed.
+        send_error = 6,             // arg0: errno (0 if the peer closed
+                                    // the connection).
+        spill = 7,                  // Buffers written to disk (arg0:
+                                    // buffers, arg1: bytes).
+        replay = 8,                 // File sent from disk (arg0: bytes).
+        retransmission_failover = 9 // Connection closed because of
+                                    // persistent retransmissions.
+      };
+
+      // Size of the dump header and of an event in the dump.
+      static constexpr const size_t header_size = 29;
+      static constexpr const size_t event_size = 29;
+
+      // Record event.
+      static void record(event e, uint64_t arg0 = 0, uint64_t arg1 = 0);
+
+      // Dump the rings (async-signal-safe).
+      static bool dump(int fd);
+      static bool dump(const char* filename);
+
+      // Dump the rings to 'filename' (overwritten) when the signal is
+      // received.
+      static bool dump_on_signal(int signum, const char* filename);
+
+      // Get event name (nullptr if unknown).
+      static const char* name(event e);
+
+      // Get TSC (monotonic time in nanoseconds if not available).
+      static uint64_t tsc();
+
+    private:
+      // Event (the fields are atomic, so the rings can be dumped while the
+      // threads are recording events).
+      struct entry {
+        std::atomic<uint64_t> tsc;
+        std::atomic<uint64_t> e;
+        std::atomic<uint64_t> arg0;
+        std::atomic<uint64_t> arg1;
+      };
+
+      // Ring.
+      struct ring {
+        // Events.
+        entry entries[ring_size];
+
+        // Number of events recorded.
+        std::atomic<uint64_t> head;
+
+        // Thread id of the owner.
+        std::atomic<uint32_t> tid;
+
+        // Is the ring in use?
+        std::atomic<bool> used;
+
+        // Next ring.
+        ring* next;
+      };
+
+      // Rings.
+      static std::atomic<ring*> _M_rings;
+
+      // Ring of the thread (released when the thread exits).
+      struct owner {
+        ring* r = nullptr;
+
+        ~owner();
+      };
+
+      static thread_local owner _M_owner;
+
+      // TSC and monotonic time when the library was loaded (to compute the
+      // TSC frequency).
+      static const uint64_t _M_tsc0;
+      static const uint64_t _M_time0;
+
+      // Dump filename (signal).
+      static char _M_filename[PATH_MAX];
+
+      // Number of events copied at once when dumping.
+      static constexpr const size_t dump_batch = 64;
+
+      // Claim a ring for the calling thread.
+      static ring* claim();
+
+      // Dump ring.
+      static bool dump(int fd, ring& r);
+
+      // Write all the data.
+      static bool write_all(int fd, const void* buf, size_t len);
+
+      // Get monotonic time in nanoseconds.
+      static uint64_t monotonic_time();
+
+      // Signal handler.
+      static void signal_handler(int signum);
+  };
+
+  inline void trace::record(event e, uint64_t arg0, uint64_t arg1)
+  {
+    ring* r = _M_owner.r;
+
+    // If the thread doesn't have a ring yet...
+    if (!r) {
+      if ((r = claim()) == nullptr) {
+        return;
+      }
+    }
+
+    const uint64_t head = r->head.load(std::memory_order_relaxed);
+
+    // The readers discard the events being overwritten (the previous head
+    // is published before the event is overwritten).
+    std::atomic_thread_fence(std::memory_order_release);
+
+    entry& ent = r->entries[head & (ring_size - 1)];
+    ent.tsc.store(tsc(), std::memory_order_relaxed);
+    ent.e.store(static_cast<uint64_t>(e), std::memory_order_relaxed);
+    ent.arg0.store(arg0, std::memory_order_relaxed);
+    ent.arg1.store(arg1, std::memory_order_relaxed);
+
+    r->head.store(head + 1, std::memory_order_release);
+  }
+
+  inline uint64_t trace::tsc()
+  {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return monotonic_time();
+#endif
+  }
+
+  inline uint64_t trace::monotonic_time()
+  {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (static_cast<uint64_t>(ts.tv_sec) * 1000000000ull) + ts.tv_nsec;
+  }
+
+  inline trace::owner::~owner()
+  {
+    if (r) {
+      r->used.store(false, std::memory_order_release);
+    }
+  }
+}
+
+#endif // NET_TRACE_H
@@ -0,0 +1,151 @@
+#include <string.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include "net/zerocopy.h"
+
+bool net::zerocopy::init(socket& sock, size_t size)
+{
+  clear();
+
+  // Allocate copy buffer.
+  if ((_M_copybuf = static_cast<uint8_t*>(malloc(copy_buffer_size))) !=
+      nullptr) {
+    _M_sock = &sock;
+
+    // Round up size to a multiple of the page size.
+    const size_t pagesize = sysconf(_SC_PAGESIZE);
+    size = ((size + pagesize - 1) / pagesize) * pagesize;
+
+    // Map region (if the socket doesn't support it, the data will be
+    // copied).
+    void* region = mmap(nullptr, size, PROT_READ, MAP_SHARED, sock.fd(), 0);
+    if (region != MAP_FAILED) {
+      _M_region = region;
+      _M_size = size;
+    }
+
+    return true;
+  }
+
+  return false;
+}
+
+void net::zerocopy::clear()
+{
+  if (_M_region) {
+    munmap(_M_region, _M_size);
+
+    _M_region = nullptr;
+    _M_size = 0;
+  }
+
+  if (_M_copybuf) {
+    free(_M_copybuf);
+    _M_copybuf = nullptr;
+  }
+
+  _M_sock = nullptr;
+  _M_skip = 0;
+  _M_busy = false;
+}
+
+ssize_t net::zerocopy::recv(view& v)
+{
+  // If the previous view has not been released...
+  if (_M_busy) {
+    errno = EBUSY;
+    return -1;
+  }
+
+  // If there is data which has to be copied...
+  if (_M_skip > 0) {
+    return copy(v, _M_skip);
+  }
+
+  // If zero-copy receive is supported...
+  if (_M_region) {
+    // Clear the request (the kernel rejects unknown flags and reserved
+    // fields which are not zero).
+    struct tcp_zerocopy_receive zc;
+    memset(&zc, 0, sizeof(struct tcp_zerocopy_receive));
+
+    zc.address = reinterpret_cast<uintptr_t>(_M_region);
+    zc.length = _M_size;
+    zc.recv_skip_hint = 0;
+
+    // Map pages.
+    socklen_t optlen = sizeof(zc);
+    if (getsockopt(_M_sock->fd(),
+                   IPPROTO_TCP,
+                   TCP_ZEROCOPY_RECEIVE,
+                   &zc,
+                   &optlen) == 0) {
+      // Save number of bytes which have to be copied.
+      _M_skip = zc.recv_skip_hint;
+
+      // If some pages have been mapped...
+      if (zc.length > 0) {
+        v._M_data = _M_region;
+        v._M_length = zc.length;
+        v._M_mapped = true;
+
+        _M_busy = true;
+
+        return zc.length;
+      }
+    } else if ((errno == EINVAL) || (errno == EOPNOTSUPP)) {
+      // Zero-copy receive is not supported, copy from now on.
+      munmap(_M_region, _M_size);
+
+      _M_region = nullptr;
+      _M_size = 0;
+    } else if (errno != EAGAIN) {
+      return -1;
+    }
+  }
+
+  // Copy data (also detects whether the peer has closed the connection).
+  return copy(v, (_M_skip > 0) ? _M_skip : copy_buffer_size);
+}
+
+ssize_t net::zerocopy::recv(view& v, int timeout)
+{
+  // Receive.
+  const ssize_t ret = recv(v);
+
+  // If the receive operation would block...
+  if ((ret < 0) && (errno == EAGAIN)) {
+    // Wait for the socket to be readable.
+    if (_M_sock->wait_readable(timeout)) {
+      return recv(v);
+    }
+  }
+
+  return ret;
+}
+
+ssize_t net::zerocopy::copy(view& v, size_t len)
+{
+  // Receive.
+  const ssize_t ret = _M_sock->recv(_M_copybuf,
+                                    (len <= copy_buffer_size) ?
+                                      len :
+                                      copy_buffer_size);
+
+  // If data has been received...
+  if (ret > 0) {
+    if (static_cast<size_t>(ret) <= _M_skip) {
+      _M_skip -= ret;
+    } else {
+      _M_skip = 0;
+    }
+
+    v._M_data = _M_copybuf;
+    v._M_length = ret;
+    v._M_mapped = false;
+
+    _M_busy = true;
+  }
+
+  return ret;
+}
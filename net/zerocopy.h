@@ -0,0 +1,142 @@
+#ifndef NET_ZEROCOPY_H
+#define NET_ZEROCOPY_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include "net/socket.h"
+
+namespace net {
+  // Zero-copy TCP receive.
+  //
+  // Uses TCP_ZEROCOPY_RECEIVE to map the payload pages received on a TCP
+  // socket into a read-only region instead of copying them. The data which
+  // cannot be mapped (not page-aligned) is copied into a fallback buffer; if
+  // the socket doesn't support zero-copy receive, all the data is copied.
+  //
+  // There can only be one view at a time: it has to be released before
+  // receiving again.
+  class zerocopy {
+    public:
+      // Read-only view of received data.
+      class view {
+        friend class zerocopy;
+
+        public:
+          // Constructor.
+          view() = default;
+
+          // Get data.
+          const void* data() const;
+
+          // Get data length.
+          size_t length() const;
+
+          // Have the pages been mapped (or has the data been copied)?
+          bool mapped() const;
+
+        private:
+          // Data.
+          const void* _M_data = nullptr;
+
+          // Data length.
+          size_t _M_length = 0;
+
+          // Mapped?
+          bool _M_mapped = false;
+
+          // Disable copy constructor and assignment operator.
+          view(const view&) = delete;
+          view& operator=(const view&) = delete;
+      };
+
+      // Default size of the mapped region.
+      static constexpr const size_t default_region_size = 2 * 1024 * 1024;
+
+      // Size of the copy buffer.
+      static constexpr const size_t copy_buffer_size = 64 * 1024;
+
+      // Constructor.
+      zerocopy() = default;
+
+      // Destructor.
+      ~zerocopy();
+
+      // Initialize (the size of the region is rounded up to a multiple of
+      // the page size).
+      bool init(socket& sock, size_t size = default_region_size);
+
+      // Free resources.
+      void clear();
+
+      // Receive (returns the length of the view, 0 if the peer has closed
+      // the connection or -1 on error).
+      ssize_t recv(view& v);
+      ssize_t recv(view& v, int timeout);
+
+      // Release view (the mapped pages are unmapped by the next receive).
+      void release(view& v);
+
+      // Is zero-copy receive supported by the socket?
+      bool supported() const;
+
+    private:
+      // Socket.
+      socket* _M_sock = nullptr;
+
+      // Mapped region.
+      void* _M_region = nullptr;
+      size_t _M_size = 0;
+
+      // Copy buffer.
+      uint8_t* _M_copybuf = nullptr;
+
+      // Number of bytes which have to be copied before mapping more pages.
+      size_t _M_skip = 0;
+
+      // Is there a view which has not been released?
+      bool _M_busy = false;
+
+      // Copy data.
+      ssize_t copy(view& v, size_t len);
+
+      // Disable copy constructor and assignment operator.
+      zerocopy(const zerocopy&) = delete;
+      zerocopy& operator=(const zerocopy&) = delete;
+  };
+
+  inline const void* zerocopy::view::data() const
+  {
+    return _M_data;
+  }
+
+  inline size_t zerocopy::view::length() const
+  {
+    return _M_length;
+  }
+
+  inline bool zerocopy::view::mapped() const
+  {
+    return _M_mapped;
+  }
+
+  inline zerocopy::~zerocopy()
+  {
+    clear();
+  }
+
+  inline void zerocopy::release(view& v)
+  {
+    v._M_data = nullptr;
+    v._M_length = 0;
+    v._M_mapped = false;
+
+    _M_busy = false;
+  }
+
+  inline bool zerocopy::supported() const
+  {
+    return (_M_region != nullptr);
+  }
+}
+
+#endif // NET_ZEROCOPY_H
@@ -0,0 +1,73 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include "net/sender.h"
+#include "net/exporter.h"
+
+int main(int argc, const char** argv)
+{
+  if (argc == 3) {
+    // Buffer allocator.
+    net::buffer::allocator allocator;
+
+    net::sender sender(allocator);
+    sender.set_latency_histograms(true);
+
+    // Export statistics.
+    net::exporter exporter;
+    exporter.add("test", sender);
+    exporter.add("test", allocator);
+
+    if (!exporter.start(argv[2])) {
+      fprintf(stderr, "Error starting exporter.\n");
+      return -1;
+    }
+
+    // Start sender.
+    if (sender.start(argv[1], net::sender::encryption::no, "buffersdir")) {
+      unsigned count = 0;
+
+      do {
+        printf("Press 'q' to quit (statistics: curl --unix-socket %s "
+               "http://localhost/metrics).\n",
+               argv[2]);
+
+        // Get character.
+        int c = getchar();
+
+        if (c != 'q') {
+          // Get a free buffer.
+          net::buffer* buf = allocator.get();
+          if (buf) {
+            char s[256];
+            size_t len = snprintf(s, sizeof(s), "%06u\n", count++);
+
+            // Initialize buffer.
+            if (buf->init(s, len)) {
+              // Send buffer.
+              sender.send(buf);
+            } else {
+              fprintf(stderr, "Error initializing buffer.\n");
+
+              allocator.put(buf);
+
+              return -1;
+            }
+          } else {
+            fprintf(stderr, "Error getting free buffer.\n");
+            return -1;
+          }
+        } else {
+          break;
+        }
+      } while (true);
+
+      return 0;
+    } else {
+      fprintf(stderr, "Error starting sender.\n");
+    }
+  } else {
+    fprintf(stderr, "Usage: %s <address> <socket-path>\n", argv[0]);
+  }
+
+  return -1;
+}
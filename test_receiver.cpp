@@ -0,0 +1,46 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include "net/receiver.h"
+
+static bool print_envelope(net::envelope::decoder& decoder, void* user);
+
+int main(int argc, const char** argv)
+{
+  if (argc == 2) {
+    // Start receiver.
+    net::receiver receiver;
+    if (receiver.start(argv[1],
+                       net::receiver::encryption::no,
+                       print_envelope,
+                       nullptr)) {
+      printf("Press 'q' to quit.\n");
+
+      // Wait for 'q'.
+      while (getchar() != 'q');
+
+      return 0;
+    } else {
+      fprintf(stderr, "Error starting receiver.\n");
+    }
+  } else {
+    fprintf(stderr, "Usage: %s <address>\n", argv[0]);
+  }
+
+  return -1;
+}
+
+bool print_envelope(net::envelope::decoder& decoder, void* user)
+{
+  printf("Envelope %llu with %zu record(s):\n",
+         static_cast<unsigned long long>(decoder.sequence()),
+         decoder.count());
+
+  // For each record...
+  const void* data;
+  size_t len;
+  while (decoder.next(data, len)) {
+    printf("  %.*s", static_cast<int>(len), static_cast<const char*>(data));
+  }
+
+  return true;
+}
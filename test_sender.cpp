@@ -1,15 +1,28 @@
 #include <stdlib.h>
 #include <stdio.h>
+#include <signal.h>
 #include "net/sender.h"
+#include "net/trace.h"
 
 int main(int argc, const char** argv)
 {
-  if (argc == 2) {
+  if ((argc == 2) || (argc == 3)) {
     // Buffer allocator.
     net::buffer::allocator allocator;
 
-    // Start sender.
     net::sender sender(allocator);
+
+    // If the window has been specified...
+    if (argc == 3) {
+      // Send envelopes and wait for acknowledgements.
+      sender.set_framing(net::sender::framing::envelope);
+      sender.set_window(strtoul(argv[2], nullptr, 10));
+    }
+
+    // Dump the trace on SIGUSR1 (decode with trace_decode).
+    net::trace::dump_on_signal(SIGUSR1, "netbuf.trace");
+
+    // Start sender.
     if (sender.start(argv[1], net::sender::encryption::no, "buffersdir")) {
       unsigned count = 0;
 
@@ -51,7 +64,7 @@ int main(int argc, const char** argv)
       fprintf(stderr, "Error starting sender.\n");
     }
   } else {
-    fprintf(stderr, "Usage: %s <address>\n", argv[0]);
+    fprintf(stderr, "Usage: %s <address> [<window>]\n", argv[0]);
   }
 
   return -1;
@@ -0,0 +1,288 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <atomic>
+#include "net/sender.h"
+#include "net/receiver.h"
+
+// Disk quota of a tenant with a replay connection.
+//
+// Tenant 1 can have 'quota' bytes on disk.
+//
+// First, a file of the tenant filling the quota is left on disk before the
+// sender starts (no receiver is running, so it is not replayed): the file
+// must be accounted to the tenant, so a batch is discarded.
+//
+// Then, with the receiver running, the sender spills a batch which fits in
+// the quota, the replay connection sends and removes the files (and the
+// file left on disk), and the sender spills a second batch: the files
+// removed by the replay connection must have been deducted from the disk
+// usage of the tenant, so none of the second batch is discarded.
+
+static const size_t buffer_size = 100;
+static const size_t batch = 11;
+static const size_t quota = 15 * buffer_size;
+
+static std::atomic<size_t> received(0);
+
+static bool test_backlog(const char* address, const char* directory);
+static bool test_replay(const char* address, const char* directory);
+static void configure(net::sender& sender);
+static bool count_envelope(net::envelope::decoder& decoder, void* user);
+static bool spill(net::buffer::allocator& allocator, net::sender& sender);
+static size_t count_files(const char* directory);
+static bool wait_replayed(const char* directory, size_t expected);
+
+int main(int argc, const char** argv)
+{
+  if (argc != 2) {
+    fprintf(stderr, "Usage: %s <address>\n", argv[0]);
+    return -1;
+  }
+
+  char directory[] = "/tmp/test_spill_quota.XXXXXX";
+  if (!mkdtemp(directory)) {
+    fprintf(stderr, "Error creating directory.\n");
+    return -1;
+  }
+
+  int ret = -1;
+
+  if ((test_backlog(argv[1], directory)) &&
+      (test_replay(argv[1], directory))) {
+    printf("OK.\n");
+    ret = 0;
+  }
+
+  // Remove the files left (if any) and the directory.
+  DIR* dir = opendir(directory);
+  if (dir) {
+    struct dirent* entry;
+    while ((entry = readdir(dir)) != nullptr) {
+      if ((strcmp(entry->d_name, ".") != 0) &&
+          (strcmp(entry->d_name, "..") != 0)) {
+        char filename[PATH_MAX];
+        snprintf(filename,
+                 sizeof(filename),
+                 "%s/%s",
+                 directory,
+                 entry->d_name);
+
+        unlink(filename);
+      }
+    }
+
+    closedir(dir);
+  }
+
+  rmdir(directory);
+
+  return ret;
+}
+
+bool test_backlog(const char* address, const char* directory)
+{
+  // Leave a file of tenant 1 filling the quota on disk (see
+  // sender::save_buffer() for the name).
+  char filename[PATH_MAX];
+  snprintf(filename,
+           sizeof(filename),
+           "%s/20000101-000000_000000.1",
+           directory);
+
+  FILE* file = fopen(filename, "w");
+  if (!file) {
+    fprintf(stderr, "Error creating file.\n");
+    return false;
+  }
+
+  char s[quota];
+  memset(s, 'z', sizeof(s));
+
+  const bool written = (fwrite(s, 1, sizeof(s), file) == sizeof(s));
+
+  if ((fclose(file) != 0) || (!written)) {
+    fprintf(stderr, "Error writing file.\n");
+    return false;
+  }
+
+  bool ret = false;
+
+  // Buffer allocator.
+  net::buffer::allocator allocator;
+
+  net::sender sender(allocator);
+  configure(sender);
+
+  // Start sender (the receiver is not running).
+  if (sender.start(address, net::sender::encryption::no, directory)) {
+    net::sender::statistics st;
+
+    if (spill(allocator, sender)) {
+      sender.stats(st);
+
+      printf("Backlog: spilled: %llu, over quota: %llu.\n",
+             static_cast<unsigned long long>(st.buffers_spilled),
+             static_cast<unsigned long long>(st.buffers_over_quota));
+
+      if ((st.buffers_spilled == 0) && (st.buffers_over_quota == batch)) {
+        ret = true;
+      } else {
+        fprintf(stderr, "The file on disk has not been accounted.\n");
+      }
+    }
+
+    sender.stop();
+  } else {
+    fprintf(stderr, "Error starting sender.\n");
+  }
+
+  return ret;
+}
+
+bool test_replay(const char* address, const char* directory)
+{
+  bool ret = false;
+
+  // Start receiver.
+  net::receiver receiver;
+  if (receiver.start(address,
+                     net::receiver::encryption::no,
+                     count_envelope,
+                     nullptr)) {
+    // Buffer allocator.
+    net::buffer::allocator allocator;
+
+    net::sender sender(allocator);
+    configure(sender);
+
+    // Start sender.
+    if (sender.start(address, net::sender::encryption::no, directory)) {
+      net::sender::statistics st;
+
+      // Let the replay connection send the file left on disk, spill, let
+      // the replay connection send the files and spill again.
+      if ((wait_replayed(directory, 1)) &&
+          (spill(allocator, sender)) &&
+          (wait_replayed(directory, 1 + batch)) &&
+          (spill(allocator, sender))) {
+        sender.stats(st);
+
+        printf("Spilled: %llu, over quota: %llu.\n",
+               static_cast<unsigned long long>(st.buffers_spilled),
+               static_cast<unsigned long long>(st.buffers_over_quota));
+
+        if ((st.buffers_spilled != 2 * batch) ||
+            (st.buffers_over_quota != 0)) {
+          fprintf(stderr, "The disk quota has not been released.\n");
+        } else if (wait_replayed(directory, 1 + 2 * batch)) {
+          ret = true;
+        }
+      }
+
+      sender.stop();
+    } else {
+      fprintf(stderr, "Error starting sender.\n");
+    }
+
+    receiver.stop();
+  } else {
+    fprintf(stderr, "Error starting receiver.\n");
+  }
+
+  return ret;
+}
+
+void configure(net::sender& sender)
+{
+  sender.set_framing(net::sender::framing::envelope);
+  sender.set_window(16);
+  sender.set_tenants(2);
+  sender.set_tenant_quota(1, batch - 1, 1024 * 1024, quota);
+  sender.set_concurrent_replay(100);
+}
+
+bool count_envelope(net::envelope::decoder& decoder, void* user)
+{
+  received += decoder.count();
+  return true;
+}
+
+bool spill(net::buffer::allocator& allocator, net::sender& sender)
+{
+  net::buffer* first = nullptr;
+  net::buffer* last = nullptr;
+
+  // Build a batch exceeding the queue of the tenant (it is spilled).
+  for (size_t i = 0; i < batch; i++) {
+    net::buffer* buf = allocator.get();
+    if (!buf) {
+      fprintf(stderr, "Error getting free buffer.\n");
+      return false;
+    }
+
+    char s[buffer_size];
+    memset(s, 'a' + i, sizeof(s));
+
+    if (!buf->init(s, sizeof(s))) {
+      fprintf(stderr, "Error initializing buffer.\n");
+      allocator.put(buf);
+      return false;
+    }
+
+    if (first) {
+      last->next(buf);
+      buf->prev(last);
+    } else {
+      first = buf;
+      buf->prev(nullptr);
+    }
+
+    buf->next(nullptr);
+    last = buf;
+  }
+
+  sender.send(first, last, 0, 1);
+
+  return true;
+}
+
+size_t count_files(const char* directory)
+{
+  size_t count = 0;
+
+  DIR* dir = opendir(directory);
+  if (dir) {
+    struct dirent* entry;
+    while ((entry = readdir(dir)) != nullptr) {
+      if (entry->d_name[0] != '.') {
+        count++;
+      }
+    }
+
+    closedir(dir);
+  }
+
+  return count;
+}
+
+bool wait_replayed(const char* directory, size_t expected)
+{
+  // Wait up to 10 seconds for the records to be received and the files to
+  // be removed (after being acknowledged).
+  for (unsigned i = 0; i < 100; i++) {
+    if ((received >= expected) && (count_files(directory) == 0)) {
+      return true;
+    }
+
+    usleep(100000);
+  }
+
+  fprintf(stderr,
+          "Timeout waiting for the files to be replayed (received: %zu).\n",
+          received.load());
+
+  return false;
+}
@@ -0,0 +1,221 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include "net/socket.h"
+#include "net/zerocopy.h"
+
+// Zero-copy receive.
+//
+// A thread sends a known pattern on a loopback connection and the data is
+// received with net::zerocopy. The data has to arrive intact and, if the
+// socket supports zero-copy receive, part of it has to have been mapped
+// instead of copied.
+//
+// The pattern is sent with MSG_ZEROCOPY: on the loopback interface, the
+// kernel then delivers the payload in whole pages, which can be mapped (the
+// data copied by a plain send lands in compound pages, which can't).
+
+static const size_t total = 16 * 1024 * 1024;
+static const size_t chunk_size = 256 * 1024;
+
+// Sender thread arguments.
+struct context {
+  const net::socket::address* addr;
+  const uint8_t* data;
+};
+
+static void* send_pattern(void* arg);
+static bool send_chunk(net::socket& sock, const uint8_t* data, size_t len);
+static void drain_notifications(net::socket& sock);
+static uint8_t pattern(size_t offset);
+
+int main(int argc, const char** argv)
+{
+  if (argc != 2) {
+    fprintf(stderr, "Usage: %s <address>\n", argv[0]);
+    return -1;
+  }
+
+  net::socket::address addr;
+  if (!addr.build(argv[1])) {
+    fprintf(stderr, "Invalid address '%s'.\n", argv[1]);
+    return -1;
+  }
+
+  // Listen.
+  net::socket sock;
+  if (!sock.listen(addr)) {
+    fprintf(stderr, "Error listening.\n");
+    return -1;
+  }
+
+  // Allocate page-aligned buffer (it is not modified once filled and is
+  // only freed once all the data has been received, as the kernel reads it
+  // after send() has returned).
+  void* buf;
+  if (posix_memalign(&buf, sysconf(_SC_PAGESIZE), total) != 0) {
+    fprintf(stderr, "Error allocating buffer.\n");
+    return -1;
+  }
+
+  uint8_t* data = static_cast<uint8_t*>(buf);
+  for (size_t i = 0; i < total; i++) {
+    data[i] = pattern(i);
+  }
+
+  // Start sender thread.
+  context ctx;
+  ctx.addr = &addr;
+  ctx.data = data;
+
+  pthread_t thread;
+  if (pthread_create(&thread, nullptr, send_pattern, &ctx) != 0) {
+    fprintf(stderr, "Error creating thread.\n");
+    free(buf);
+    return -1;
+  }
+
+  int ret = -1;
+
+  // Accept connection.
+  net::socket client;
+  if (sock.accept(client, net::socket::default_timeout)) {
+    net::zerocopy zc;
+    if (zc.init(client)) {
+      const bool supported = zc.supported();
+
+      size_t received = 0;
+      size_t mapped = 0;
+      bool error = false;
+
+      // Receive until the peer closes the connection.
+      net::zerocopy::view v;
+      while (zc.recv(v, net::socket::default_timeout) > 0) {
+        // Check data.
+        const uint8_t* data = static_cast<const uint8_t*>(v.data());
+        for (size_t i = 0; i < v.length(); i++) {
+          if (data[i] != pattern(received + i)) {
+            error = true;
+            break;
+          }
+        }
+
+        if (error) {
+          fprintf(stderr, "Invalid data at offset %zu.\n", received);
+          break;
+        }
+
+        if (v.mapped()) {
+          mapped += v.length();
+        }
+
+        received += v.length();
+
+        zc.release(v);
+      }
+
+      printf("Received: %zu, mapped: %zu (zero-copy %ssupported).\n",
+             received,
+             mapped,
+             supported ? "" : "not ");
+
+      if (!error) {
+        if (received != total) {
+          fprintf(stderr, "Expected %zu bytes.\n", total);
+        } else if ((supported) && (!zc.supported())) {
+          fprintf(stderr, "Zero-copy receive has been disabled.\n");
+        } else if ((supported) && (mapped == 0)) {
+          fprintf(stderr, "No pages have been mapped.\n");
+        } else {
+          printf("OK.\n");
+          ret = 0;
+        }
+      }
+    } else {
+      fprintf(stderr, "Error initializing zero-copy receive.\n");
+    }
+  } else {
+    fprintf(stderr, "Error accepting connection.\n");
+  }
+
+  pthread_join(thread, nullptr);
+
+  free(buf);
+
+  return ret;
+}
+
+void* send_pattern(void* arg)
+{
+  const context* ctx = static_cast<const context*>(arg);
+
+  // Connect.
+  net::socket sock;
+  if (sock.connect(*ctx->addr, net::socket::default_timeout)) {
+    // Enable MSG_ZEROCOPY.
+    static const int optval = 1;
+    if (setsockopt(sock.fd(),
+                   SOL_SOCKET,
+                   SO_ZEROCOPY,
+                   &optval,
+                   sizeof(int)) == 0) {
+      // Send the pattern in chunks.
+      for (size_t offset = 0; offset < total; offset += chunk_size) {
+        if (!send_chunk(sock, ctx->data + offset, chunk_size)) {
+          fprintf(stderr, "Error sending.\n");
+          break;
+        }
+      }
+    } else {
+      fprintf(stderr, "Error enabling MSG_ZEROCOPY.\n");
+    }
+  } else {
+    fprintf(stderr, "Error connecting.\n");
+  }
+
+  return nullptr;
+}
+
+bool send_chunk(net::socket& sock, const uint8_t* data, size_t len)
+{
+  do {
+    const ssize_t ret = ::send(sock.fd(), data, len, MSG_ZEROCOPY);
+    if (ret > 0) {
+      data += ret;
+      len -= ret;
+    } else if ((ret < 0) && (errno == ENOBUFS)) {
+      // Too many pending completion notifications.
+      drain_notifications(sock);
+    } else if ((ret < 0) && ((errno == EAGAIN) || (errno == EINTR))) {
+      if (!sock.wait_writable(net::socket::default_timeout)) {
+        return false;
+      }
+    } else {
+      return false;
+    }
+  } while (len > 0);
+
+  return true;
+}
+
+void drain_notifications(net::socket& sock)
+{
+  // Discard the completion notifications queued in the error queue.
+  char control[128];
+
+  struct msghdr msg;
+  memset(&msg, 0, sizeof(struct msghdr));
+
+  do {
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+  } while (recvmsg(sock.fd(), &msg, MSG_ERRQUEUE) >= 0);
+}
+
+uint8_t pattern(size_t offset)
+{
+  // Prime modulus, so that the pattern is not page-periodic.
+  return static_cast<uint8_t>(offset % 251);
+}
@@ -0,0 +1,194 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include "net/trace.h"
+#include "net/envelope.h"
+
+// Trace decoder.
+//
+// Prints the events of a trace dump (see net/trace.h) in chronological
+// order, one per line: UTC time, thread id, event and arguments.
+
+struct event {
+  uint32_t tid;
+  uint64_t tsc;
+  uint8_t e;
+  uint64_t arg0;
+  uint64_t arg1;
+};
+
+static bool load(const char* filename, uint8_t*& data, size_t& len);
+static int compare(const void* a, const void* b);
+static void print(const event& ev, uint64_t hz, uint64_t tsc, uint64_t time);
+
+int main(int argc, const char** argv)
+{
+  if (argc != 2) {
+    fprintf(stderr, "Usage: %s <trace-dump>\n", argv[0]);
+    return -1;
+  }
+
+  uint8_t* data;
+  size_t len;
+  if (!load(argv[1], data, len)) {
+    fprintf(stderr, "Error reading '%s'.\n", argv[1]);
+    return -1;
+  }
+
+  // Check header.
+  if ((len < net::trace::header_size) ||
+      (memcmp(data, "NBTR", 4) != 0) ||
+      (data[4] != 1) ||
+      ((len - net::trace::header_size) % net::trace::event_size != 0)) {
+    fprintf(stderr, "Invalid trace dump.\n");
+    free(data);
+    return -1;
+  }
+
+  const uint64_t hz = net::envelope::read64(data + 5);
+  const uint64_t tsc = net::envelope::read64(data + 13);
+  const uint64_t time = net::envelope::read64(data + 21);
+
+  const size_t count = (len - net::trace::header_size) /
+                       net::trace::event_size;
+
+  event* events = static_cast<event*>(malloc((count > 0 ? count : 1) *
+                                             sizeof(event)));
+  if (!events) {
+    free(data);
+    return -1;
+  }
+
+  // Decode events.
+  const uint8_t* p = data + net::trace::header_size;
+  for (size_t i = 0; i < count; i++, p += net::trace::event_size) {
+    events[i].tid = net::envelope::read32(p);
+    events[i].tsc = net::envelope::read64(p + 4);
+    events[i].e = p[12];
+    events[i].arg0 = net::envelope::read64(p + 13);
+    events[i].arg1 = net::envelope::read64(p + 21);
+  }
+
+  // Sort events by TSC.
+  qsort(events, count, sizeof(event), compare);
+
+  for (size_t i = 0; i < count; i++) {
+    print(events[i], hz, tsc, time);
+  }
+
+  free(events);
+  free(data);
+
+  return 0;
+}
+
+bool load(const char* filename, uint8_t*& data, size_t& len)
+{
+  FILE* file = fopen(filename, "rb");
+  if (!file) {
+    return false;
+  }
+
+  size_t size = 64 * 1024;
+  data = static_cast<uint8_t*>(malloc(size));
+  len = 0;
+
+  while (data) {
+    len += fread(data + len, 1, size - len, file);
+
+    // If the end of the file has been reached...
+    if (len < size) {
+      const bool ret = (ferror(file) == 0);
+
+      fclose(file);
+
+      if (!ret) {
+        free(data);
+      }
+
+      return ret;
+    }
+
+    uint8_t* d = static_cast<uint8_t*>(realloc(data, size * 2));
+    if (!d) {
+      free(data);
+      break;
+    }
+
+    data = d;
+    size *= 2;
+  }
+
+  fclose(file);
+
+  return false;
+}
+
+int compare(const void* a, const void* b)
+{
+  const uint64_t tsca = static_cast<const event*>(a)->tsc;
+  const uint64_t tscb = static_cast<const event*>(b)->tsc;
+
+  return (tsca < tscb) ? -1 : (tsca > tscb);
+}
+
+void print(const event& ev, uint64_t hz, uint64_t tsc, uint64_t time)
+{
+  // Convert TSC to CLOCK_REALTIME.
+  const double ago = (tsc >= ev.tsc) ? (tsc - ev.tsc) * (1e9 / hz) : 0;
+  const uint64_t t = time - static_cast<uint64_t>(ago);
+
+  const time_t sec = t / 1000000000ull;
+  struct tm tm;
+  gmtime_r(&sec, &tm);
+
+  char date[32];
+  strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%S", &tm);
+
+  const net::trace::event e = static_cast<net::trace::event>(ev.e);
+  const char* name = net::trace::name(e);
+
+  printf("%s.%09lluZ [%u] %s",
+         date,
+         static_cast<unsigned long long>(t % 1000000000ull),
+         ev.tid,
+         name ? name : "unknown");
+
+  switch (e) {
+    case net::trace::event::send_error:
+      if (ev.arg0 == 0) {
+        printf(" connection closed by peer");
+        break;
+      }
+
+      // Fall through.
+    case net::trace::event::connect_failure:
+      printf(" errno=%llu (%s)",
+             static_cast<unsigned long long>(ev.arg0),
+             strerror(static_cast<int>(ev.arg0)));
+
+      break;
+    case net::trace::event::spill:
+      printf(" buffers=%llu bytes=%llu",
+             static_cast<unsigned long long>(ev.arg0),
+             static_cast<unsigned long long>(ev.arg1));
+
+      break;
+    case net::trace::event::replay:
+      printf(" bytes=%llu", static_cast<unsigned long long>(ev.arg0));
+      break;
+    default:
+      if (!name) {
+        printf(" (%u) arg0=%llu arg1=%llu",
+               ev.e,
+               static_cast<unsigned long long>(ev.arg0),
+               static_cast<unsigned long long>(ev.arg1));
+      }
+
+      break;
+  }
+
+  printf("\n");
+}